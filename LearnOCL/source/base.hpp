@@ -116,13 +116,18 @@ void checkCLError(int err, int line, char const* file, char const* info)
 	checkCLError(err, __LINE__, __FILE__, #expr)
 
 
-void getCLTime(cl_event E, char const* info)
+// ms between start and end of E, printed with info unless it is NULL
+double getCLTime(cl_event E, char const* info)
 {
 	cl_ulong t, q;
 	clGetEventProfilingInfo(E, CL_PROFILING_COMMAND_START, sizeof(t), &t, NULL);
 	clGetEventProfilingInfo(E, CL_PROFILING_COMMAND_END, sizeof(q), &q, NULL);
-	fprintf(stderr, "%s: %.2fms\n", info, (q - t) * 1e-6);
-	fflush(stderr);
+	if (info)
+	{
+		fprintf(stderr, "%s: %.2fms\n", info, (q - t) * 1e-6);
+		fflush(stderr);
+	}
+	return (q - t) * 1e-6;
 }
 
 
@@ -136,6 +141,9 @@ string loadCLFile(char const* file)
 	fseek(f, 0, SEEK_SET);
 	fread(&K[0], 1, flen, f);
 	fclose(f);
+	// skip the UTF-8 BOM, several files may be joined into one program
+	if (K.compare(0, 3, "\xEF\xBB\xBF") == 0)
+		K.erase(0, 3);
 	return K;
 }
 
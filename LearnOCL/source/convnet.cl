@@ -0,0 +1,128 @@
+﻿// activations are NCHW, the GEMMs are sgemm_nn and gemm_batch of matmul.cl;
+// offsets of an image or a channel plane of the batch are size_t, mad24 is only for indices inside a plane
+
+// col[n][r][p] = X[n][c][y * S - P + i][x * S - P + j] for r = (c * K + i) * K + j and p = y * OW + x,
+// 0 in the padding, so that conv2d of image n is W (Cout x C K K) * col[n] (C K K x OH OW)
+__kernel void im2col(int const C, int const H, int const W, int const K, int const S, int const P,
+	int const OH, int const OW, __global float const* X, __global float* col)
+{
+	int const p = get_global_id(0);
+	int const r = get_global_id(1);
+	int const n = get_global_id(2);
+	if (p >= OH * OW || r >= C * K * K)
+		return;
+	X += (size_t)n * C * H * W;
+	col += (size_t)n * C * K * K * OH * OW;
+	int const c = r / (K * K), i = r / K % K, j = r % K;
+	int const y = p / OW * S - P + i;
+	int const x = p % OW * S - P + j;
+	col[mad24(r, OH * OW, p)] = (0 <= y && y < H && 0 <= x && x < W) ? X[mad24(mad24(c, H, y), W, x)] : 0;
+}
+
+// Y[n][c][p] += bias[c], then max(0, Y) if relu
+__kernel void bias_act(int const C, int const HW, __global float* Y, __global float const* bias, int const relu)
+{
+	int const p = get_global_id(0);
+	int const c = get_global_id(1);
+	int const n = get_global_id(2);
+	if (p >= HW || c >= C)
+		return;
+	__global float* y = Y + ((size_t)n * C + c) * HW + p;
+	float const v = *y + bias[c];
+	*y = relu ? max(v, 0.f) : v;
+}
+
+// max or average (of the pixels inside the image) pooling
+__kernel void pool(int const C, int const H, int const W, int const K, int const S, int const P,
+	int const OH, int const OW, int const avg, __global float const* X, __global float* Y)
+{
+	int const p = get_global_id(0);
+	int const c = get_global_id(1);
+	int const n = get_global_id(2);
+	if (p >= OH * OW || c >= C)
+		return;
+	int const y0 = p / OW * S - P, x0 = p % OW * S - P;
+	int const y1 = min(y0 + K, H), x1 = min(x0 + K, W);
+	float s = avg ? 0 : -INFINITY;
+	X += ((size_t)n * C + c) * H * W;
+	for (int y = max(y0, 0); y < y1; ++y)
+		for (int x = max(x0, 0); x < x1; ++x)
+			s = avg ? s + X[mad24(y, W, x)] : max(s, X[mad24(y, W, x)]);
+	if (avg)
+		s /= (y1 - max(y0, 0)) * (x1 - max(x0, 0));
+	Y[((size_t)n * C + c) * OH * OW + p] = s;
+}
+
+// Winograd F(2 x 2, 3 x 3): every 2 x 2 output tile t = (n * TH + ty) * TW + tx is computed from
+// the 4 x 4 input tile d at (2 ty - P, 2 tx - P) as A^T [(G g G^T) .* (B^T d B)] A,
+// the element-wise products summed over input channels are 16 GEMMs of (Cout x C) * (C x T)
+
+// V[e][c][t] = (B^T d B)[e]
+__kernel void wino_input(int const N, int const C, int const H, int const W, int const P, int const TH, int const TW,
+	__global float const* X, __global float* V)
+{
+	int const t = get_global_id(0);
+	int const c = get_global_id(1);
+	int const T = N * TH * TW;
+	if (t >= T || c >= C)
+		return;
+	int const n = t / (TH * TW), y0 = t / TW % TH * 2 - P, x0 = t % TW * 2 - P;
+	float d[4][4], u[4][4];
+	X += ((size_t)n * C + c) * H * W;
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+		{
+			int const y = y0 + i, x = x0 + j;
+			d[i][j] = (0 <= y && y < H && 0 <= x && x < W) ? X[mad24(y, W, x)] : 0;
+		}
+	// B^T = [1 0 -1 0; 0 1 1 0; 0 -1 1 0; 0 1 0 -1]
+	for (int j = 0; j < 4; ++j)
+	{
+		u[0][j] = d[0][j] - d[2][j];
+		u[1][j] = d[1][j] + d[2][j];
+		u[2][j] = d[2][j] - d[1][j];
+		u[3][j] = d[1][j] - d[3][j];
+	}
+	int const CT = C * T;
+	V += (size_t)c * T + t;
+	for (int i = 0; i < 4; ++i)
+	{
+		V[(i * 4 + 0) * CT] = u[i][0] - u[i][2];
+		V[(i * 4 + 1) * CT] = u[i][1] + u[i][2];
+		V[(i * 4 + 2) * CT] = u[i][2] - u[i][1];
+		V[(i * 4 + 3) * CT] = u[i][1] - u[i][3];
+	}
+}
+
+// Y = A^T m A + bias for M[e][k][t], A^T = [1 1 1 0; 0 1 -1 -1]
+__kernel void wino_output(int const N, int const K, int const OH, int const OW, int const TH, int const TW,
+	__global float const* M, __global float const* bias, int const relu, __global float* Y)
+{
+	int const t = get_global_id(0);
+	int const k = get_global_id(1);
+	int const T = N * TH * TW;
+	if (t >= T || k >= K)
+		return;
+	int const n = t / (TH * TW), y0 = t / TW % TH * 2, x0 = t % TW * 2;
+	int const KT = K * T;
+	float m[4][4], s[2][4];
+	M += (size_t)k * T + t;
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+			m[i][j] = M[(i * 4 + j) * KT];
+	for (int j = 0; j < 4; ++j)
+	{
+		s[0][j] = m[0][j] + m[1][j] + m[2][j];
+		s[1][j] = m[1][j] - m[2][j] - m[3][j];
+	}
+	Y += ((size_t)n * K + k) * OH * OW;
+	for (int i = 0; i < 2; ++i)
+	{
+		float v[2];
+		v[0] = s[i][0] + s[i][1] + s[i][2] + bias[k];
+		v[1] = s[i][1] - s[i][2] - s[i][3] + bias[k];
+		for (int j = 0; j < 2; ++j)
+			if (y0 + i < OH && x0 + j < OW)
+				Y[mad24(y0 + i, OW, x0 + j)] = relu ? max(v[j], 0.f) : v[j];
+	}
+}
@@ -0,0 +1,619 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+#include <cmath>
+#include "base.hpp"
+
+enum LayerType
+{
+	CONV,
+	POOL,
+	FC,
+};
+
+// weight file, int32 and float32 little-endian:
+// "CNET", input C, H, W, number of layers, then every layer starts with its type and is
+// CONV: cin, cout, k, stride, pad, relu, bn, weight[cout][cin][k][k], bias[cout],
+//       if bn gamma[cout], beta[cout], mean[cout], var[cout]
+// POOL: k, stride, pad, avg
+// FC: cin, cout, relu, weight[cout][cin], bias[cout], cin is C * H * W of the previous layer
+struct Layer
+{
+	int type;
+	int cin, cout, k, stride, pad, relu, avg;
+	// output of one image
+	int C, H, W;
+	// batch-norm is folded into weight and bias, U is the Winograd transform of 3 x 3 weights
+	vector<float> weight, bias, U;
+	cl_mem w, b, u;
+	double ms;
+
+	bool winograd() const
+	{
+		return type == CONV && k == 3 && stride == 1;
+	}
+};
+
+static bool readf(FILE* f, vector<float>& v, size_t n)
+{
+	v.resize(n);
+	return fread(v.data(), sizeof(float), n, f) == n;
+}
+
+static void writef(FILE* f, cv::RNG& rng, size_t n, float lo, float hi)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		float const v = rng.uniform(lo, hi);
+		fwrite(&v, sizeof(v), 1, f);
+	}
+}
+
+// a small random VGG-like net for 3 x 64 x 64 input, for when there is no weight file;
+// the im2col of the 256 -> 16 layer is 256 x 3 x 3 x 64 x 64 > 2^23 floats per image
+static void make_net(char const* file)
+{
+	// type, then the ints of the layer
+	int const spec[][8] = {
+		{CONV, 3, 16, 3, 1, 1, 1, 1},
+		{CONV, 16, 256, 1, 1, 0, 1, 0},
+		{CONV, 256, 16, 3, 1, 1, 1, 1},
+		{POOL, 2, 2, 0, 0},
+		{CONV, 16, 32, 3, 1, 1, 1, 1},
+		{CONV, 32, 32, 1, 1, 0, 1, 0},
+		{POOL, 3, 2, 1, 0},
+		{CONV, 32, 64, 3, 2, 1, 1, 1},
+		{POOL, 8, 8, 0, 1},
+		{FC, 64, 10, 0},
+	};
+	int const head[] = {3, 64, 64, static_cast<int>(_countof(spec))};
+	cv::RNG rng(7);
+	FILE* f = fopen(file, "wb");
+	fwrite("CNET", 1, 4, f);
+	fwrite(head, sizeof(int), 4, f);
+	for (size_t i = 0; i < _countof(spec); ++i)
+	{
+		int const* s = spec[i];
+		fwrite(s, sizeof(int), s[0] == CONV ? 8 : s[0] == POOL ? 5 : 4, f);
+		// He initialization keeps the activations around 1
+		if (s[0] == CONV)
+		{
+			float const a = static_cast<float>(sqrt(6.0 / (s[1] * s[3] * s[3])));
+			writef(f, rng, s[2] * s[1] * s[3] * s[3], -a, a);
+			writef(f, rng, s[2], -0.1f, 0.1f);
+			if (s[7])
+			{
+				writef(f, rng, s[2], 0.5f, 1.5f);
+				writef(f, rng, s[2], -0.1f, 0.1f);
+				writef(f, rng, s[2], -0.1f, 0.1f);
+				writef(f, rng, s[2], 0.5f, 1.5f);
+			}
+		}
+		if (s[0] == FC)
+		{
+			float const a = static_cast<float>(sqrt(3.0 / s[1]));
+			writef(f, rng, s[2] * s[1], -a, a);
+			writef(f, rng, s[2], -0.1f, 0.1f);
+		}
+	}
+	fclose(f);
+}
+
+class OCL
+{
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue cqueue;
+	cl_program program;
+	// input of one image
+	int ic, ih, iw;
+	vector<Layer> layer;
+	// input and ping-pong activations, im2col and Winograd buffers for batch
+	int batch;
+	cl_mem act[3], col, wv, wm;
+
+public:
+	OCL();
+	~OCL();
+
+	void init();
+	bool load(char const* file);
+	void prepare(int N);
+	void release();
+	cl_event gemm(bool tb, int M, int N, int K, cl_mem A, int oa, int lda, cl_mem B, int ob, int ldb, cl_mem C, int oc, int ldc);
+	cl_event bias_act(int C, int HW, int N, cl_mem Y, cl_mem bias, int relu);
+	void conv_gemm(Layer const& L, int N, int h, int w, cl_mem X, cl_mem Y, vector<cl_event>& ev);
+	void conv_winograd(Layer const& L, int N, int h, int w, cl_mem X, cl_mem Y, vector<cl_event>& ev);
+	void pool(Layer const& L, int N, int h, int w, cl_mem X, cl_mem Y, vector<cl_event>& ev);
+	cl_mem forward(int N, bool wino);
+	void reference(vector<float> const& X, int N, vector<float>& Y);
+	void work(int N);
+};
+
+OCL::OCL()
+{
+	platform = NULL, device = NULL, context = NULL, cqueue = NULL, program = NULL;
+	ic = ih = iw = batch = 0;
+	act[0] = act[1] = act[2] = col = wv = wm = NULL;
+}
+
+OCL::~OCL()
+{
+	release();
+	for (size_t i = 0; i < layer.size(); ++i)
+	{
+		if (layer[i].w) clReleaseMemObject(layer[i].w);
+		if (layer[i].b) clReleaseMemObject(layer[i].b);
+		if (layer[i].u) clReleaseMemObject(layer[i].u);
+	}
+	if (program) clReleaseProgram(program);
+	if (cqueue) clReleaseCommandQueue(cqueue);
+	if (context) clReleaseContext(context);
+	if (device) clReleaseDevice(device);
+}
+
+void OCL::init()
+{
+	cl_int err;
+	CheckCLError(err = clGetPlatformIDs(1, &platform, NULL));
+	// the CPU device of the platform if there is no GPU
+	if (clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL) != CL_SUCCESS)
+	{
+		CheckCLError(err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &device, NULL));
+	}
+	char info[4096] = {0};
+	clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(info), info, NULL);
+	fprintf(stderr, "device: %s\n", info);
+	cl_context_properties prop[] = {
+		CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(platform),
+		0, 0};
+	CheckCLError(context = clCreateContext(prop, 1, &device, NULL, NULL, &err));
+	CheckCLError(cqueue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
+	string K = string(__FILE__);
+	string G = K.substr(0, K.size() - strlen("convnet.cpp")) + "matmul.cl";
+	K = K.substr(0, K.size() - 4) + ".cl";
+	K = loadCLFile(K.data());
+	G = loadCLFile(G.data());
+	char const* KS[] = {K.data(), G.data()};
+	CheckCLError(program = clCreateProgramWithSource(context, 2, KS, 0, &err));
+	err = clBuildProgram(program, 1, &device, "-cl-std=CL2.0 -cl-kernel-arg-info -Werror -DTS=16 -DWS=4", NULL, NULL);
+	clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
+	fprintf(stderr, "build program with code %d, log:\n%s", err, info);
+	CheckCLError((void)(err));
+}
+
+// reads the weight file, folds batch-norm, transforms the weights of 3 x 3 stride 1 layers and uploads them
+bool OCL::load(char const* file)
+{
+	cl_int err;
+	char magic[4] = {0};
+	int head[4] = {0};
+	FILE* f = fopen(file, "rb");
+	bool ok = f && fread(magic, 1, 4, f) == 4 && memcmp(magic, "CNET", 4) == 0
+		&& fread(head, sizeof(int), 4, f) == 4;
+	ic = head[0], ih = head[1], iw = head[2];
+	int c = ic, h = ih, w = iw;
+	for (int i = 0; ok && i < head[3]; ++i)
+	{
+		Layer L = Layer();
+		int p[7] = {0};
+		ok = fread(&L.type, sizeof(int), 1, f) == 1;
+		if (ok && L.type == CONV)
+		{
+			ok = fread(p, sizeof(int), 7, f) == 7 && p[0] == c;
+			L.cin = p[0], L.cout = p[1], L.k = p[2], L.stride = p[3], L.pad = p[4], L.relu = p[5];
+			int const n = L.cin * L.k * L.k;
+			ok = ok && readf(f, L.weight, static_cast<size_t>(L.cout) * n) && readf(f, L.bias, L.cout);
+			vector<float> gamma, beta, mean, var;
+			if (ok && p[6])
+			{
+				ok = readf(f, gamma, L.cout) && readf(f, beta, L.cout) && readf(f, mean, L.cout) && readf(f, var, L.cout);
+				for (int o = 0; ok && o < L.cout; ++o)
+				{
+					float const s = gamma[o] / sqrt(var[o] + 1e-5f);
+					for (int j = 0; j < n; ++j)
+						L.weight[o * n + j] *= s;
+					L.bias[o] = (L.bias[o] - mean[o]) * s + beta[o];
+				}
+			}
+			L.C = L.cout, L.H = (h + 2 * L.pad - L.k) / L.stride + 1, L.W = (w + 2 * L.pad - L.k) / L.stride + 1;
+		}
+		else if (ok && L.type == POOL)
+		{
+			ok = fread(p, sizeof(int), 4, f) == 4;
+			L.k = p[0], L.stride = p[1], L.pad = p[2], L.avg = p[3];
+			L.C = c, L.H = (h + 2 * L.pad - L.k) / L.stride + 1, L.W = (w + 2 * L.pad - L.k) / L.stride + 1;
+		}
+		else if (ok && L.type == FC)
+		{
+			ok = fread(p, sizeof(int), 3, f) == 3 && p[0] == c * h * w;
+			L.cin = p[0], L.cout = p[1], L.relu = p[2];
+			ok = ok && readf(f, L.weight, static_cast<size_t>(L.cout) * L.cin) && readf(f, L.bias, L.cout);
+			L.C = L.cout, L.H = L.W = 1;
+		}
+		else
+			ok = false;
+		ok = ok && L.H > 0 && L.W > 0;
+		if (!ok)
+			break;
+		// U[e][o][i] = (G g G^T)[e], G = [1 0 0; 1/2 1/2 1/2; 1/2 -1/2 1/2; 0 0 1]
+		if (L.winograd())
+		{
+			float const G[4][3] = {{1, 0, 0}, {0.5f, 0.5f, 0.5f}, {0.5f, -0.5f, 0.5f}, {0, 0, 1}};
+			L.U.resize(16 * L.cout * L.cin);
+			for (int o = 0; o < L.cout; ++o)
+				for (int j = 0; j < L.cin; ++j)
+				{
+					float const* g = &L.weight[(o * L.cin + j) * 9];
+					float t[4][3];
+					for (int a = 0; a < 4; ++a)
+						for (int b = 0; b < 3; ++b)
+							t[a][b] = G[a][0] * g[b] + G[a][1] * g[3 + b] + G[a][2] * g[6 + b];
+					for (int a = 0; a < 4; ++a)
+						for (int b = 0; b < 4; ++b)
+							L.U[((a * 4 + b) * L.cout + o) * L.cin + j] = t[a][0] * G[b][0] + t[a][1] * G[b][1] + t[a][2] * G[b][2];
+				}
+		}
+		if (!L.weight.empty())
+		{
+			CheckCLError(L.w = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, L.weight.size() * sizeof(float), L.weight.data(), &err));
+			CheckCLError(L.b = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, L.bias.size() * sizeof(float), L.bias.data(), &err));
+		}
+		if (!L.U.empty())
+		{
+			CheckCLError(L.u = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, L.U.size() * sizeof(float), L.U.data(), &err));
+		}
+		layer.push_back(L);
+		c = L.C, h = L.H, w = L.W;
+	}
+	if (f)
+		fclose(f);
+	if (!ok)
+		fprintf(stderr, "%s: not a valid weight file (layer %d)\n", file, static_cast<int>(layer.size()));
+	return ok;
+}
+
+// buffers for a batch of N images
+void OCL::prepare(int N)
+{
+	cl_int err;
+	release();
+	size_t na = ic * ih * iw, nc = 1, nv = 1, nm = 1;
+	for (size_t i = 0; i < layer.size(); ++i)
+	{
+		Layer const& L = layer[i];
+		na = max(na, static_cast<size_t>(L.C) * L.H * L.W);
+		if (L.type == CONV)
+			nc = max(nc, static_cast<size_t>(L.cin) * L.k * L.k * L.H * L.W);
+		if (L.winograd())
+		{
+			size_t const T = static_cast<size_t>((L.H + 1) / 2) * ((L.W + 1) / 2) * N;
+			nv = max(nv, 16 * L.cin * T);
+			nm = max(nm, 16 * L.cout * T);
+		}
+	}
+	batch = N;
+	CheckCLError(act[0] = clCreateBuffer(context, CL_MEM_READ_WRITE, na * N * sizeof(float), NULL, &err));
+	CheckCLError(act[1] = clCreateBuffer(context, CL_MEM_READ_WRITE, na * N * sizeof(float), NULL, &err));
+	CheckCLError(act[2] = clCreateBuffer(context, CL_MEM_READ_WRITE, na * N * sizeof(float), NULL, &err));
+	CheckCLError(col = clCreateBuffer(context, CL_MEM_READ_WRITE, nc * N * sizeof(float), NULL, &err));
+	CheckCLError(wv = clCreateBuffer(context, CL_MEM_READ_WRITE, nv * sizeof(float), NULL, &err));
+	CheckCLError(wm = clCreateBuffer(context, CL_MEM_READ_WRITE, nm * sizeof(float), NULL, &err));
+}
+
+void OCL::release()
+{
+	cl_mem* m[] = {act, act + 1, act + 2, &col, &wv, &wm};
+	for (size_t i = 0; i < _countof(m); ++i)
+		if (*m[i])
+		{
+			clReleaseMemObject(*m[i]);
+			*m[i] = NULL;
+		}
+}
+
+// C = A * B or A * B^T with sgemm_nn and sgemm_nt of matmul.cl
+cl_event OCL::gemm(bool tb, int M, int N, int K, cl_mem A, int oa, int lda, cl_mem B, int ob, int ldb, cl_mem C, int oc, int ldc)
+{
+	cl_int err;
+	cl_event e;
+	float const alpha = 1, beta = 0;
+	Vec4z szlocal(16, 16), sztotal((N + 3) / 4, M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel Ker = clCreateKernel(program, tb ? "sgemm_nt" : "sgemm_nn", &err));
+	CheckCLError(err = clSetKernelArg(Ker, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(Ker, 1, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(Ker, 2, sizeof(K), &K));
+	CheckCLError(err = clSetKernelArg(Ker, 3, sizeof(alpha), &alpha));
+	CheckCLError(err = clSetKernelArg(Ker, 4, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(Ker, 5, sizeof(oa), &oa));
+	CheckCLError(err = clSetKernelArg(Ker, 6, sizeof(lda), &lda));
+	CheckCLError(err = clSetKernelArg(Ker, 7, sizeof(B), &B));
+	CheckCLError(err = clSetKernelArg(Ker, 8, sizeof(ob), &ob));
+	CheckCLError(err = clSetKernelArg(Ker, 9, sizeof(ldb), &ldb));
+	CheckCLError(err = clSetKernelArg(Ker, 10, sizeof(beta), &beta));
+	CheckCLError(err = clSetKernelArg(Ker, 11, sizeof(C), &C));
+	CheckCLError(err = clSetKernelArg(Ker, 12, sizeof(oc), &oc));
+	CheckCLError(err = clSetKernelArg(Ker, 13, sizeof(ldc), &ldc));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, Ker, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(Ker));
+	return e;
+}
+
+cl_event OCL::bias_act(int C, int HW, int N, cl_mem Y, cl_mem bias, int relu)
+{
+	cl_int err;
+	cl_event e;
+	Vec4z szlocal(64, 1, 1), sztotal(HW, C, N);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, "bias_act", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(C), &C));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(HW), &HW));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(Y), &Y));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(bias), &bias));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(relu), &relu));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 3, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	return e;
+}
+
+// im2col of the batch, then W * col per image; 1 x 1 stride 1 layers use the input as col
+void OCL::conv_gemm(Layer const& L, int N, int h, int w, cl_mem X, cl_mem Y, vector<cl_event>& ev)
+{
+	cl_int err;
+	int const P = L.H * L.W, R = L.cin * L.k * L.k;
+	bool const direct = L.k == 1 && L.stride == 1 && L.pad == 0;
+	if (!direct)
+	{
+		cl_event e;
+		Vec4z szlocal(64, 1, 1), sztotal(P, R, N);
+		makeDiv(sztotal, szlocal);
+		CheckCLError(cl_kernel K = clCreateKernel(program, "im2col", &err));
+		CheckCLError(err = clSetKernelArg(K, 0, sizeof(L.cin), &L.cin));
+		CheckCLError(err = clSetKernelArg(K, 1, sizeof(h), &h));
+		CheckCLError(err = clSetKernelArg(K, 2, sizeof(w), &w));
+		CheckCLError(err = clSetKernelArg(K, 3, sizeof(L.k), &L.k));
+		CheckCLError(err = clSetKernelArg(K, 4, sizeof(L.stride), &L.stride));
+		CheckCLError(err = clSetKernelArg(K, 5, sizeof(L.pad), &L.pad));
+		CheckCLError(err = clSetKernelArg(K, 6, sizeof(L.H), &L.H));
+		CheckCLError(err = clSetKernelArg(K, 7, sizeof(L.W), &L.W));
+		CheckCLError(err = clSetKernelArg(K, 8, sizeof(X), &X));
+		CheckCLError(err = clSetKernelArg(K, 9, sizeof(col), &col));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 3, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+		CheckCLError(err = clReleaseKernel(K));
+		ev.push_back(e);
+	}
+	for (int n = 0; n < N; ++n)
+		ev.push_back(gemm(false, L.cout, P, R, L.w, 0, R, direct ? X : col, n * R * P, P, Y, n * L.cout * P, P));
+	ev.push_back(bias_act(L.cout, P, N, Y, L.b, L.relu));
+}
+
+// input transform, 16 GEMMs in one gemm_batch, output transform with bias and relu
+void OCL::conv_winograd(Layer const& L, int N, int h, int w, cl_mem X, cl_mem Y, vector<cl_event>& ev)
+{
+	cl_int err;
+	cl_event e;
+	int const TH = (L.H + 1) / 2, TW = (L.W + 1) / 2, T = N * TH * TW;
+	int const sa = L.cout * L.cin, sb = L.cin * T, sc = L.cout * T;
+	Vec4z szlocal(64, 1), sztotal(T, L.cin);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, "wino_input", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(L.cin), &L.cin));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(h), &h));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(w), &w));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(L.pad), &L.pad));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(TH), &TH));
+	CheckCLError(err = clSetKernelArg(K, 6, sizeof(TW), &TW));
+	CheckCLError(err = clSetKernelArg(K, 7, sizeof(X), &X));
+	CheckCLError(err = clSetKernelArg(K, 8, sizeof(wv), &wv));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	ev.push_back(e);
+
+	Vec4z gl(16, 16, 1), gt(T, L.cout, 16);
+	makeDiv(gt, gl);
+	CheckCLError(K = clCreateKernel(program, "gemm_batch", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(L.cout), &L.cout));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(L.cin), &L.cin));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(T), &T));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(L.u), &L.u));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(L.cin), &L.cin));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(sa), &sa));
+	CheckCLError(err = clSetKernelArg(K, 6, sizeof(wv), &wv));
+	CheckCLError(err = clSetKernelArg(K, 7, sizeof(T), &T));
+	CheckCLError(err = clSetKernelArg(K, 8, sizeof(sb), &sb));
+	CheckCLError(err = clSetKernelArg(K, 9, sizeof(wm), &wm));
+	CheckCLError(err = clSetKernelArg(K, 10, sizeof(T), &T));
+	CheckCLError(err = clSetKernelArg(K, 11, sizeof(sc), &sc));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 3, NULL, gt.val, gl.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	ev.push_back(e);
+
+	sztotal[0] = T, sztotal[1] = L.cout;
+	makeDiv(sztotal, szlocal);
+	CheckCLError(K = clCreateKernel(program, "wino_output", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(L.cout), &L.cout));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(L.H), &L.H));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(L.W), &L.W));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(TH), &TH));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(TW), &TW));
+	CheckCLError(err = clSetKernelArg(K, 6, sizeof(wm), &wm));
+	CheckCLError(err = clSetKernelArg(K, 7, sizeof(L.b), &L.b));
+	CheckCLError(err = clSetKernelArg(K, 8, sizeof(L.relu), &L.relu));
+	CheckCLError(err = clSetKernelArg(K, 9, sizeof(Y), &Y));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	ev.push_back(e);
+}
+
+void OCL::pool(Layer const& L, int N, int h, int w, cl_mem X, cl_mem Y, vector<cl_event>& ev)
+{
+	cl_int err;
+	cl_event e;
+	Vec4z szlocal(64, 1, 1), sztotal(L.H * L.W, L.C, N);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, "pool", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(L.C), &L.C));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(h), &h));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(w), &w));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(L.k), &L.k));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(L.stride), &L.stride));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(L.pad), &L.pad));
+	CheckCLError(err = clSetKernelArg(K, 6, sizeof(L.H), &L.H));
+	CheckCLError(err = clSetKernelArg(K, 7, sizeof(L.W), &L.W));
+	CheckCLError(err = clSetKernelArg(K, 8, sizeof(L.avg), &L.avg));
+	CheckCLError(err = clSetKernelArg(K, 9, sizeof(X), &X));
+	CheckCLError(err = clSetKernelArg(K, 10, sizeof(Y), &Y));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 3, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	ev.push_back(e);
+}
+
+// runs the net on the N <= batch images in act[0], returns the buffer holding the output;
+// the kernel time of every layer is added to its ms
+cl_mem OCL::forward(int N, bool wino)
+{
+	cl_int err;
+	int h = ih, w = iw;
+	cl_mem x = act[0];
+	vector<vector<cl_event> > ev(layer.size());
+	for (size_t i = 0; i < layer.size(); ++i)
+	{
+		Layer const& L = layer[i];
+		cl_mem const y = act[1 + i % 2];
+		if (L.type == CONV && wino && L.winograd())
+			conv_winograd(L, N, h, w, x, y, ev[i]);
+		else if (L.type == CONV)
+			conv_gemm(L, N, h, w, x, y, ev[i]);
+		else if (L.type == POOL)
+			pool(L, N, h, w, x, y, ev[i]);
+		else
+		{
+			ev[i].push_back(gemm(true, N, L.cout, L.cin, x, 0, L.cin, L.w, 0, L.cin, y, 0, L.cout));
+			ev[i].push_back(bias_act(L.cout, 1, N, y, L.b, L.relu));
+		}
+		x = y, h = L.H, w = L.W;
+	}
+	CheckCLError(err = clFinish(cqueue));
+	for (size_t i = 0; i < layer.size(); ++i)
+		for (size_t k = 0; k < ev[i].size(); ++k)
+		{
+			layer[i].ms += getCLTime(ev[i][k], NULL);
+			clReleaseEvent(ev[i][k]);
+		}
+	return x;
+}
+
+// the same net on the host, direct convolution
+void OCL::reference(vector<float> const& X, int N, vector<float>& Y)
+{
+	int c = ic, h = ih, w = iw;
+	Y = X;
+	for (size_t i = 0; i < layer.size(); ++i)
+	{
+		Layer const& L = layer[i];
+		vector<float> Z(static_cast<size_t>(N) * L.C * L.H * L.W);
+		for (int n = 0; n < N; ++n)
+		{
+			float const* x = &Y[static_cast<size_t>(n) * c * h * w];
+			float* z = &Z[static_cast<size_t>(n) * L.C * L.H * L.W];
+			if (L.type == FC)
+				for (int o = 0; o < L.cout; ++o)
+				{
+					double s = L.bias[o];
+					for (int j = 0; j < L.cin; ++j)
+						s += static_cast<double>(L.weight[o * L.cin + j]) * x[j];
+					z[o] = static_cast<float>(L.relu ? max(s, 0.0) : s);
+				}
+			else
+				for (int o = 0; o < L.C; ++o)
+					for (int y = 0; y < L.H; ++y)
+						for (int q = 0; q < L.W; ++q)
+						{
+							double s = L.type == CONV ? L.bias[o] : L.avg ? 0 : -HUGE_VAL;
+							int cnt = 0;
+							for (int j = 0; j < (L.type == CONV ? L.cin : 1); ++j)
+								for (int a = 0; a < L.k; ++a)
+									for (int b = 0; b < L.k; ++b)
+									{
+										int const yy = y * L.stride - L.pad + a, xx = q * L.stride - L.pad + b;
+										if (yy < 0 || yy >= h || xx < 0 || xx >= w)
+											continue;
+										if (L.type == CONV)
+											s += static_cast<double>(L.weight[((o * L.cin + j) * L.k + a) * L.k + b]) * x[(j * h + yy) * w + xx];
+										else
+										{
+											float const v = x[(o * h + yy) * w + xx];
+											s = L.avg ? s + v : max(s, static_cast<double>(v));
+											++cnt;
+										}
+									}
+							if (L.type == POOL && L.avg)
+								s /= cnt;
+							z[(o * L.H + y) * L.W + q] = static_cast<float>(L.relu && L.type == CONV ? max(s, 0.0) : s);
+						}
+		}
+		Y.swap(Z);
+		c = L.C, h = L.H, w = L.W;
+	}
+}
+
+// im2col + GEMM everywhere, then Winograd for the 3 x 3 stride 1 layers, at batch 1 and N
+void OCL::work(int N)
+{
+	cl_int err;
+	int const repeat = 10;
+	int const in = ic * ih * iw, out = layer.back().C * layer.back().H * layer.back().W;
+	char const* kind[] = {"conv", "pool", "fc"};
+	vector<float> X(static_cast<size_t>(N) * in), Y(static_cast<size_t>(N) * out), R;
+	cv::RNG rng;
+	for (size_t i = 0; i < X.size(); ++i)
+		X[i] = rng.uniform(0.f, 1.f);
+	reference(X, N, R);
+	prepare(N);
+	CheckCLError(err = clEnqueueWriteBuffer(cqueue, act[0], CL_TRUE, 0, X.size() * sizeof(float), X.data(), 0, NULL, NULL));
+	for (int wino = 0; wino < 2; ++wino)
+	{
+		cl_mem y = forward(N, wino != 0);
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, y, CL_TRUE, 0, Y.size() * sizeof(float), Y.data(), 0, NULL, NULL));
+		double dif = 0, ref = 0;
+		for (size_t i = 0; i < Y.size(); ++i)
+			dif = max(dif, static_cast<double>(fabs(Y[i] - R[i]))), ref = max(ref, static_cast<double>(fabs(R[i])));
+		fprintf(stderr, "\n%s: max difference to the host = %g\n", wino ? "winograd" : "im2col", dif / ref);
+		int const bs[] = {1, N};
+		for (int b = N > 1 ? 0 : 1; b < 2; ++b)
+		{
+			int const n = bs[b];
+			for (size_t i = 0; i < layer.size(); ++i)
+				layer[i].ms = 0;
+			int64_t t = cv::getTickCount();
+			for (int r = 0; r < repeat; ++r)
+				forward(n, wino != 0);
+			double const ms = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency() / repeat;
+			fprintf(stderr, "batch %d: latency %.3fms, %.1f images/s\n", n, ms, n * 1e3 / ms);
+			for (size_t i = 0; i < layer.size(); ++i)
+			{
+				Layer const& L = layer[i];
+				fprintf(stderr, "\t%2d %-4s k%d/s%d %3d x %3d x %3d: %.3fms%s\n", static_cast<int>(i), kind[L.type],
+					L.k, L.stride, L.C, L.H, L.W, L.ms / repeat, wino && L.winograd() ? " winograd" : "");
+			}
+			fflush(stderr);
+		}
+	}
+	release();
+}
+
+// convnet [weights [batch]], a random net is written to convnet.bin without weights
+int main(int argc, char** argv)
+{
+	char const* file = argc > 1 ? argv[1] : "convnet.bin";
+	int const N = argc > 2 ? atoi(argv[2]) : 8;
+	if (argc < 2)
+		make_net(file);
+	OCL ocl;
+	ocl.init();
+	if (ocl.load(file))
+		ocl.work(N);
+	fputs("Game Over!\n", stderr);
+}
@@ -0,0 +1,82 @@
+﻿// flags of trsm_left and trsm_right: T is lower (else upper) triangular,
+// op(T) is T^T, the diagonal of T is taken as 1
+#define T_LOWER 1
+#define T_TRANS 2
+#define T_UNIT 4
+
+inline float tget(__global float const* T, int const ldt, int const trans, int const i, int const j)
+{
+	return trans ? T[mad24(j, ldt, i)] : T[mad24(i, ldt, j)];
+}
+
+// op(T) * X = B for n x n T, X overwrites B, one work-item per column of B
+__kernel void trsm_left(int const n, int const nrhs, __global float const* T, int const ot, int const ldt,
+	__global float* B, int const ob, int const ldb, int const flags)
+{
+	int const w = get_global_id(0);
+	if (w >= nrhs)
+		return;
+	int const trans = (flags & T_TRANS) != 0;
+	int const unit = (flags & T_UNIT) != 0;
+	// op(T) is lower for a lower T or the transpose of an upper one
+	int const lower = ((flags & T_LOWER) != 0) != trans;
+	T += ot, B += ob + w;
+	for (int k = 0; k < n; ++k)
+	{
+		int const i = lower ? k : n - 1 - k;
+		float s = B[mad24(i, ldb, 0)];
+		if (lower)
+			for (int j = 0; j < i; ++j)
+				s -= tget(T, ldt, trans, i, j) * B[mad24(j, ldb, 0)];
+		else
+			for (int j = i + 1; j < n; ++j)
+				s -= tget(T, ldt, trans, i, j) * B[mad24(j, ldb, 0)];
+		B[mad24(i, ldb, 0)] = unit ? s : s / tget(T, ldt, trans, i, i);
+	}
+}
+
+// X * op(T) = B for m x n B, X overwrites B, one work-item per row of B
+__kernel void trsm_right(int const m, int const n, __global float const* T, int const ot, int const ldt,
+	__global float* B, int const ob, int const ldb, int const flags)
+{
+	int const h = get_global_id(0);
+	if (h >= m)
+		return;
+	int const trans = (flags & T_TRANS) != 0;
+	int const unit = (flags & T_UNIT) != 0;
+	int const lower = ((flags & T_LOWER) != 0) != trans;
+	T += ot, B += ob + mad24(h, ldb, 0);
+	// x[j] depends on x[i] with op(T)[i][j] != 0, i < j for an upper op(T)
+	for (int k = 0; k < n; ++k)
+	{
+		int const j = lower ? n - 1 - k : k;
+		float s = B[j];
+		if (lower)
+			for (int i = j + 1; i < n; ++i)
+				s -= B[i] * tget(T, ldt, trans, i, j);
+		else
+			for (int i = 0; i < j; ++i)
+				s -= B[i] * tget(T, ldt, trans, i, j);
+		B[j] = unit ? s : s / tget(T, ldt, trans, j, j);
+	}
+}
+
+// row interchanges k0 .. k1 of getrf: row i swaps with row ipiv[i], in order,
+// one work-item per column, columns [c0, c1) are skipped
+__kernel void laswp(int const ncols, __global float* A, int const lda, int const c0, int const c1,
+	__global int const* ipiv, int const k0, int const k1)
+{
+	int const w = get_global_id(0);
+	if (w >= ncols || (c0 <= w && w < c1))
+		return;
+	for (int i = k0; i < k1; ++i)
+	{
+		int const p = ipiv[i];
+		if (p != i)
+		{
+			float const t = A[mad24(i, lda, w)];
+			A[mad24(i, lda, w)] = A[mad24(p, lda, w)];
+			A[mad24(p, lda, w)] = t;
+		}
+	}
+}
@@ -0,0 +1,410 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+#include <algorithm>
+#include <cmath>
+#include "base.hpp"
+
+// block size of the factorizations and of the blocked triangular solves
+static int NB = 128;
+
+// flags of trsm_left and trsm_right in factor.cl
+enum
+{
+	T_LOWER = 1,
+	T_TRANS = 2,
+	T_UNIT = 4,
+};
+
+// A = L * L^T in place on the lower triangle of the n x n a, false if A is not positive definite
+static bool potrf(float* a, int n, int lda)
+{
+	for (int j = 0; j < n; ++j)
+	{
+		double d = a[j * lda + j];
+		for (int k = 0; k < j; ++k)
+			d -= static_cast<double>(a[j * lda + k]) * a[j * lda + k];
+		if (!(d > 0))
+			return false;
+		double const l = sqrt(d);
+		a[j * lda + j] = static_cast<float>(l);
+		for (int i = j + 1; i < n; ++i)
+		{
+			double s = a[i * lda + j];
+			for (int k = 0; k < j; ++k)
+				s -= static_cast<double>(a[i * lda + k]) * a[j * lda + k];
+			a[i * lda + j] = static_cast<float>(s / l);
+		}
+	}
+	return true;
+}
+
+// P * A = L * U in place for the m x n panel a (m >= n) with partial pivoting,
+// row i was swapped with row ipiv[i] >= i, false if A is singular
+static bool getrf(float* a, int m, int n, int lda, int* ipiv)
+{
+	for (int j = 0; j < n; ++j)
+	{
+		int p = j;
+		for (int i = j + 1; i < m; ++i)
+			if (fabs(a[i * lda + j]) > fabs(a[p * lda + j]))
+				p = i;
+		ipiv[j] = p;
+		if (a[p * lda + j] == 0)
+			return false;
+		if (p != j)
+			for (int k = 0; k < n; ++k)
+				std::swap(a[j * lda + k], a[p * lda + k]);
+		float const r = 1 / a[j * lda + j];
+		for (int i = j + 1; i < m; ++i)
+		{
+			float const l = a[i * lda + j] *= r;
+			for (int k = j + 1; k < n; ++k)
+				a[i * lda + k] -= l * a[j * lda + k];
+		}
+	}
+	return true;
+}
+
+class OCL
+{
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue cqueue;
+	cl_program program;
+
+public:
+	OCL();
+	~OCL();
+
+	void init();
+	void gemm(bool ta, bool tb, int M, int N, int K, float alpha, cl_mem A, int oa, int lda,
+		cl_mem B, int ob, int ldb, float beta, cl_mem C, int oc, int ldc);
+	void trsm(bool left, int flags, int m, int n, cl_mem T, int ot, int ldt, cl_mem B, int ob, int ldb);
+	void laswp(int ncols, cl_mem A, int lda, int c0, int c1, cl_mem ipiv, int k0, int k1);
+	bool cholesky(int n, cl_mem A, double& panel);
+	bool lu(int n, cl_mem A, vector<int>& ipiv, cl_mem dpiv, double& panel);
+	void solve(int flags, int n, int nrhs, cl_mem T, cl_mem B);
+	void work();
+};
+
+OCL::OCL()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+OCL::~OCL()
+{
+	if (program) clReleaseProgram(program);
+	if (cqueue) clReleaseCommandQueue(cqueue);
+	if (context) clReleaseContext(context);
+	if (device) clReleaseDevice(device);
+}
+
+void OCL::init()
+{
+	cl_int err;
+	CheckCLError(err = clGetPlatformIDs(1, &platform, NULL));
+	CheckCLError(err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL));
+	cl_context_properties prop[] = {
+		CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(platform),
+		0, 0};
+	CheckCLError(context = clCreateContext(prop, 1, &device, NULL, NULL, &err));
+	CheckCLError(cqueue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
+	char info[4096] = {0};
+	// trailing updates are the sgemm kernels of matmul.cl
+	string K = string(__FILE__);
+	string G = K.substr(0, K.size() - strlen("factor.cpp")) + "matmul.cl";
+	K = K.substr(0, K.size() - 4) + ".cl";
+	K = loadCLFile(K.data());
+	G = loadCLFile(G.data());
+	char const* KS[] = {K.data(), G.data()};
+	CheckCLError(program = clCreateProgramWithSource(context, 2, KS, 0, &err));
+	err = clBuildProgram(program, 1, &device, "-cl-std=CL2.0 -cl-kernel-arg-info -Werror -DTS=16 -DWS=4", NULL, NULL);
+	clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
+	fprintf(stderr, "build program with code %d, log:\n%s", err, info);
+	CheckCLError((void)(err));
+	CheckCLError(err = clGetProgramInfo(program, CL_PROGRAM_KERNEL_NAMES, sizeof(info), info, NULL));
+	fprintf(stderr, "kernel names: %s\n", info);
+}
+
+// C = alpha * op(A) * op(B) + beta * C with sgemm_nn .. sgemm_tt, as OCL::sgemm in matmul.cpp
+void OCL::gemm(bool ta, bool tb, int M, int N, int K, float alpha, cl_mem A, int oa, int lda,
+	cl_mem B, int ob, int ldb, float beta, cl_mem C, int oc, int ldc)
+{
+	cl_int err;
+	char const* name[] = {"sgemm_nn", "sgemm_nt", "sgemm_tn", "sgemm_tt"};
+	Vec4z szlocal(16, 16), sztotal((N + 3) / 4, M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel Ker = clCreateKernel(program, name[ta * 2 + tb], &err));
+	CheckCLError(err = clSetKernelArg(Ker, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(Ker, 1, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(Ker, 2, sizeof(K), &K));
+	CheckCLError(err = clSetKernelArg(Ker, 3, sizeof(alpha), &alpha));
+	CheckCLError(err = clSetKernelArg(Ker, 4, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(Ker, 5, sizeof(oa), &oa));
+	CheckCLError(err = clSetKernelArg(Ker, 6, sizeof(lda), &lda));
+	CheckCLError(err = clSetKernelArg(Ker, 7, sizeof(B), &B));
+	CheckCLError(err = clSetKernelArg(Ker, 8, sizeof(ob), &ob));
+	CheckCLError(err = clSetKernelArg(Ker, 9, sizeof(ldb), &ldb));
+	CheckCLError(err = clSetKernelArg(Ker, 10, sizeof(beta), &beta));
+	CheckCLError(err = clSetKernelArg(Ker, 11, sizeof(C), &C));
+	CheckCLError(err = clSetKernelArg(Ker, 12, sizeof(oc), &oc));
+	CheckCLError(err = clSetKernelArg(Ker, 13, sizeof(ldc), &ldc));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, Ker, 2, NULL, sztotal.val, szlocal.val, 0, NULL, NULL));
+	CheckCLError(err = clReleaseKernel(Ker));
+}
+
+// op(T) * X = B (left) or X * op(T) = B for the m x n B, T is m x m or n x n
+void OCL::trsm(bool left, int flags, int m, int n, cl_mem T, int ot, int ldt, cl_mem B, int ob, int ldb)
+{
+	cl_int err;
+	Vec4z szlocal(64), sztotal(left ? n : m);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, left ? "trsm_left" : "trsm_right", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(m), &m));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(n), &n));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(T), &T));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(ot), &ot));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(ldt), &ldt));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(B), &B));
+	CheckCLError(err = clSetKernelArg(K, 6, sizeof(ob), &ob));
+	CheckCLError(err = clSetKernelArg(K, 7, sizeof(ldb), &ldb));
+	CheckCLError(err = clSetKernelArg(K, 8, sizeof(flags), &flags));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, sztotal.val, szlocal.val, 0, NULL, NULL));
+	CheckCLError(err = clReleaseKernel(K));
+}
+
+void OCL::laswp(int ncols, cl_mem A, int lda, int c0, int c1, cl_mem ipiv, int k0, int k1)
+{
+	cl_int err;
+	Vec4z szlocal(64), sztotal(ncols);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, "laswp", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(ncols), &ncols));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(lda), &lda));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(c0), &c0));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(c1), &c1));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(ipiv), &ipiv));
+	CheckCLError(err = clSetKernelArg(K, 6, sizeof(k0), &k0));
+	CheckCLError(err = clSetKernelArg(K, 7, sizeof(k1), &k1));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, sztotal.val, szlocal.val, 0, NULL, NULL));
+	CheckCLError(err = clReleaseKernel(K));
+}
+
+// right-looking blocked A = L * L^T in place, the upper triangle is left undefined.
+// Diagonal blocks are factored on the host; with look-ahead the next block column is updated first
+// so that its diagonal block is factored while the device updates the rest of the trailing matrix.
+// panel is the host time spent on the diagonal blocks
+bool OCL::cholesky(int n, cl_mem A, double& panel)
+{
+	cl_int err;
+	cl_event r = NULL;
+	Mat D(NB, NB, CV_32F);
+	size_t const zero[3] = {0, 0, 0};
+	size_t const bpitch = n * sizeof(float), hpitch = NB * sizeof(float);
+	panel = 0;
+	{
+		int const nb = min(NB, n);
+		size_t const region[3] = {nb * sizeof(float), static_cast<size_t>(nb), 1};
+		CheckCLError(err = clEnqueueReadBufferRect(cqueue, A, CL_TRUE, zero, zero, region, bpitch, 0, hpitch, 0, D.data, 0, NULL, NULL));
+	}
+	for (int k = 0; k < n; k += NB)
+	{
+		int const nb = min(NB, n - k), rest = n - k - nb;
+		size_t const origin[3] = {k * sizeof(float), static_cast<size_t>(k), 0};
+		size_t const region[3] = {nb * sizeof(float), static_cast<size_t>(nb), 1};
+		if (r)
+		{
+			CheckCLError(err = clWaitForEvents(1, &r));
+			CheckCLError(err = clReleaseEvent(r));
+			r = NULL;
+		}
+		int64_t t = cv::getTickCount();
+		bool const spd = potrf(D.ptr<float>(), nb, NB);
+		panel += (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+		if (!spd)
+		{
+			clFinish(cqueue);
+			return false;
+		}
+		CheckCLError(err = clEnqueueWriteBufferRect(cqueue, A, CL_FALSE, origin, zero, region, bpitch, 0, hpitch, 0, D.data, 0, NULL, NULL));
+		if (!rest)
+			break;
+		// L21 = A21 * L11^-T
+		int const o21 = (k + nb) * n + k;
+		trsm(false, T_LOWER | T_TRANS, rest, nb, A, k * n + k, n, A, o21, n);
+		// A22 -= L21 * L21^T, the next block column first,
+		// the upper triangle is updated as well though it is never read
+		int const nb2 = min(NB, rest), k2 = k + nb;
+		size_t const origin2[3] = {k2 * sizeof(float), static_cast<size_t>(k2), 0};
+		size_t const region2[3] = {nb2 * sizeof(float), static_cast<size_t>(nb2), 1};
+		gemm(false, true, rest, nb2, nb, -1, A, o21, n, A, o21, n, 1, A, k2 * n + k2, n);
+		CheckCLError(err = clEnqueueReadBufferRect(cqueue, A, CL_FALSE, origin2, zero, region2, bpitch, 0, hpitch, 0, D.data, 0, NULL, &r));
+		if (rest > nb2)
+		{
+			int const o = o21 + nb2 * n;
+			gemm(false, true, rest - nb2, rest - nb2, nb, -1, A, o, n, A, o, n, 1, A, (k2 + nb2) * n + k2 + nb2, n);
+		}
+		clFlush(cqueue);
+	}
+	CheckCLError(err = clFinish(cqueue));
+	return true;
+}
+
+// right-looking blocked P * A = L * U in place with partial pivoting, ipiv as LAPACK (0-based) and also in dpiv.
+// Panels of NB columns are factored on the host, look-ahead as in cholesky
+bool OCL::lu(int n, cl_mem A, vector<int>& ipiv, cl_mem dpiv, double& panel)
+{
+	cl_int err;
+	cl_event r = NULL;
+	Mat P(n, NB, CV_32F);
+	size_t const zero[3] = {0, 0, 0};
+	size_t const bpitch = n * sizeof(float), hpitch = NB * sizeof(float);
+	ipiv.resize(n);
+	panel = 0;
+	{
+		size_t const region[3] = {min(NB, n) * sizeof(float), static_cast<size_t>(n), 1};
+		CheckCLError(err = clEnqueueReadBufferRect(cqueue, A, CL_TRUE, zero, zero, region, bpitch, 0, hpitch, 0, P.data, 0, NULL, NULL));
+	}
+	for (int k = 0; k < n; k += NB)
+	{
+		int const nb = min(NB, n - k), rest = n - k - nb;
+		size_t const origin[3] = {k * sizeof(float), static_cast<size_t>(k), 0};
+		size_t const region[3] = {nb * sizeof(float), static_cast<size_t>(n - k), 1};
+		if (r)
+		{
+			CheckCLError(err = clWaitForEvents(1, &r));
+			CheckCLError(err = clReleaseEvent(r));
+			r = NULL;
+		}
+		int64_t t = cv::getTickCount();
+		bool const regular = getrf(P.ptr<float>(), n - k, nb, NB, &ipiv[k]);
+		panel += (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+		if (!regular)
+		{
+			clFinish(cqueue);
+			return false;
+		}
+		for (int i = k; i < k + nb; ++i)
+			ipiv[i] += k;
+		CheckCLError(err = clEnqueueWriteBufferRect(cqueue, A, CL_FALSE, origin, zero, region, bpitch, 0, hpitch, 0, P.data, 0, NULL, NULL));
+		CheckCLError(err = clEnqueueWriteBuffer(cqueue, dpiv, CL_FALSE, k * sizeof(int), nb * sizeof(int), &ipiv[k], 0, NULL, NULL));
+		// the panel is swapped already, the other columns follow
+		laswp(n, A, n, k, k + nb, dpiv, k, k + nb);
+		if (!rest)
+			break;
+		// U12 = L11^-1 * A12
+		int const k2 = k + nb, nb2 = min(NB, rest);
+		trsm(true, T_LOWER | T_UNIT, nb, rest, A, k * n + k, n, A, k * n + k2, n);
+		// A22 -= L21 * U12, the next panel first
+		size_t const origin2[3] = {k2 * sizeof(float), static_cast<size_t>(k2), 0};
+		size_t const region2[3] = {nb2 * sizeof(float), static_cast<size_t>(rest), 1};
+		gemm(false, false, rest, nb2, nb, -1, A, k2 * n + k, n, A, k * n + k2, n, 1, A, k2 * n + k2, n);
+		CheckCLError(err = clEnqueueReadBufferRect(cqueue, A, CL_FALSE, origin2, zero, region2, bpitch, 0, hpitch, 0, P.data, 0, NULL, &r));
+		if (rest > nb2)
+			gemm(false, false, rest, rest - nb2, nb, -1, A, k2 * n + k, n, A, k * n + k2 + nb2, n, 1, A, k2 * n + k2 + nb2, n);
+		clFlush(cqueue);
+	}
+	CheckCLError(err = clFinish(cqueue));
+	return true;
+}
+
+// op(T) * X = B in place for the n x nrhs B by blocks of NB rows:
+// trsm_left on the diagonal block, then sgemm removes the solved rows from the rest
+void OCL::solve(int flags, int n, int nrhs, cl_mem T, cl_mem B)
+{
+	bool const trans = (flags & T_TRANS) != 0;
+	bool const lower = ((flags & T_LOWER) != 0) != trans;
+	for (int b = 0; b < n; b += NB)
+	{
+		int const ib = min(NB, n - b);
+		int const i0 = lower ? b : n - b - ib;
+		trsm(true, flags, ib, nrhs, T, i0 * n + i0, n, B, i0 * nrhs, nrhs);
+		if (lower && i0 + ib < n)
+			gemm(trans, false, n - i0 - ib, nrhs, ib, -1, T, trans ? i0 * n + i0 + ib : (i0 + ib) * n + i0, n,
+				B, i0 * nrhs, nrhs, 1, B, (i0 + ib) * nrhs, nrhs);
+		if (!lower && i0 > 0)
+			gemm(trans, false, i0, nrhs, ib, -1, T, trans ? i0 * n : i0, n, B, i0 * nrhs, nrhs, 1, B, 0, nrhs);
+	}
+}
+
+void OCL::work()
+{
+	cl_int err;
+	int const n = 4096, nrhs = 4;
+	double panel, ms;
+	vector<int> ipiv;
+	Mat X(n, n, CV_32F), A, B(n, nrhs, CV_32F), F(n, n, CV_32F), Y(n, nrhs, CV_32F), R;
+	randu(X, -1.0, 1.0);
+	randu(B, -1.0, 1.0);
+	CheckCLError(cl_mem a = clCreateBuffer(context, CL_MEM_READ_WRITE, X.total() * X.elemSize(), NULL, &err));
+	CheckCLError(cl_mem b = clCreateBuffer(context, CL_MEM_READ_WRITE, B.total() * B.elemSize(), NULL, &err));
+	CheckCLError(cl_mem p = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(int), NULL, &err));
+
+	// SPD A = X * X^T / n + I
+	cv::gemm(X, X, 1.0 / n, Mat(), 0, A, cv::GEMM_2_T);
+	for (int i = 0; i < n; ++i)
+		A.at<float>(i, i) += 1;
+	CheckCLError(err = clEnqueueWriteBuffer(cqueue, a, CL_TRUE, 0, A.total() * A.elemSize(), A.data, 0, NULL, NULL));
+	CheckCLError(err = clEnqueueWriteBuffer(cqueue, b, CL_TRUE, 0, B.total() * B.elemSize(), B.data, 0, NULL, NULL));
+	int64_t t = cv::getTickCount();
+	if (!cholesky(n, a, panel))
+		fputs("cholesky: A is not positive definite\n", stderr);
+	ms = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+	fprintf(stderr, "cholesky: %.2fms, %.1f GFLOPS, host panels %.2fms\n", ms, 1e-6 * n * n * n / 3 / ms, panel);
+	t = cv::getTickCount();
+	solve(T_LOWER, n, nrhs, a, b);
+	solve(T_LOWER | T_TRANS, n, nrhs, a, b);
+	CheckCLError(err = clEnqueueReadBuffer(cqueue, b, CL_TRUE, 0, Y.total() * Y.elemSize(), Y.data, 0, NULL, NULL));
+	ms = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+	CheckCLError(err = clEnqueueReadBuffer(cqueue, a, CL_TRUE, 0, F.total() * F.elemSize(), F.data, 0, NULL, NULL));
+	for (int h = 0; h < n; ++h)
+		for (int w = h + 1; w < n; ++w)
+			F.at<float>(h, w) = 0;
+	cv::gemm(F, F, 1, A, -1, R, cv::GEMM_2_T);
+	fprintf(stderr, "cholesky: max |L * L^T - A| / max |A| = %g\n", norm(R, cv::NORM_INF) / norm(A, cv::NORM_INF));
+	cv::gemm(A, Y, 1, B, -1, R);
+	fprintf(stderr, "cholesky solve: %.2fms, max |A * x - b| / max |b| = %g\n", ms, norm(R, cv::NORM_INF) / norm(B, cv::NORM_INF));
+	fflush(stderr);
+
+	// general A
+	randu(A, -1.0, 1.0);
+	CheckCLError(err = clEnqueueWriteBuffer(cqueue, a, CL_TRUE, 0, A.total() * A.elemSize(), A.data, 0, NULL, NULL));
+	CheckCLError(err = clEnqueueWriteBuffer(cqueue, b, CL_TRUE, 0, B.total() * B.elemSize(), B.data, 0, NULL, NULL));
+	t = cv::getTickCount();
+	if (!lu(n, a, ipiv, p, panel))
+		fputs("lu: A is singular\n", stderr);
+	ms = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+	fprintf(stderr, "lu: %.2fms, %.1f GFLOPS, host panels %.2fms\n", ms, 2e-6 * n * n * n / 3 / ms, panel);
+	t = cv::getTickCount();
+	laswp(nrhs, b, nrhs, 0, 0, p, 0, n);
+	solve(T_LOWER | T_UNIT, n, nrhs, a, b);
+	solve(0, n, nrhs, a, b);
+	CheckCLError(err = clEnqueueReadBuffer(cqueue, b, CL_TRUE, 0, Y.total() * Y.elemSize(), Y.data, 0, NULL, NULL));
+	ms = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+	CheckCLError(err = clEnqueueReadBuffer(cqueue, a, CL_TRUE, 0, F.total() * F.elemSize(), F.data, 0, NULL, NULL));
+	Mat L = Mat::eye(n, n, CV_32F), U = Mat::zeros(n, n, CV_32F), PA = A.clone();
+	for (int h = 0; h < n; ++h)
+		for (int w = 0; w < n; ++w)
+			(w < h ? L : U).at<float>(h, w) = F.at<float>(h, w);
+	for (int i = 0; i < n; ++i)
+		std::swap_ranges(PA.ptr<float>(i), PA.ptr<float>(i) + n, PA.ptr<float>(ipiv[i]));
+	cv::gemm(L, U, 1, PA, -1, R);
+	fprintf(stderr, "lu: max |L * U - P * A| / max |A| = %g\n", norm(R, cv::NORM_INF) / norm(A, cv::NORM_INF));
+	cv::gemm(A, Y, 1, B, -1, R);
+	fprintf(stderr, "lu solve: %.2fms, max |A * x - b| / (max |A| * max |x|) = %g\n", ms,
+		norm(R, cv::NORM_INF) / (norm(A, cv::NORM_INF) * norm(Y, cv::NORM_INF)));
+	CheckCLError(err = clReleaseMemObject(a));
+	CheckCLError(err = clReleaseMemObject(b));
+	CheckCLError(err = clReleaseMemObject(p));
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1) NB = atoi(argv[1]);
+	OCL ocl;
+	ocl.init();
+	ocl.work();
+	fputs("Game Over!\n", stderr);
+}
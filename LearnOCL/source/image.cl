@@ -63,3 +63,93 @@ __kernel void convolution(sampler_t const sampler,
 	write_imageui(dst, dp, convert_uint4_rte(pixel));
 }
 
+// interleaved pixels of cn = 3 or 4 uchar channels, alpha ignored on load and 255 on store,
+// swap exchanges the first and third channel (RGB <-> BGR)
+inline float3 load_rgb(__global uchar const* src, int const cn, int const swap, int const i)
+{
+	float3 const v = cn == 4 ? convert_float4(vload4(i, src)).xyz : convert_float3(vload3(i, src));
+	return swap ? v.zyx : v;
+}
+
+inline void store_rgb(float3 v, __global uchar* dst, int const cn, int const swap, int const i)
+{
+	uchar3 const u = convert_uchar3_sat_rte(swap ? v.zyx : v);
+	if (cn == 4)
+		vstore4((uchar4)(u, 255), i, dst);
+	else
+		vstore3(u, i, dst);
+}
+
+// dst[c][i] = src[i][c] * scale[c] + offset[c] for the total pixels of src, one plane per channel
+__kernel void rgb2planar(__global uchar const* src, int const total, int const cn, int const swap,
+	float4 const scale, float4 const offset, __global float* dst)
+{
+	int const i = get_global_id(0);
+	if (i >= total)
+		return;
+	float3 const v = mad(load_rgb(src, cn, swap, i), scale.xyz, offset.xyz);
+	dst[i] = v.x;
+	dst[i + total] = v.y;
+	dst[i + total * 2] = v.z;
+}
+
+__kernel void rgb2planar_half(__global uchar const* src, int const total, int const cn, int const swap,
+	float4 const scale, float4 const offset, __global half* dst)
+{
+	int const i = get_global_id(0);
+	if (i >= total)
+		return;
+	float3 const v = mad(load_rgb(src, cn, swap, i), scale.xyz, offset.xyz);
+	vstore_half(v.x, i, dst);
+	vstore_half(v.y, i + total, dst);
+	vstore_half(v.z, i + total * 2, dst);
+}
+
+// the inverse of rgb2planar, dst[i][c] = (src[c][i] - offset[c]) / scale[c]
+__kernel void planar2rgb(__global float const* src, int const total, int const cn, int const swap,
+	float4 const scale, float4 const offset, __global uchar* dst)
+{
+	int const i = get_global_id(0);
+	if (i >= total)
+		return;
+	float3 const v = (float3)(src[i], src[i + total], src[i + total * 2]);
+	store_rgb((v - offset.xyz) / scale.xyz, dst, cn, swap, i);
+}
+
+__kernel void planar2rgb_half(__global half const* src, int const total, int const cn, int const swap,
+	float4 const scale, float4 const offset, __global uchar* dst)
+{
+	int const i = get_global_id(0);
+	if (i >= total)
+		return;
+	float3 const v = (float3)(vload_half(i, src), vload_half(i + total, src), vload_half(i + total * 2, src));
+	store_rgb((v - offset.xyz) / scale.xyz, dst, cn, swap, i);
+}
+
+// interleaved uchar3 or uchar4 to and from the RGBA image of rotation and convolution
+__kernel void rgb2image(__global uchar const* src, int const rows, int const cols, int const cn,
+	__write_only image2d_t dst)
+{
+	int const x = get_global_id(0);
+	int const y = get_global_id(1);
+	if (x >= cols || y >= rows)
+		return;
+	int const i = y * cols + x;
+	uint4 const p = cn == 4 ? convert_uint4(vload4(i, src)) : (uint4)(convert_uint3(vload3(i, src)), 255);
+	write_imageui(dst, (int2)(x, y), p);
+}
+
+__kernel void image2rgb(__read_only image2d_t src, int const rows, int const cols, int const cn,
+	__global uchar* dst)
+{
+	int const x = get_global_id(0);
+	int const y = get_global_id(1);
+	if (x >= cols || y >= rows)
+		return;
+	int const i = y * cols + x;
+	uint4 const p = read_imageui(src, (int2)(x, y));
+	if (cn == 4)
+		vstore4(convert_uchar4_sat(p), i, dst);
+	else
+		vstore3(convert_uchar3_sat(p.xyz), i, dst);
+}
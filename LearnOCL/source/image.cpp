@@ -1,10 +1,19 @@
 ﻿#define _CRT_SECURE_NO_WARNINGS
 #include <cmath>
-#include <opencv2/imgproc.hpp>
 #include "base.hpp"
 
 static int const HistBins = 256;
 
+// IEEE 754 binary16 to float
+static float half2float(cl_half h)
+{
+	int const e = (h >> 10) & 31, m = h & 1023;
+	float const v = e == 0 ? ldexpf(static_cast<float>(m), -24)
+		: e == 31 ? (m ? NAN : INFINITY)
+		: ldexpf(static_cast<float>(m + 1024), e - 25);
+	return (h & 0x8000) ? -v : v;
+}
+
 static void getGaussianKernel(Mat& kernel)
 {
 	float sum = 0;
@@ -40,6 +49,7 @@ public:
 	~OCL();
 
 	void init();
+	void planar(cl_mem rgb, Mat const& src);
 	void work();
 };
 
@@ -83,20 +93,97 @@ void OCL::init()
 	fprintf(stderr, "kernel names: %s\n", info);
 }
 
+// interleaved RGB to normalized planar float or half and back on the device, swap gives BGR planes;
+// the half planes are checked to 1 ulp, vstore_half rounds toward zero
+void OCL::planar(cl_mem rgb, Mat const& src)
+{
+	// (x / 255 - mean) / stdv with the ImageNet mean and stdv
+	float const mean[] = {0.485f, 0.456f, 0.406f}, stdv[] = {0.229f, 0.224f, 0.225f};
+	cl_float4 scale, offset;
+	for (int c = 0; c < 3; ++c)
+		scale.s[c] = 1 / (255 * stdv[c]), offset.s[c] = -mean[c] / stdv[c];
+	scale.s[3] = 1, offset.s[3] = 0;
+	cl_int err;
+	cl_int const total = src.rows * src.cols, cn = src.channels();
+	size_t const szloc = cwgs, sztot = (total + cwgs - 1) / cwgs * cwgs;
+	Mat F(3, total, CV_32F), back(src.size(), src.type());
+	vector<cl_half> H(F.total());
+	CheckCLError(cl_mem P = clCreateBuffer(context, CL_MEM_READ_WRITE, F.total() * F.elemSize(), NULL, &err));
+	CheckCLError(cl_mem Q = clCreateBuffer(context, CL_MEM_WRITE_ONLY, back.total() * back.elemSize(), NULL, &err));
+	for (int k = 0; k < 4; ++k)
+	{
+		cl_int const fp16 = k & 1, swap = k >> 1;
+		cl_event e[2];
+		char name[2][32];
+		snprintf(name[0], sizeof(name[0]), "rgb2planar%s", fp16 ? "_half" : "");
+		snprintf(name[1], sizeof(name[1]), "planar2rgb%s", fp16 ? "_half" : "");
+		for (int j = 0; j < 2; ++j)
+		{
+			CheckCLError(cl_kernel K = clCreateKernel(program, name[j], &err));
+			CheckCLError(err = clSetKernelArg(K, 0, sizeof(cl_mem), j ? &P : &rgb));
+			CheckCLError(err = clSetKernelArg(K, 1, sizeof(total), &total));
+			CheckCLError(err = clSetKernelArg(K, 2, sizeof(cn), &cn));
+			CheckCLError(err = clSetKernelArg(K, 3, sizeof(swap), &swap));
+			CheckCLError(err = clSetKernelArg(K, 4, sizeof(scale), &scale));
+			CheckCLError(err = clSetKernelArg(K, 5, sizeof(offset), &offset));
+			CheckCLError(err = clSetKernelArg(K, 6, sizeof(cl_mem), j ? &Q : &P));
+			CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, &sztot, &szloc, 0, NULL, e + j));
+			CheckCLError(err = clReleaseKernel(K));
+		}
+		if (fp16)
+		{
+			CheckCLError(err = clEnqueueReadBuffer(cqueue, P, CL_TRUE, 0, H.size() * sizeof(cl_half), H.data(), 0, NULL, NULL));
+		}
+		else
+		{
+			CheckCLError(err = clEnqueueReadBuffer(cqueue, P, CL_TRUE, 0, F.total() * F.elemSize(), F.data, 0, NULL, NULL));
+		}
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, Q, CL_TRUE, 0, back.total() * back.elemSize(), back.data, 0, NULL, NULL));
+		getCLTime(e[0], name[0]);
+		getCLTime(e[1], name[1]);
+		CheckCLError(err = clReleaseEvent(e[0]));
+		CheckCLError(err = clReleaseEvent(e[1]));
+		double dif = 0;
+		int changed = 0, wrong = 0;
+		for (int i = 0; i < total; ++i)
+			for (int c = 0; c < 3; ++c)
+			{
+				uchar const x = src.data[i * cn + (swap ? 2 - c : c)];
+				float const ref = x * scale.s[c] + offset.s[c];
+				if (fp16)
+				{
+					double const d = fabs(half2float(H[c * total + i]) - ref);
+					dif = max(dif, d);
+					wrong += !(d <= ldexp(fabs(ref), -10) + 1e-6);
+				}
+				else
+					dif = max(dif, fabs(F.at<float>(c, i) - ref));
+				changed += back.data[i * cn + c] != src.data[i * cn + c];
+			}
+		fprintf(stderr, "%s %s planes: max difference to the host = %g, %d of %d values changed by the round trip\n",
+			fp16 ? "half" : "float", swap ? "BGR" : "RGB", dif, changed, total * 3);
+		if (fp16)
+			fprintf(stderr, "half %s planes: %d values off by more than 1 ulp\n", swap ? "BGR" : "RGB", wrong);
+	}
+	CheckCLError(err = clReleaseMemObject(Q));
+	CheckCLError(err = clReleaseMemObject(P));
+}
+
 void OCL::work()
 {
 	Mat src, dst, filter;
 	getGaussianKernel(filter);
-	assert(jpgRead("sample\\20200518_002047.jpg", dst));
-	cvtColor(dst, src, cv::COLOR_RGB2RGBA);
+	assert(jpgRead("sample\\20200518_002047.jpg", src));
+	dst.create(src.size(), src.type());
 	cl_int err = src.isContinuous();
-	cl_event e1, e2;
+	cl_event e0, e1, e2;
 	Vec4z szloc = Vec4z::all(cwgs), sztot = Vec4z::all(cwgs * cunits);
 	int total = src.rows * src.cols * src.channels();
+	int cn = src.channels();
 
 	/// 直方图
-	int hist[HistBins], chist[HistBins];
-	CheckCLError(cl_mem M1 = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, total, src.data, &err));
+	int hist[HistBins] = {0}, chist[HistBins];
+	CheckCLError(cl_mem M1 = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_WRITE, total, src.data, &err));
 	CheckCLError(cl_mem M2 = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(chist), NULL, &err));
 	CheckCLError(cl_kernel K1 = clCreateKernel(program, "histogram", &err));
 	CheckCLError(err = clEnqueueFillBuffer(cqueue, M2, &err, sizeof(err), 0, sizeof(chist), 0, NULL, NULL));
@@ -110,7 +197,6 @@ void OCL::work()
 	getCLTime(e1, "histogram");
 	CheckCLError(err = clReleaseKernel(K1));
 	CheckCLError(err = clReleaseMemObject(M2));
-	CheckCLError(err = clReleaseMemObject(M1));
 	int dif = 0;
 	for (int i = 0; i < total; ++i)
 		++(hist[src.data[i]]);
@@ -118,6 +204,9 @@ void OCL::work()
 		dif += abs(hist[i] - chist[i]);
 	fprintf(stderr, "absdiff(cpu, ocl) = %d\n", dif);
 
+	/// 布局转换
+	planar(M1, src);
+
 	/// 旋转、卷积
 	szloc = Vec4z(16, 8);
 	sztot = Vec4z(src.cols, src.rows, 1);
@@ -138,12 +227,19 @@ void OCL::work()
 	ifmt.image_channel_data_type = CL_UNSIGNED_INT8;
 	CheckCLError(cl_sampler S1 = clCreateSampler(context, CL_TRUE, CL_ADDRESS_CLAMP, CL_FILTER_LINEAR, &err));
 	CheckCLError(cl_sampler S2 = clCreateSampler(context, CL_FALSE, CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST, &err));
-	CheckCLError(cl_mem I1 = clCreateImage(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, &ifmt, &desc, src.data, &err));
+	CheckCLError(cl_mem I1 = clCreateImage(context, CL_MEM_READ_WRITE, &ifmt, &desc, NULL, &err));
 	CheckCLError(cl_mem I2 = clCreateImage(context, CL_MEM_WRITE_ONLY, &ifmt, &desc, NULL, &err));
 	CheckCLError(cl_mem I3 = clCreateImage(context, CL_MEM_WRITE_ONLY, &ifmt, &desc, NULL, &err));
 	CheckCLError(cl_mem F1 = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, filter.total() * filter.elemSize(), filter.data, &err));
+	CheckCLError(cl_kernel K0 = clCreateKernel(program, "rgb2image", &err));
 	CheckCLError(cl_kernel K2 = clCreateKernel(program, "rotation", &err));
 	CheckCLError(cl_kernel K3 = clCreateKernel(program, "convolution", &err));
+	CheckCLError(cl_kernel K4 = clCreateKernel(program, "image2rgb", &err));
+	CheckCLError(err = clSetKernelArg(K0, 0, sizeof(M1), &M1));
+	CheckCLError(err = clSetKernelArg(K0, 1, sizeof(int), &src.rows));
+	CheckCLError(err = clSetKernelArg(K0, 2, sizeof(int), &src.cols));
+	CheckCLError(err = clSetKernelArg(K0, 3, sizeof(int), &cn));
+	CheckCLError(err = clSetKernelArg(K0, 4, sizeof(I1), &I1));
 	CheckCLError(err = clSetKernelArg(K2, 0, sizeof(S1), &S1));
 	CheckCLError(err = clSetKernelArg(K2, 1, sizeof(I1), &I1));
 	CheckCLError(err = clSetKernelArg(K2, 2, sizeof(I2), &I2));
@@ -156,22 +252,33 @@ void OCL::work()
 	CheckCLError(err = clSetKernelArg(K3, 4, sizeof(int), &src.rows));
 	CheckCLError(err = clSetKernelArg(K3, 5, sizeof(int), &src.cols));
 	CheckCLError(err = clSetKernelArg(K3, 6, sizeof(int), &filter.cols));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K0, 2, NULL, sztot.val, szloc.val, 0, NULL, &e0));
 	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K2, 2, NULL, sztot.val, szloc.val, 0, NULL, &e1));
 	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K3, 2, NULL, sztot.val, szloc.val, 0, NULL, &e2));
 	clFlush(cqueue), clFinish(cqueue);
+	CheckCLError(clWaitForEvents(1, &e0));
 	CheckCLError(clWaitForEvents(1, &e1));
 	CheckCLError(clWaitForEvents(1, &e2));
+	getCLTime(e0, "rgb2image");
 	getCLTime(e1, "rotation");
 	getCLTime(e2, "convolution");
-	szloc = Vec4z::all(0), sztot = Vec4z(src.cols, src.rows, 1);
-	CheckCLError(err = clEnqueueReadImage(cqueue, I2, CL_TRUE, szloc.val, sztot.val, 0, 0, src.data, 0, NULL, NULL));
-	cvtColor(src, dst, cv::COLOR_RGBA2RGB);
+	// back to interleaved RGB in M1 on the device
+	CheckCLError(err = clSetKernelArg(K4, 0, sizeof(I2), &I2));
+	CheckCLError(err = clSetKernelArg(K4, 1, sizeof(int), &src.rows));
+	CheckCLError(err = clSetKernelArg(K4, 2, sizeof(int), &src.cols));
+	CheckCLError(err = clSetKernelArg(K4, 3, sizeof(int), &cn));
+	CheckCLError(err = clSetKernelArg(K4, 4, sizeof(M1), &M1));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K4, 2, NULL, sztot.val, szloc.val, 0, NULL, NULL));
+	CheckCLError(err = clEnqueueReadBuffer(cqueue, M1, CL_TRUE, 0, total, dst.data, 0, NULL, NULL));
 	jpgWrite("sample\\20200518_002047-1.jpg", dst);
-	CheckCLError(err = clEnqueueReadImage(cqueue, I3, CL_TRUE, szloc.val, sztot.val, 0, 0, src.data, 0, NULL, NULL));
-	cvtColor(src, dst, cv::COLOR_RGBA2RGB);
+	CheckCLError(err = clSetKernelArg(K4, 0, sizeof(I3), &I3));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K4, 2, NULL, sztot.val, szloc.val, 0, NULL, NULL));
+	CheckCLError(err = clEnqueueReadBuffer(cqueue, M1, CL_TRUE, 0, total, dst.data, 0, NULL, NULL));
 	jpgWrite("sample\\20200518_002047-2.jpg", dst);
+	CheckCLError(clReleaseKernel(K4));
 	CheckCLError(clReleaseKernel(K3));
 	CheckCLError(clReleaseKernel(K2));
+	CheckCLError(clReleaseKernel(K0));
 	CheckCLError(clReleaseMemObject(F1));
 	CheckCLError(clReleaseMemObject(I3));
 	CheckCLError(clReleaseMemObject(I2));
@@ -180,6 +287,8 @@ void OCL::work()
 	CheckCLError(clReleaseSampler(S1));
 	CheckCLError(clReleaseEvent(e2));
 	CheckCLError(clReleaseEvent(e1));
+	CheckCLError(clReleaseEvent(e0));
+	CheckCLError(clReleaseMemObject(M1));
 }
 
 int main()
@@ -7,28 +7,74 @@
 #	define WS 8
 #endif
 
+#ifndef WPTM
+#	define WPTM WS
+#endif
+
+#ifndef WPTQ
+#	define WPTQ WS
+#endif
+
+// largest M, N, Q handled by gemm_small
+#ifndef SM
+#	define SM 32
+#endif
+
+// tall-skinny sgemm: N <= NS, a work-group has GR rows of GV lanes
+#ifndef NS
+#	define NS 16
+#endif
+
+#ifndef GV
+#	define GV 32
+#endif
+
+#ifndef GR
+#	define GR 8
+#endif
+
+// element type of matmul0 .. matmul3, FP64 needs cl_khr_fp64
+#ifdef FP64
+#	pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#	define REAL double
+#	define REAL4 double4
+#else
+#	define REAL float
+#	define REAL4 float4
+#endif
+
+// matmul3: a work-group of TS x TS computes a TSM x TSQ block of C,
+// every work-item a WPTM x WPTQ register tile, K-slices are TS wide and loaded as REAL4
+#if TS % 4
+#	error matmul3 needs TS to be a multiple of 4
+#endif
+#define TSM (TS * WPTM)
+#define TSQ (TS * WPTQ)
+#define LDA ((TSM * TS / 4 + TS * TS - 1) / (TS * TS))
+#define LDB ((TSQ * TS / 4 + TS * TS - 1) / (TS * TS))
+
 __kernel void matmul0(int const M, int const N, int const Q,
-	__global float const* A, __global float const* B, __global float* C)
+	__global REAL const* A, __global REAL const* B, __global REAL* C)
 {
 	int w = get_global_id(0);
 	int h = get_global_id(1);
 	if (h >= M || w >= Q)
 		return;
-	float val = 0;
+	REAL val = 0;
 	for (int i = 0; i < N; ++i)
 		val += A[h * N + i] * B[i * Q + w];
 	C[h * Q + w] = val;
 }
 
 __kernel void matmul1(int const M, int const N, int const Q,
-	__global float const* A, __global float const* B, __global float* C)
+	__global REAL const* A, __global REAL const* B, __global REAL* C)
 {
 	int const lw = get_local_id(0);
 	int const lh = get_local_id(1);
 	int const gw = get_global_id(0);
 	int const gh = get_global_id(1);
-	float val = 0;
-	__local float a[TS][TS], b[TS][TS];
+	REAL val = 0;
+	__local REAL a[TS][TS], b[TS][TS];
 	for (int t = 0; t < N; t += TS)
 	{
 		int const th = t + lh;
@@ -45,7 +91,444 @@ __kernel void matmul1(int const M, int const N, int const Q,
 
 
 __kernel void matmul2(int const M, int const N, int const Q,
-	__global float const* A, __global float const* B, __global float* C)
+	__global REAL const* A, __global REAL const* B, __global REAL* C)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const pw = get_group_id(0) * TS * WS;
+	int const ph = get_group_id(1) * TS;
+	REAL c[WS];
+	__local REAL a[TS][TS], b[TS][TS * WS];
+	for (int i = 0; i < WS; ++i)
+		c[i] = 0;
+	for (int t = 0; t < N; t += TS)
+	{
+		int h = ph + lh;
+		int w = t + lw;
+		a[lh][lw] = (h < M && w < N) ? A[mad24(h, N, w)] : 0;
+		for (int p = 0; p < WS; ++p)
+		{
+			h = t + lh;
+			w = pw + lw + TS * p;
+			b[lh][w - pw] = (h < N && w < Q) ? B[mad24(h, Q, w)] : 0;
+		}
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+		for (int i = 0; i < TS; ++i)
+			for (int p = 0; p < WS; ++p)
+				c[p] += a[lh][i] * b[i][TS * p + lw];
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	for (int p = 0; p < WS; ++p)
+	{
+		int h = ph + lh;
+		int w = pw + lw + TS * p;
+		if (h < M && w < Q)
+			C[mad24(h, Q, w)] = c[p];
+	}
+}
+
+
+inline REAL4 load4(__global REAL const* X, int const rows, int const cols, int const h, int const w)
+{
+	REAL4 v = 0;
+	if (h >= rows)
+		return v;
+	if (w + 3 < cols)
+		return vload4(0, X + mad24(h, cols, w));
+	if (w < cols) v.x = X[mad24(h, cols, w)];
+	if (w + 1 < cols) v.y = X[mad24(h, cols, w + 1)];
+	if (w + 2 < cols) v.z = X[mad24(h, cols, w + 2)];
+	return v;
+}
+
+
+__kernel void matmul3(int const M, int const N, int const Q,
+	__global REAL const* A, __global REAL const* B, __global REAL* C)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const li = mad24(lh, TS, lw);
+	int const pw = get_group_id(0) * TSQ;
+	int const ph = get_group_id(1) * TSM;
+	// a is kept transposed (k-major) and padded, b is kept as is;
+	// two copies of each so that the next K-slice can be stored while
+	// slower work-items are still reading the current one
+	__local REAL a[2][TS][TSM + 1], b[2][TS][TSQ];
+	REAL4 ra[LDA], rb[LDB];
+	REAL c[WPTM][WPTQ], rq[WPTQ];
+	for (int i = 0; i < WPTM; ++i)
+		for (int j = 0; j < WPTQ; ++j)
+			c[i][j] = 0;
+	for (int p = 0; p < LDA; ++p)
+	{
+		int const i = li + p * TS * TS;
+		ra[p] = load4(A, min(M, ph + TSM), N, ph + i / (TS / 4), i % (TS / 4) * 4);
+	}
+	for (int p = 0; p < LDB; ++p)
+	{
+		int const i = li + p * TS * TS;
+		rb[p] = load4(B, min(N, TS), Q, i / (TSQ / 4), pw + i % (TSQ / 4) * 4);
+	}
+	for (int t = 0, s = 0; t < N; t += TS, s ^= 1)
+	{
+		for (int p = 0; p < LDA; ++p)
+		{
+			int const i = li + p * TS * TS;
+			int const h = i / (TS / 4);
+			int const w = i % (TS / 4) * 4;
+			if (h < TSM)
+			{
+				a[s][w][h] = ra[p].x;
+				a[s][w + 1][h] = ra[p].y;
+				a[s][w + 2][h] = ra[p].z;
+				a[s][w + 3][h] = ra[p].w;
+			}
+		}
+		for (int p = 0; p < LDB; ++p)
+		{
+			int const i = li + p * TS * TS;
+			int const h = i / (TSQ / 4);
+			if (h < TS)
+				vstore4(rb[p], 0, b[s][h] + i % (TSQ / 4) * 4);
+		}
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+		// issue the global loads of the next K-slice before computing this one
+		int const tn = t + TS;
+		for (int p = 0; p < LDA && tn < N; ++p)
+		{
+			int const i = li + p * TS * TS;
+			ra[p] = load4(A, min(M, ph + TSM), N, ph + i / (TS / 4), tn + i % (TS / 4) * 4);
+		}
+		for (int p = 0; p < LDB && tn < N; ++p)
+		{
+			int const i = li + p * TS * TS;
+			rb[p] = load4(B, min(N, tn + TS), Q, tn + i / (TSQ / 4), pw + i % (TSQ / 4) * 4);
+		}
+		for (int k = 0; k < TS; ++k)
+		{
+			for (int j = 0; j < WPTQ; ++j)
+				rq[j] = b[s][k][lw + TS * j];
+			for (int i = 0; i < WPTM; ++i)
+			{
+				REAL const v = a[s][k][lh + TS * i];
+				for (int j = 0; j < WPTQ; ++j)
+					c[i][j] += v * rq[j];
+			}
+		}
+	}
+	for (int i = 0; i < WPTM; ++i)
+		for (int j = 0; j < WPTQ; ++j)
+		{
+			int const h = ph + lh + TS * i;
+			int const w = pw + lw + TS * j;
+			if (h < M && w < Q)
+				C[mad24(h, Q, w)] = c[i][j];
+		}
+}
+
+
+// batched C[z] = A[z] * B[z], z = get_global_id(2),
+// strides (sa, sb, sc) and leading dimensions (lda, ldb, ldc) are in elements
+__kernel void gemm_batch(int const M, int const N, int const Q,
+	__global float const* A, int const lda, int const sa,
+	__global float const* B, int const ldb, int const sb,
+	__global float* C, int const ldc, int const sc)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const gw = get_global_id(0);
+	int const gh = get_global_id(1);
+	size_t const z = get_global_id(2);
+	float val = 0;
+	__local float a[TS][TS], b[TS][TS];
+	A += z * sa;
+	B += z * sb;
+	C += z * sc;
+	for (int t = 0; t < N; t += TS)
+	{
+		int const th = t + lh;
+		int const tw = t + lw;
+		a[lh][lw] = (gh < M && tw < N) ? A[mad24(gh, lda, tw)] : 0;
+		b[lh][lw] = (th < N && gw < Q) ? B[mad24(th, ldb, gw)] : 0;
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+		for (int i = 0; i < TS; ++i)
+			val += a[lh][i] * b[i][lw];
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (gh < M && gw < Q)
+		C[mad24(gh, ldc, gw)] = val;
+}
+
+
+// same as gemm_batch for M, N, Q <= SM, one TS x TS work-group per matrix,
+// A[z] and B[z] are loaded into local memory once
+__kernel void gemm_small(int const M, int const N, int const Q,
+	__global float const* A, int const lda, int const sa,
+	__global float const* B, int const ldb, int const sb,
+	__global float* C, int const ldc, int const sc)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	size_t const z = get_group_id(2);
+	__local float a[SM][SM + 1], b[SM][SM];
+	A += z * sa;
+	B += z * sb;
+	C += z * sc;
+	for (int h = lh; h < M; h += TS)
+		for (int w = lw; w < N; w += TS)
+			a[h][w] = A[mad24(h, lda, w)];
+	for (int h = lh; h < N; h += TS)
+		for (int w = lw; w < Q; w += TS)
+			b[h][w] = B[mad24(h, ldb, w)];
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	for (int h = lh; h < M; h += TS)
+		for (int w = lw; w < Q; w += TS)
+		{
+			float val = 0;
+			for (int i = 0; i < N; ++i)
+				val += a[h][i] * b[i][w];
+			C[mad24(h, ldc, w)] = val;
+		}
+}
+
+
+// half / bf16 storage, both passed as ushort, float accumulation
+inline float load_lp(__global ushort const* X, int const i, int const bf)
+{
+	if (bf)
+		return as_float(convert_uint(X[i]) << 16);
+	return vload_half(i, (__global half const*)(X));
+}
+
+// matmul2 on 16-bit storage, a and b are local tiles of [TS][TS] and [TS][TS * WS]
+inline void matmul_lp(int const M, int const N, int const Q,
+	__global ushort const* A, __global ushort const* B, __global float* C,
+	__local float* a, __local float* b, int const bf)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const pw = get_group_id(0) * TS * WS;
+	int const ph = get_group_id(1) * TS;
+	float c[WS];
+	for (int i = 0; i < WS; ++i)
+		c[i] = 0;
+	for (int t = 0; t < N; t += TS)
+	{
+		int h = ph + lh;
+		int w = t + lw;
+		a[lh * TS + lw] = (h < M && w < N) ? load_lp(A, mad24(h, N, w), bf) : 0;
+		for (int p = 0; p < WS; ++p)
+		{
+			h = t + lh;
+			w = pw + lw + TS * p;
+			b[lh * TS * WS + w - pw] = (h < N && w < Q) ? load_lp(B, mad24(h, Q, w), bf) : 0;
+		}
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+		for (int i = 0; i < TS; ++i)
+			for (int p = 0; p < WS; ++p)
+				c[p] += a[lh * TS + i] * b[i * TS * WS + TS * p + lw];
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	for (int p = 0; p < WS; ++p)
+	{
+		int h = ph + lh;
+		int w = pw + lw + TS * p;
+		if (h < M && w < Q)
+			C[mad24(h, Q, w)] = c[p];
+	}
+}
+
+__kernel void matmul_half(int const M, int const N, int const Q,
+	__global ushort const* A, __global ushort const* B, __global float* C)
+{
+	__local float a[TS][TS], b[TS][TS * WS];
+	matmul_lp(M, N, Q, A, B, C, a[0], b[0], 0);
+}
+
+__kernel void matmul_bf16(int const M, int const N, int const Q,
+	__global ushort const* A, __global ushort const* B, __global float* C)
+{
+	__local float a[TS][TS], b[TS][TS * WS];
+	matmul_lp(M, N, Q, A, B, C, a[0], b[0], 1);
+}
+
+// float to half / bf16, both round to nearest even
+__kernel void to_half(int const n, __global float const* X, __global ushort* Y)
+{
+	int const i = get_global_id(0);
+	if (i < n)
+		vstore_half_rte(X[i], i, (__global half*)(Y));
+}
+
+__kernel void to_bf16(int const n, __global float const* X, __global ushort* Y)
+{
+	int const i = get_global_id(0);
+	if (i >= n)
+		return;
+	uint u = as_uint(X[i]);
+	if ((u & 0x7fffffff) > 0x7f800000)
+		u |= 0x00400000; // keep NaN a quiet NaN
+	else
+		u += 0x7fff + ((u >> 16) & 1);
+	Y[i] = convert_ushort(u >> 16);
+}
+
+
+#ifdef cl_khr_integer_dot_product
+#	define dot4(a, b) dot(a, b)
+#else
+inline int dot4(char4 const a, char4 const b)
+{
+	int4 const p = convert_int4(a) * convert_int4(b);
+	return p.x + p.y + p.z + p.w;
+}
+#endif
+
+// X[h][w .. w + 3], zero outside
+inline char4 load_i8(__global char const* X, int const rows, int const cols, int const h, int const w)
+{
+	char4 v = 0;
+	if (h >= rows)
+		return v;
+	if (w + 3 < cols)
+		return vload4(0, X + mad24(h, cols, w));
+	if (w < cols) v.x = X[mad24(h, cols, w)];
+	if (w + 1 < cols) v.y = X[mad24(h, cols, w + 1)];
+	if (w + 2 < cols) v.z = X[mad24(h, cols, w + 2)];
+	return v;
+}
+
+// X[h .. h + 3][w], zero outside
+inline char4 gather_i8(__global char const* X, int const rows, int const cols, int const h, int const w)
+{
+	char4 v = 0;
+	if (w >= cols)
+		return v;
+	if (h < rows) v.x = X[mad24(h, cols, w)];
+	if (h + 1 < rows) v.y = X[mad24(h + 1, cols, w)];
+	if (h + 2 < rows) v.z = X[mad24(h + 2, cols, w)];
+	if (h + 3 < rows) v.w = X[mad24(h + 3, cols, w)];
+	return v;
+}
+
+// acc[p] = sum (A[h][k] - za) * (B[k][w] - zb[w]) for the WS columns of matmul2,
+// K-slices are 4 * TS wide and packed as char4 along K,
+// the zero points are applied once at the end from the row sum of A and the column sums of B
+inline void gemm_i8(int const M, int const N, int const Q,
+	__global char const* A, int const za, __global char const* B, __global int const* zb,
+	__local char4* a, __local char4* b, int* acc)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const pw = get_group_id(0) * TS * WS;
+	int const ph = get_group_id(1) * TS;
+	char4 const one = (char4)(1);
+	int c[WS], cb[WS], ra = 0;
+	for (int i = 0; i < WS; ++i)
+		c[i] = cb[i] = 0;
+	for (int t = 0; t < N; t += 4 * TS)
+	{
+		a[lh * TS + lw] = load_i8(A, M, N, ph + lh, t + 4 * lw);
+		for (int p = 0; p < WS; ++p)
+			b[lh * TS * WS + TS * p + lw] = gather_i8(B, N, Q, t + 4 * lh, pw + lw + TS * p);
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+		for (int i = 0; i < TS; ++i)
+		{
+			char4 const u = a[lh * TS + i];
+			ra += dot4(u, one);
+			for (int p = 0; p < WS; ++p)
+			{
+				char4 const v = b[i * TS * WS + TS * p + lw];
+				c[p] += dot4(u, v);
+				cb[p] += dot4(v, one);
+			}
+		}
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	for (int p = 0; p < WS; ++p)
+	{
+		int const w = pw + lw + TS * p;
+		int const z = w < Q ? zb[w] : 0;
+		acc[p] = c[p] - z * ra - za * cb[p] + N * za * z;
+	}
+}
+
+// int8 x int8 -> int32
+__kernel void matmul_i8(int const M, int const N, int const Q,
+	__global char const* A, int const za, __global char const* B, __global int const* zb,
+	__global int* C)
+{
+	__local char4 a[TS][TS], b[TS][TS * WS];
+	int acc[WS];
+	gemm_i8(M, N, Q, A, za, B, zb, a[0], b[0], acc);
+	int const h = get_group_id(1) * TS + get_local_id(1);
+	for (int p = 0; p < WS; ++p)
+	{
+		int const w = get_group_id(0) * TS * WS + get_local_id(0) + TS * p;
+		if (h < M && w < Q)
+			C[mad24(h, Q, w)] = acc[p];
+	}
+}
+
+// int8 x int8 -> int8, C = round(acc * scale[w]) + zc with scale[w] = sa * sb[w] / sc
+__kernel void matmul_i8q(int const M, int const N, int const Q,
+	__global char const* A, int const za, __global char const* B, __global int const* zb,
+	__global float const* scale, int const zc, __global char* C)
+{
+	__local char4 a[TS][TS], b[TS][TS * WS];
+	int acc[WS];
+	gemm_i8(M, N, Q, A, za, B, zb, a[0], b[0], acc);
+	int const h = get_group_id(1) * TS + get_local_id(1);
+	for (int p = 0; p < WS; ++p)
+	{
+		int const w = get_group_id(0) * TS * WS + get_local_id(0) + TS * p;
+		if (h < M && w < Q)
+			C[mad24(h, Q, w)] = convert_char_sat(convert_int_sat_rte(acc[p] * scale[w]) + zc);
+	}
+}
+
+
+// matmul2 with B packed by matpack in mattranspose.cl, each K-tile of B is one
+// contiguous block of TS x TS * WS floats and is read without bounds checks
+__kernel void matmul_packed(int const M, int const N, int const Q,
+	__global float const* A, __global float const* P, __global float* C)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const li = mad24(lh, TS, lw);
+	int const pw = get_group_id(0) * TS * WS;
+	int const ph = get_group_id(1) * TS;
+	float c[WS];
+	__local float a[TS][TS], b[TS * TS * WS];
+	for (int i = 0; i < WS; ++i)
+		c[i] = 0;
+	P += get_group_id(0) * ((N + TS - 1) / TS) * TS * TS * WS;
+	for (int t = 0; t < N; t += TS, P += TS * TS * WS)
+	{
+		int const h = ph + lh;
+		int const w = t + lw;
+		a[lh][lw] = (h < M && w < N) ? A[mad24(h, N, w)] : 0;
+		for (int p = 0; p < WS; ++p)
+			b[li + TS * TS * p] = P[li + TS * TS * p];
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+		for (int i = 0; i < TS; ++i)
+			for (int p = 0; p < WS; ++p)
+				c[p] += a[lh][i] * b[i * TS * WS + TS * p + lw];
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	for (int p = 0; p < WS; ++p)
+	{
+		int h = ph + lh;
+		int w = pw + lw + TS * p;
+		if (h < M && w < Q)
+			C[mad24(h, Q, w)] = c[p];
+	}
+}
+
+
+// matmul2 that adds to C if acc is set, for the out-of-core driver
+__kernel void matmul_acc(int const M, int const N, int const Q,
+	__global float const* A, __global float const* B, __global float* C, int const acc)
 {
 	int const lw = get_local_id(0);
 	int const lh = get_local_id(1);
@@ -77,6 +560,390 @@ __kernel void matmul2(int const M, int const N, int const Q,
 		int h = ph + lh;
 		int w = pw + lw + TS * p;
 		if (h < M && w < Q)
-			C[mad24(h, Q, w)] = c[p];
+			C[mad24(h, Q, w)] = acc ? C[mad24(h, Q, w)] + c[p] : c[p];
+	}
+}
+
+
+// matmul2 on sub-matrices, offsets (oa, ob, oc) and leading dimensions are in elements
+__kernel void matmul_view(int const M, int const N, int const Q,
+	__global float const* A, int const oa, int const lda,
+	__global float const* B, int const ob, int const ldb,
+	__global float* C, int const oc, int const ldc)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const pw = get_group_id(0) * TS * WS;
+	int const ph = get_group_id(1) * TS;
+	float c[WS];
+	__local float a[TS][TS], b[TS][TS * WS];
+	A += oa;
+	B += ob;
+	C += oc;
+	for (int i = 0; i < WS; ++i)
+		c[i] = 0;
+	for (int t = 0; t < N; t += TS)
+	{
+		int h = ph + lh;
+		int w = t + lw;
+		a[lh][lw] = (h < M && w < N) ? A[mad24(h, lda, w)] : 0;
+		for (int p = 0; p < WS; ++p)
+		{
+			h = t + lh;
+			w = pw + lw + TS * p;
+			b[lh][w - pw] = (h < N && w < Q) ? B[mad24(h, ldb, w)] : 0;
+		}
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+		for (int i = 0; i < TS; ++i)
+			for (int p = 0; p < WS; ++p)
+				c[p] += a[lh][i] * b[i][TS * p + lw];
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	for (int p = 0; p < WS; ++p)
+	{
+		int h = ph + lh;
+		int w = pw + lw + TS * p;
+		if (h < M && w < Q)
+			C[mad24(h, ldc, w)] = c[p];
+	}
+}
+
+// C = A + beta * B on sub-matrices
+__kernel void matadd(int const M, int const Q,
+	__global float const* A, int const oa, int const lda,
+	__global float const* B, int const ob, int const ldb, float const beta,
+	__global float* C, int const oc, int const ldc)
+{
+	int const w = get_global_id(0);
+	int const h = get_global_id(1);
+	if (h < M && w < Q)
+		C[oc + mad24(h, ldc, w)] = A[oa + mad24(h, lda, w)] + beta * B[ob + mad24(h, ldb, w)];
+}
+
+
+// BLAS naming from here on: C = alpha * op(A) * op(B) + beta * C, op(A) is M x K, op(B) is K x N,
+// C is M x N, all row-major with leading dimensions in elements, op(X) is X^T if tx is set.
+// Tiling follows matmul2, transposed operands are read along their rows and transposed in local memory.
+inline void gemm_op(int const ta, int const tb, int const M, int const N, int const K,
+	__global float const* A, int const lda, __global float const* B, int const ldb,
+	__local float* a, __local float* b, float* c)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const pw = get_group_id(0) * TS * WS;
+	int const ph = get_group_id(1) * TS;
+	int const la = TS + 1, lb = TS * WS + 1;
+	for (int i = 0; i < WS; ++i)
+		c[i] = 0;
+	for (int t = 0; t < K; t += TS)
+	{
+		if (ta)
+		{
+			int const h = ph + lw;
+			int const k = t + lh;
+			a[lw * la + lh] = (h < M && k < K) ? A[mad24(k, lda, h)] : 0;
+		}
+		else
+		{
+			int const h = ph + lh;
+			int const k = t + lw;
+			a[lh * la + lw] = (h < M && k < K) ? A[mad24(h, lda, k)] : 0;
+		}
+		for (int p = 0; p < WS; ++p)
+		{
+			if (tb)
+			{
+				int const w = pw + lh + TS * p;
+				int const k = t + lw;
+				b[lw * lb + lh + TS * p] = (k < K && w < N) ? B[mad24(w, ldb, k)] : 0;
+			}
+			else
+			{
+				int const w = pw + lw + TS * p;
+				int const k = t + lh;
+				b[lh * lb + lw + TS * p] = (k < K && w < N) ? B[mad24(k, ldb, w)] : 0;
+			}
+		}
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+		for (int i = 0; i < TS; ++i)
+			for (int p = 0; p < WS; ++p)
+				c[p] += a[lh * la + i] * b[i * lb + TS * p + lw];
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	}
+}
+
+// C = alpha * c + beta * C for the WS columns of gemm_op, C is not read if beta is 0
+inline void gemm_store(int const M, int const N, float const alpha, float const beta,
+	__global float* C, int const ldc, float const* c)
+{
+	int const h = get_group_id(1) * TS + get_local_id(1);
+	for (int p = 0; p < WS; ++p)
+	{
+		int const w = get_group_id(0) * TS * WS + get_local_id(0) + TS * p;
+		if (h < M && w < N)
+		{
+			__global float* y = C + mad24(h, ldc, w);
+			*y = beta == 0 ? alpha * c[p] : alpha * c[p] + beta * *y;
+		}
+	}
+}
+
+__kernel void sgemm_nn(int const M, int const N, int const K, float const alpha,
+	__global float const* A, int const oa, int const lda, __global float const* B, int const ob, int const ldb,
+	float const beta, __global float* C, int const oc, int const ldc)
+{
+	__local float a[TS][TS + 1], b[TS][TS * WS + 1];
+	float c[WS];
+	gemm_op(0, 0, M, N, K, A + oa, lda, B + ob, ldb, a[0], b[0], c);
+	gemm_store(M, N, alpha, beta, C + oc, ldc, c);
+}
+
+__kernel void sgemm_nt(int const M, int const N, int const K, float const alpha,
+	__global float const* A, int const oa, int const lda, __global float const* B, int const ob, int const ldb,
+	float const beta, __global float* C, int const oc, int const ldc)
+{
+	__local float a[TS][TS + 1], b[TS][TS * WS + 1];
+	float c[WS];
+	gemm_op(0, 1, M, N, K, A + oa, lda, B + ob, ldb, a[0], b[0], c);
+	gemm_store(M, N, alpha, beta, C + oc, ldc, c);
+}
+
+__kernel void sgemm_tn(int const M, int const N, int const K, float const alpha,
+	__global float const* A, int const oa, int const lda, __global float const* B, int const ob, int const ldb,
+	float const beta, __global float* C, int const oc, int const ldc)
+{
+	__local float a[TS][TS + 1], b[TS][TS * WS + 1];
+	float c[WS];
+	gemm_op(1, 0, M, N, K, A + oa, lda, B + ob, ldb, a[0], b[0], c);
+	gemm_store(M, N, alpha, beta, C + oc, ldc, c);
+}
+
+__kernel void sgemm_tt(int const M, int const N, int const K, float const alpha,
+	__global float const* A, int const oa, int const lda, __global float const* B, int const ob, int const ldb,
+	float const beta, __global float* C, int const oc, int const ldc)
+{
+	__local float a[TS][TS + 1], b[TS][TS * WS + 1];
+	float c[WS];
+	gemm_op(1, 1, M, N, K, A + oa, lda, B + ob, ldb, a[0], b[0], c);
+	gemm_store(M, N, alpha, beta, C + oc, ldc, c);
+}
+
+// C = alpha * A * op(B) + beta * C for N <= NS, GV lanes stride along a row of A so that A is read once
+// and coalesced, the nw partial sums of every lane are added in local memory.
+// B(k, w) is B[k * sk + w * sw] so that both op(B) are covered
+inline void skinny_nop(int const nw, int const M, int const K, float const alpha,
+	__global float const* A, int const lda, __global float const* B, int const sk, int const sw,
+	float const beta, __global float* C, int const ldc, __local float* S)
+{
+	int const lx = get_local_id(0);
+	int const ly = get_local_id(1);
+	int const h = get_global_id(1);
+	float c[NS];
+	for (int w = 0; w < nw; ++w)
+		c[w] = 0;
+	if (h < M)
+		for (int k = lx; k < K; k += GV)
+		{
+			float const a = A[mad24(h, lda, k)];
+			for (int w = 0; w < nw; ++w)
+				c[w] += a * B[mad24(k, sk, w * sw)];
+		}
+	for (int w = 0; w < nw; ++w)
+		S[(ly * nw + w) * GV + lx] = c[w];
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	if (h < M && lx < nw)
+	{
+		float s = 0;
+		for (int i = 0; i < GV; ++i)
+			s += S[(ly * nw + lx) * GV + i];
+		__global float* y = C + mad24(h, ldc, lx);
+		*y = beta == 0 ? alpha * s : alpha * s + beta * *y;
+	}
+}
+
+// C = alpha * A^T * op(B) + beta * C for N <= NS, A is K x M, a lane owns a column of A
+// and the GR rows of the work-group split K, partial sums are added in local memory
+inline void skinny_top(int const nw, int const M, int const K, float const alpha,
+	__global float const* A, int const lda, __global float const* B, int const sk, int const sw,
+	float const beta, __global float* C, int const ldc, __local float* S)
+{
+	int const lx = get_local_id(0);
+	int const ly = get_local_id(1);
+	int const h = get_global_id(0);
+	float c[NS];
+	for (int w = 0; w < nw; ++w)
+		c[w] = 0;
+	if (h < M)
+		for (int k = ly; k < K; k += GR)
+		{
+			float const a = A[mad24(k, lda, h)];
+			for (int w = 0; w < nw; ++w)
+				c[w] += a * B[mad24(k, sk, w * sw)];
+		}
+	for (int w = 0; w < nw; ++w)
+		S[(w * GR + ly) * GV + lx] = c[w];
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	if (h < M)
+		for (int w = ly; w < nw; w += GR)
+		{
+			float s = 0;
+			for (int i = 0; i < GR; ++i)
+				s += S[(w * GR + i) * GV + lx];
+			__global float* y = C + mad24(h, ldc, w);
+			*y = beta == 0 ? alpha * s : alpha * s + beta * *y;
+		}
+}
+
+// y = alpha * A * x + beta * y, x and y have strides incx and incy
+__kernel void gemv_n(int const M, int const K, float const alpha,
+	__global float const* A, int const oa, int const lda, __global float const* x, int const ox, int const incx,
+	float const beta, __global float* y, int const oy, int const incy)
+{
+	__local float S[GR * GV];
+	skinny_nop(1, M, K, alpha, A + oa, lda, x + ox, incx, 0, beta, y + oy, incy, S);
+}
+
+// y = alpha * A^T * x + beta * y
+__kernel void gemv_t(int const M, int const K, float const alpha,
+	__global float const* A, int const oa, int const lda, __global float const* x, int const ox, int const incx,
+	float const beta, __global float* y, int const oy, int const incy)
+{
+	__local float S[GR * GV];
+	skinny_top(1, M, K, alpha, A + oa, lda, x + ox, incx, 0, beta, y + oy, incy, S);
+}
+
+// sgemm with N <= NS, arguments as sgemm_nn but B is addressed by (sk, sw) for either transpose
+__kernel void skinny_n(int const M, int const N, int const K, float const alpha,
+	__global float const* A, int const oa, int const lda, __global float const* B, int const ob, int const sk, int const sw,
+	float const beta, __global float* C, int const oc, int const ldc)
+{
+	__local float S[NS * GR * GV];
+	skinny_nop(N, M, K, alpha, A + oa, lda, B + ob, sk, sw, beta, C + oc, ldc, S);
+}
+
+__kernel void skinny_t(int const M, int const N, int const K, float const alpha,
+	__global float const* A, int const oa, int const lda, __global float const* B, int const ob, int const sk, int const sw,
+	float const beta, __global float* C, int const oc, int const ldc)
+{
+	__local float S[NS * GR * GV];
+	skinny_top(N, M, K, alpha, A + oa, lda, B + ob, sk, sw, beta, C + oc, ldc, S);
+}
+
+
+// fused epilogue of sgemm_ep, set with -D at build time:
+// EP0 .. EP3 name the steps applied in order to alpha * op(A) * op(B) + beta * C, each one of
+// bias_row (+ bias[h]), bias_col (+ bias[w]), relu, gelu, residual (+ R[h * ldr + w]);
+// OUT_HALF stores C as half, TA and TB select the transposes
+#ifndef TA
+#	define TA 0
+#endif
+
+#ifndef TB
+#	define TB 0
+#endif
+
+#ifdef OUT_HALF
+#	define CTYPE half
+#	define LOADC(i, C) vload_half(i, C)
+#	define STOREC(v, i, C) vstore_half_rte(v, i, C)
+#else
+#	define CTYPE float
+#	define LOADC(i, C) C[i]
+#	define STOREC(v, i, C) C[i] = v
+#endif
+
+#define EP_CAT(a, b) a##b
+#define EP_STEP(op) v = EP_CAT(ep_, op)(v, h, w, bias, R, ldr)
+
+inline float ep_bias_row(float const v, int const h, int const w,
+	__global float const* bias, __global float const* R, int const ldr)
+{
+	return v + bias[h];
+}
+
+inline float ep_bias_col(float const v, int const h, int const w,
+	__global float const* bias, __global float const* R, int const ldr)
+{
+	return v + bias[w];
+}
+
+inline float ep_relu(float const v, int const h, int const w,
+	__global float const* bias, __global float const* R, int const ldr)
+{
+	return fmax(v, 0.f);
+}
+
+// tanh approximation
+inline float ep_gelu(float const v, int const h, int const w,
+	__global float const* bias, __global float const* R, int const ldr)
+{
+	return 0.5f * v * (1.f + tanh(0.7978845608f * (v + 0.044715f * v * v * v)));
+}
+
+inline float ep_residual(float const v, int const h, int const w,
+	__global float const* bias, __global float const* R, int const ldr)
+{
+	return v + R[mad24(h, ldr, w)];
+}
+
+inline float epilogue(float v, int const h, int const w,
+	__global float const* bias, __global float const* R, int const ldr)
+{
+#ifdef EP0
+	EP_STEP(EP0);
+#endif
+#ifdef EP1
+	EP_STEP(EP1);
+#endif
+#ifdef EP2
+	EP_STEP(EP2);
+#endif
+#ifdef EP3
+	EP_STEP(EP3);
+#endif
+	return v;
+}
+
+// sgemm with the epilogue applied before the only store of C
+__kernel void sgemm_ep(int const M, int const N, int const K, float const alpha,
+	__global float const* A, int const oa, int const lda, __global float const* B, int const ob, int const ldb,
+	float const beta, __global CTYPE* C, int const oc, int const ldc,
+	__global float const* bias, __global float const* R, int const ldr)
+{
+	__local float a[TS][TS + 1], b[TS][TS * WS + 1];
+	float c[WS];
+	gemm_op(TA, TB, M, N, K, A + oa, lda, B + ob, ldb, a[0], b[0], c);
+	C += oc;
+	int const h = get_group_id(1) * TS + get_local_id(1);
+	for (int p = 0; p < WS; ++p)
+	{
+		int const w = get_group_id(0) * TS * WS + get_local_id(0) + TS * p;
+		if (h < M && w < N)
+		{
+			int const i = mad24(h, ldc, w);
+			float v = beta == 0 ? alpha * c[p] : alpha * c[p] + beta * LOADC(i, C);
+			v = epilogue(v, h, w, bias, R, ldr);
+			STOREC(v, i, C);
+		}
+	}
+}
+
+// a single epilogue step as its own pass over C, 0 .. 4 for bias_row .. residual
+__kernel void ep_pass(int const M, int const N, __global float* C, int const ldc,
+	__global float const* bias, __global float const* R, int const ldr, int const step)
+{
+	int const w = get_global_id(0);
+	int const h = get_global_id(1);
+	if (h >= M || w >= N)
+		return;
+	float v = C[mad24(h, ldc, w)];
+	switch (step)
+	{
+	case 0: v = ep_bias_row(v, h, w, bias, R, ldr); break;
+	case 1: v = ep_bias_col(v, h, w, bias, R, ldr); break;
+	case 2: v = ep_relu(v, h, w, bias, R, ldr); break;
+	case 3: v = ep_gelu(v, h, w, bias, R, ldr); break;
+	default: v = ep_residual(v, h, w, bias, R, ldr); break;
 	}
+	C[mad24(h, ldc, w)] = v;
 }
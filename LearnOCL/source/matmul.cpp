@@ -1,9 +1,96 @@
 ﻿#define _CRT_SECURE_NO_WARNINGS
+#include <cctype>
 #include <cmath>
 #include "base.hpp"
 
 static int TS = 16;
 static int WS = 4;
+static int WPTM = 4;
+static int WPTQ = 4;
+static int SM = 32;
+// tall-skinny sgemm: largest N, lanes per row and rows per work-group
+static int NS = 16;
+static int GV = 32;
+static int GR = 8;
+
+// element type of A and B in global memory, C is always float
+enum Storage
+{
+	FP32,
+	HALF,
+	BF16,
+};
+
+// asymmetric int8, q = round(x / scale) + zero,
+// one scale and zero point for the whole matrix, or one per column if percol
+static void quantize(Mat const& X, bool percol, Mat& Y, vector<float>& scale, vector<int>& zero)
+{
+	int const n = percol ? X.cols : 1;
+	vector<float> lo(n, 0.f), hi(n, 0.f);
+	for (int h = 0; h < X.rows; ++h)
+		for (int w = 0; w < X.cols; ++w)
+		{
+			float const x = X.at<float>(h, w);
+			lo[w % n] = min(lo[w % n], x);
+			hi[w % n] = max(hi[w % n], x);
+		}
+	scale.resize(n), zero.resize(n);
+	for (int i = 0; i < n; ++i)
+	{
+		scale[i] = max(hi[i] - lo[i], 1e-8f) / 255.f;
+		zero[i] = clamp(static_cast<int>(lrint(-128 - lo[i] / scale[i])), -128, 127);
+	}
+	Y.create(X.rows, X.cols, CV_8S);
+	for (int h = 0; h < X.rows; ++h)
+		for (int w = 0; w < X.cols; ++w)
+		{
+			int q = static_cast<int>(lrint(X.at<float>(h, w) / scale[w % n])) + zero[w % n];
+			Y.at<schar>(h, w) = static_cast<schar>(clamp(q, -128, 127));
+		}
+}
+
+// x = (q - zero) * scale for CV_8S or CV_32S X, per tensor or per column as in quantize
+static void dequantize(Mat const& X, vector<float> const& scale, vector<int> const& zero, Mat& Y)
+{
+	int const n = static_cast<int>(scale.size());
+	Y.create(X.rows, X.cols, CV_32F);
+	for (int h = 0; h < X.rows; ++h)
+		for (int w = 0; w < X.cols; ++w)
+		{
+			int q = X.depth() == CV_8S ? X.at<schar>(h, w) : X.at<int>(h, w);
+			Y.at<float>(h, w) = (q - zero[w % n]) * scale[w % n];
+		}
+}
+
+// steps of the sgemm_ep epilogue, EP0 .. EP3 in matmul.cl
+enum EpStep
+{
+	BIAS_ROW,
+	BIAS_COL,
+	RELU,
+	GELU,
+	RESIDUAL,
+};
+
+// B packed by OCL::pack for matmul_packed, can be reused as long as it is alive
+struct Packed
+{
+	cl_mem P;
+	int N, Q;
+};
+
+// sub-matrix of a buffer, offset and leading dimension are in elements
+struct View
+{
+	cl_mem m;
+	int off, ld;
+
+	View at(int h, int w) const
+	{
+		View v = {m, off + h * ld + w, ld};
+		return v;
+	}
+};
 
 class OCL
 {
@@ -12,6 +99,8 @@ class OCL
 	cl_context context;
 	cl_command_queue cqueue;
 	cl_program program;
+	// matmul0 .. matmul3 built with FP64, NULL without device support
+	cl_program program64;
 	// H, W, C
 	int nkernel;
 
@@ -20,8 +109,42 @@ public:
 	~OCL();
 
 	void init_ocl();
+	cl_program build(char const* defs);
 	void init_prog();
-	void work();
+	void work(bool fp64);
+	void fp64();
+	cl_event gemm_batch(int batch, int M, int N, int Q,
+		cl_mem A, int lda, int sa, cl_mem B, int ldb, int sb, cl_mem C, int ldc, int sc);
+	void batch();
+	cl_mem convert(Storage s, cl_mem X, int n);
+	cl_event matmul_lp(Storage s, int M, int N, int Q, cl_mem A, cl_mem B, cl_mem C);
+	void lowp();
+	cl_event matmul_i8(int M, int N, int Q, cl_mem A, int za, cl_mem B, cl_mem zb, cl_mem scale, int zc, cl_mem C);
+	void quant();
+	Packed pack(cl_mem B, int N, int Q, bool trans);
+	cl_event matmul_packed(int M, Packed const& P, cl_mem A, cl_mem C);
+	void release(Packed& P);
+	void packed();
+	double gemm_ooc(Mat const& A, Mat const& B, Mat& C, size_t budget);
+	void outofcore();
+	void matadd(cl_command_queue q, cl_kernel K, int M, int Q, View A, View B, float beta, View C);
+	void matmul_view(cl_command_queue q, cl_kernel K, int M, int N, int Q, View A, View B, View C);
+	void winograd(cl_command_queue* q, int nq, cl_kernel* K, int n, View A, View B, View C, int cutoff);
+	double gemm_strassen(int n, cl_mem A, cl_mem B, cl_mem C, int cutoff);
+	int tune_strassen(int n);
+	void strassen();
+	cl_event sgemm(bool ta, bool tb, int M, int N, int K, float alpha, cl_mem A, int oa, int lda,
+		cl_mem B, int ob, int ldb, float beta, cl_mem C, int oc, int ldc);
+	void blas();
+	cl_event sgemm_tile(bool ta, bool tb, int M, int N, int K, float alpha, cl_mem A, int oa, int lda,
+		cl_mem B, int ob, int ldb, float beta, cl_mem C, int oc, int ldc);
+	cl_event skinny(bool ta, bool tb, int M, int N, int K, float alpha, cl_mem A, int oa, int lda,
+		cl_mem B, int ob, int ldb, float beta, cl_mem C, int oc, int ldc);
+	void tallskinny();
+	cl_program build_ep(EpStep const* step, int nstep, bool half, bool ta, bool tb);
+	cl_event sgemm_ep(cl_program prog, int M, int N, int K, float alpha, cl_mem A, int oa, int lda,
+		cl_mem B, int ob, int ldb, float beta, cl_mem C, int oc, int ldc, cl_mem bias, cl_mem R, int ldr);
+	void epilogue();
 };
 
 OCL::OCL()
@@ -32,6 +155,7 @@ OCL::OCL()
 OCL::~OCL()
 {
 	if (program) clReleaseProgram(program);
+	if (program64) clReleaseProgram(program64);
 	if (cqueue) clReleaseCommandQueue(cqueue);
 	if (context) clReleaseContext(context);
 	if (device) clReleaseDevice(device);
@@ -114,38 +238,56 @@ void OCL::init_ocl()
 	CheckCLError(cqueue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
 }
 
-void OCL::init_prog()
+// builds matmul.cl and mattranspose.cl with the common options and defs appended
+cl_program OCL::build(char const* defs)
 {
 	cl_int err;
 	char info[4096];
 	string K = string(__FILE__);
+	// matpack lives with the other transpose kernels
+	string T = K.substr(0, K.size() - strlen("matmul.cpp")) + "mattranspose.cl";
 	K = K.substr(0, K.size() - 4) + ".cl";
 	K = loadCLFile(K.data());
-	char const* KS[] = {K.data()};
-	snprintf(info, sizeof(info), "-cl-std=CL2.0 -cl-kernel-arg-info -Werror -DTS=%d -DWS=%d", TS, WS);
-	CheckCLError(program = clCreateProgramWithSource(context, 1, KS, 0, &err));
-	err = clBuildProgram(program, 1, &device, info, NULL, NULL);
-	clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
+	T = loadCLFile(T.data());
+	char const* KS[] = {K.data(), T.data()};
+	snprintf(info, sizeof(info), "-cl-std=CL2.0 -cl-kernel-arg-info -Werror -DTS=%d -DWS=%d -DWPTM=%d -DWPTQ=%d -DSM=%d -DNS=%d -DGV=%d -DGR=%d %s",
+		TS, WS, WPTM, WPTQ, SM, NS, GV, GR, defs);
+	CheckCLError(cl_program prog = clCreateProgramWithSource(context, 2, KS, 0, &err));
+	err = clBuildProgram(prog, 1, &device, info, NULL, NULL);
+	clGetProgramBuildInfo(prog, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
 	if (err)
 	{
 		fprintf(stderr, "%s (%d), error:\n%s", clErrorString(err), err, info);
-		return;
+		clReleaseProgram(prog);
+		return NULL;
 	}
 	fprintf(stderr, "build program end with code %d, log:\n%s", err, info);
+	return prog;
+}
+
+void OCL::init_prog()
+{
+	cl_int err;
+	char info[4096];
+	program = build("");
+	if (!program)
+		return;
 	CheckCLError(err = clGetProgramInfo(program, CL_PROGRAM_KERNEL_NAMES, sizeof(info), info, NULL));
 	fprintf(stderr, "kernel names: %s\n", info);
-	nkernel = info[0] != 0;
-	for (size_t i = 1; i < _countof(info) && info[i]; ++i)
-		nkernel += info[i] == ';';
+	// only matmul0, matmul1, ... take part in work()
+	for (char const* p = strstr(info, "matmul"); p; p = strstr(p + 6, "matmul"))
+		nkernel += (p == info || p[-1] == ';') && isdigit(p[6]);
 }
 
-void OCL::work()
+// matmul0 .. matmul3 in float, or double with program64
+void OCL::work(bool fp64)
 {
 	cl_int err = cv::getNumThreads();
 	cl_event e;
 	cl_int const M = 4096, N = 5120, Q = 3072;
+	int const type = fp64 ? CV_64F : CV_32F;
 	Vec4z szlocal(TS, TS), sztotal(Q, M);
-	Mat A(M, N, CV_32F), B(N, Q, CV_32F), C(M, Q, CV_32F), D(M, Q, CV_32F);
+	Mat A(M, N, type), B(N, Q, type), C(M, Q, type), D(M, Q, type);
 	size_t dstsize = C.total() * C.elemSize();
 	randu(A, -8.0, nextafter(8.0, 9.0));
 	randu(B, -8.0, nextafter(8.0, 9.0));
@@ -155,14 +297,15 @@ void OCL::work()
 	clFlush(cqueue), clFinish(cqueue);
 	fprintf(stderr, "create matrix done\n");
 
-	char KS[32];
+	char KS[32], name[32];
 	for (int i = 0; i < nkernel; ++i)
 	{
 		swap(C, D);
-		CheckCLError(err = clEnqueueFillBuffer(cqueue, c, A.data, sizeof(float), 0, dstsize, 0, NULL, NULL));
+		CheckCLError(err = clEnqueueFillBuffer(cqueue, c, A.data, A.elemSize(), 0, dstsize, 0, NULL, NULL));
 		clFlush(cqueue), clFinish(cqueue);
 		snprintf(KS, sizeof(KS), "matmul%d", i);
-		CheckCLError(cl_kernel K = clCreateKernel(program, KS, &err));
+		snprintf(name, sizeof(name), fp64 ? "%s fp64" : "%s", KS);
+		CheckCLError(cl_kernel K = clCreateKernel(fp64 ? program64 : program, KS, &err));
 		CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
 		CheckCLError(err = clSetKernelArg(K, 1, sizeof(M), &N));
 		CheckCLError(err = clSetKernelArg(K, 2, sizeof(M), &Q));
@@ -170,12 +313,16 @@ void OCL::work()
 		CheckCLError(err = clSetKernelArg(K, 4, sizeof(b), &b));
 		CheckCLError(err = clSetKernelArg(K, 5, sizeof(c), &c));
 		sztotal[0] = i < 2 ? Q : (Q + WS - 1) / WS;
+		sztotal[1] = M;
+		if (i == 3)
+			sztotal[0] = (Q + WPTQ - 1) / WPTQ, sztotal[1] = (M + WPTM - 1) / WPTM;
 		makeDiv(sztotal, szlocal);
 		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
 		CheckCLError(clEnqueueReadBuffer(cqueue, c, CL_TRUE, 0, dstsize, C.data, 1, &e, NULL));
 		clFlush(cqueue), clFinish(cqueue);
 		CheckCLError(err = clWaitForEvents(1, &e));
-		getCLTime(e, KS);
+		double ms = getCLTime(e, name);
+		fprintf(stderr, "%s: %.1f GFLOPS\n", name, 2e-6 * M * N * Q / ms);
 		CheckCLError(err = clReleaseKernel(K));
 		if (i == 0) continue;
 		absdiff(C, D, D);
@@ -189,13 +336,1102 @@ void OCL::work()
 	CheckCLError(err = clReleaseEvent(e));
 }
 
+// matmul0 .. matmul3 again in double if either CL_DEVICE_DOUBLE_FP_CONFIG or cl_khr_fp64 says so,
+// TS, WS, WPTM and WPTQ from the command line apply to both unless the local memory is too small
+void OCL::fp64()
+{
+	cl_device_fp_config fp = 0;
+	char ext[4096] = {0};
+	clGetDeviceInfo(device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp), &fp, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, sizeof(ext), ext, NULL);
+	if (!fp && !strstr(ext, "cl_khr_fp64"))
+	{
+		fputs("device does not support FP64 (no cl_khr_fp64, CL_DEVICE_DOUBLE_FP_CONFIG is 0), skip DGEMM\n", stderr);
+		return;
+	}
+	// matmul3 keeps two K-slices of A (padded) and B in local memory, twice the bytes of float,
+	// halve its register tile for this program until they fit
+	cl_ulong lmem = 0;
+	clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(lmem), &lmem, NULL);
+	int const wptm = WPTM, wptq = WPTQ;
+	auto need = [&]() { return 2 * TS * (TS * WPTM + 1 + TS * WPTQ) * sizeof(cl_double); };
+	while (need() > lmem && (WPTM > 1 || WPTQ > 1))
+		(WPTQ >= WPTM ? WPTQ : WPTM) /= 2;
+	if (need() > lmem)
+	{
+		fprintf(stderr, "matmul3 in FP64 needs %zd bytes of local memory, device has %llu, skip DGEMM\n",
+			need(), static_cast<unsigned long long>(lmem));
+		WPTM = wptm, WPTQ = wptq;
+		return;
+	}
+	if (WPTM != wptm || WPTQ != wptq)
+		fprintf(stderr, "matmul3 in FP64 uses WPTM = %d, WPTQ = %d to fit %llu bytes of local memory\n",
+			WPTM, WPTQ, static_cast<unsigned long long>(lmem));
+	program64 = build("-DFP64");
+	if (program64)
+		work(true);
+	WPTM = wptm, WPTQ = wptq;
+}
+
+cl_event OCL::gemm_batch(int batch, int M, int N, int Q,
+	cl_mem A, int lda, int sa, cl_mem B, int ldb, int sb, cl_mem C, int ldc, int sc)
+{
+	cl_int err;
+	cl_event e;
+	bool small = M <= SM && N <= SM && Q <= SM;
+	Vec4z szlocal(TS, TS, 1), sztotal(Q, M, batch);
+	if (small)
+		sztotal[0] = sztotal[1] = TS;
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, small ? "gemm_small" : "gemm_batch", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(Q), &Q));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(lda), &lda));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(sa), &sa));
+	CheckCLError(err = clSetKernelArg(K, 6, sizeof(B), &B));
+	CheckCLError(err = clSetKernelArg(K, 7, sizeof(ldb), &ldb));
+	CheckCLError(err = clSetKernelArg(K, 8, sizeof(sb), &sb));
+	CheckCLError(err = clSetKernelArg(K, 9, sizeof(C), &C));
+	CheckCLError(err = clSetKernelArg(K, 10, sizeof(ldc), &ldc));
+	CheckCLError(err = clSetKernelArg(K, 11, sizeof(sc), &sc));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 3, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	return e;
+}
+
+void OCL::batch()
+{
+	cl_int err;
+	cl_event e;
+	// {size, batch}, size * size * sizeof(float) keeps every sub-buffer aligned
+	int const shape[][2] = {{32, 2048}, {64, 512}, {256, 32}};
+	for (size_t s = 0; s < _countof(shape); ++s)
+	{
+		int const S = shape[s][0], Z = shape[s][1];
+		size_t const sz = static_cast<size_t>(S) * S * sizeof(float);
+		Mat A(Z * S, S, CV_32F), B(Z * S, S, CV_32F), C(Z * S, S, CV_32F), D(Z * S, S, CV_32F);
+		randu(A, -8.0, nextafter(8.0, 9.0));
+		randu(B, -8.0, nextafter(8.0, 9.0));
+		CheckCLError(cl_mem a = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, sz * Z, A.data, &err));
+		CheckCLError(cl_mem b = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, sz * Z, B.data, &err));
+		CheckCLError(cl_mem c = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sz * Z, NULL, &err));
+		clFlush(cqueue), clFinish(cqueue);
+
+		// one launch per matrix through sub-buffers
+		vector<cl_mem> sub(Z * 3);
+		for (int z = 0; z < Z; ++z)
+		{
+			cl_buffer_region r = {sz * z, sz};
+			CheckCLError(sub[z * 3 + 0] = clCreateSubBuffer(a, CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &r, &err));
+			CheckCLError(sub[z * 3 + 1] = clCreateSubBuffer(b, CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &r, &err));
+			CheckCLError(sub[z * 3 + 2] = clCreateSubBuffer(c, CL_MEM_WRITE_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &r, &err));
+		}
+		CheckCLError(cl_kernel K = clCreateKernel(program, "matmul2", &err));
+		Vec4z szlocal(TS, TS), sztotal((S + WS - 1) / WS, S);
+		makeDiv(sztotal, szlocal);
+		int64_t t = cv::getTickCount();
+		for (int z = 0; z < Z; ++z)
+		{
+			CheckCLError(err = clSetKernelArg(K, 0, sizeof(S), &S));
+			CheckCLError(err = clSetKernelArg(K, 1, sizeof(S), &S));
+			CheckCLError(err = clSetKernelArg(K, 2, sizeof(S), &S));
+			CheckCLError(err = clSetKernelArg(K, 3, sizeof(cl_mem), &sub[z * 3 + 0]));
+			CheckCLError(err = clSetKernelArg(K, 4, sizeof(cl_mem), &sub[z * 3 + 1]));
+			CheckCLError(err = clSetKernelArg(K, 5, sizeof(cl_mem), &sub[z * 3 + 2]));
+			CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, NULL));
+		}
+		clFinish(cqueue);
+		double loop = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+		CheckCLError(clEnqueueReadBuffer(cqueue, c, CL_TRUE, 0, sz * Z, D.data, 0, NULL, NULL));
+		CheckCLError(err = clReleaseKernel(K));
+		for (size_t i = 0; i < sub.size(); ++i)
+		{
+			CheckCLError(err = clReleaseMemObject(sub[i]));
+		}
+
+		CheckCLError(err = clEnqueueFillBuffer(cqueue, c, A.data, sizeof(float), 0, sz * Z, 0, NULL, NULL));
+		clFinish(cqueue);
+		t = cv::getTickCount();
+		e = gemm_batch(Z, S, S, S, a, S, S * S, b, S, S * S, c, S, S * S);
+		clFinish(cqueue);
+		double bat = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+		CheckCLError(clEnqueueReadBuffer(cqueue, c, CL_TRUE, 0, sz * Z, C.data, 1, &e, NULL));
+		CheckCLError(err = clReleaseEvent(e));
+
+		double const flop = 2e-6 * S * S * S * Z;
+		fprintf(stderr, "%d x %dx%d: matmul2 loop %.2fms (%.1f GFLOPS), %s %.2fms (%.1f GFLOPS)\n",
+			Z, S, S, loop, flop / loop, S <= SM ? "gemm_small" : "gemm_batch", bat, flop / bat);
+		absdiff(C, D, D);
+		fprintf(stderr, "difference = %f\n", sum(D)[0]);
+		fflush(stderr);
+		CheckCLError(err = clReleaseMemObject(a));
+		CheckCLError(err = clReleaseMemObject(b));
+		CheckCLError(err = clReleaseMemObject(c));
+	}
+}
+
+// X (float) to a new buffer of storage s
+cl_mem OCL::convert(Storage s, cl_mem X, int n)
+{
+	cl_int err;
+	size_t const esz = s == FP32 ? sizeof(float) : sizeof(cl_ushort);
+	CheckCLError(cl_mem Y = clCreateBuffer(context, CL_MEM_READ_WRITE, esz * n, NULL, &err));
+	if (s == FP32)
+	{
+		CheckCLError(err = clEnqueueCopyBuffer(cqueue, X, Y, 0, 0, esz * n, 0, NULL, NULL));
+		return Y;
+	}
+	Vec4z szlocal(TS * TS), sztotal(n);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, s == HALF ? "to_half" : "to_bf16", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(n), &n));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(X), &X));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(Y), &Y));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, sztotal.val, szlocal.val, 0, NULL, NULL));
+	CheckCLError(err = clReleaseKernel(K));
+	return Y;
+}
+
+// C = A * B with A and B stored as s, FP32 runs matmul2
+cl_event OCL::matmul_lp(Storage s, int M, int N, int Q, cl_mem A, cl_mem B, cl_mem C)
+{
+	cl_int err;
+	cl_event e;
+	char const* name[] = {"matmul2", "matmul_half", "matmul_bf16"};
+	Vec4z szlocal(TS, TS), sztotal((Q + WS - 1) / WS, M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, name[s], &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(Q), &Q));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(B), &B));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(C), &C));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	return e;
+}
+
+void OCL::lowp()
+{
+	cl_int err;
+	cl_int const M = 1024, N = 8192, Q = 1024;
+	char const* name[] = {"fp32", "half", "bf16"};
+	Mat A(M, N, CV_32F), B(N, Q, CV_32F), C(M, Q, CV_32F), R(M, Q, CV_32F);
+	randu(A, -1.0, 1.0);
+	randu(B, -1.0, 1.0);
+	CheckCLError(cl_mem a = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, A.total() * A.elemSize(), A.data, &err));
+	CheckCLError(cl_mem b = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, B.total() * B.elemSize(), B.data, &err));
+	CheckCLError(cl_mem c = clCreateBuffer(context, CL_MEM_WRITE_ONLY, C.total() * C.elemSize(), NULL, &err));
+	for (int s = FP32; s <= BF16; ++s)
+	{
+		cl_mem x = convert(static_cast<Storage>(s), a, M * N);
+		cl_mem y = convert(static_cast<Storage>(s), b, N * Q);
+		clFinish(cqueue);
+		cl_event e = matmul_lp(static_cast<Storage>(s), M, N, Q, x, y, c);
+		CheckCLError(clEnqueueReadBuffer(cqueue, c, CL_TRUE, 0, C.total() * C.elemSize(), C.data, 1, &e, NULL));
+		double ms = getCLTime(e, name[s]);
+		size_t bytes = (s == FP32 ? sizeof(float) : sizeof(cl_ushort)) * (M * N + N * Q);
+		fprintf(stderr, "%s: %.1f GFLOPS, A + B %.1f MB\n", name[s], 2e-6 * M * N * Q / ms, bytes / 1048576.0);
+		if (s == FP32)
+			C.copyTo(R);
+		else
+		{
+			double maxdif = norm(C, R, cv::NORM_INF);
+			double reldif = norm(C, R, cv::NORM_L2) / norm(R, cv::NORM_L2);
+			fprintf(stderr, "%s vs fp32: max abs error %g, relative L2 error %g\n", name[s], maxdif, reldif);
+		}
+		fflush(stderr);
+		CheckCLError(err = clReleaseEvent(e));
+		CheckCLError(err = clReleaseMemObject(x));
+		CheckCLError(err = clReleaseMemObject(y));
+	}
+	CheckCLError(err = clReleaseMemObject(a));
+	CheckCLError(err = clReleaseMemObject(b));
+	CheckCLError(err = clReleaseMemObject(c));
+}
+
+// int8 GEMM, int32 C if scale is NULL, otherwise requantized int8 C
+cl_event OCL::matmul_i8(int M, int N, int Q, cl_mem A, int za, cl_mem B, cl_mem zb, cl_mem scale, int zc, cl_mem C)
+{
+	cl_int err;
+	cl_event e;
+	int arg = 0;
+	Vec4z szlocal(TS, TS), sztotal((Q + WS - 1) / WS, M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, scale ? "matmul_i8q" : "matmul_i8", &err));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(Q), &Q));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(za), &za));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(B), &B));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(zb), &zb));
+	if (scale)
+	{
+		CheckCLError(err = clSetKernelArg(K, arg++, sizeof(scale), &scale));
+		CheckCLError(err = clSetKernelArg(K, arg++, sizeof(zc), &zc));
+	}
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(C), &C));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	return e;
+}
+
+void OCL::quant()
+{
+	cl_int err;
+	cl_int const M = 1024, N = 4096, Q = 1024;
+	Mat A(M, N, CV_32F), B(N, Q, CV_32F), R(M, Q, CV_32F), C(M, Q, CV_32S), D(M, Q, CV_8S), F;
+	randu(A, 0.0, 4.0);
+	randn(B, 0.0, 0.5);
+	CheckCLError(cl_mem a = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, A.total() * A.elemSize(), A.data, &err));
+	CheckCLError(cl_mem b = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, B.total() * B.elemSize(), B.data, &err));
+	CheckCLError(cl_mem r = clCreateBuffer(context, CL_MEM_WRITE_ONLY, R.total() * R.elemSize(), NULL, &err));
+	cl_event e = matmul_lp(FP32, M, N, Q, a, b, r);
+	CheckCLError(clEnqueueReadBuffer(cqueue, r, CL_TRUE, 0, R.total() * R.elemSize(), R.data, 1, &e, NULL));
+	double ms = getCLTime(e, "fp32");
+	fprintf(stderr, "fp32: %.1f GFLOPS\n", 2e-6 * M * N * Q / ms);
+	CheckCLError(err = clReleaseEvent(e));
+	CheckCLError(err = clReleaseMemObject(a));
+	CheckCLError(err = clReleaseMemObject(b));
+	CheckCLError(err = clReleaseMemObject(r));
+
+	for (int percol = 0; percol < 2; ++percol)
+	{
+		Mat QA, QB;
+		vector<float> sa, sb, sc(1), s(Q);
+		vector<int> za, zb, zc(1), z(Q, 0);
+		quantize(A, false, QA, sa, za);
+		quantize(B, percol != 0, QB, sb, zb);
+		zb.resize(Q, zb[0]), sb.resize(Q, sb[0]);
+		double lo, hi;
+		minMaxLoc(R, &lo, &hi);
+		sc[0] = static_cast<float>(max(hi - lo, 1e-8) / 255);
+		zc[0] = clamp(static_cast<int>(lrint(-128 - lo / sc[0])), -128, 127);
+		for (int w = 0; w < Q; ++w)
+			s[w] = sa[0] * sb[w] / sc[0];
+		CheckCLError(a = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, QA.total(), QA.data, &err));
+		CheckCLError(b = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, QB.total(), QB.data, &err));
+		CheckCLError(cl_mem zbuf = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, Q * sizeof(int), zb.data(), &err));
+		CheckCLError(cl_mem sbuf = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, Q * sizeof(float), s.data(), &err));
+		CheckCLError(cl_mem c = clCreateBuffer(context, CL_MEM_WRITE_ONLY, C.total() * C.elemSize(), NULL, &err));
+		CheckCLError(cl_mem d = clCreateBuffer(context, CL_MEM_WRITE_ONLY, D.total() * D.elemSize(), NULL, &err));
+		char const* name = percol ? "int8 per-column" : "int8 per-tensor";
+
+		e = matmul_i8(M, N, Q, a, za[0], b, zbuf, NULL, 0, c);
+		CheckCLError(clEnqueueReadBuffer(cqueue, c, CL_TRUE, 0, C.total() * C.elemSize(), C.data, 1, &e, NULL));
+		ms = getCLTime(e, name);
+		CheckCLError(err = clReleaseEvent(e));
+		for (int w = 0; w < Q; ++w)
+			s[w] = sa[0] * sb[w];
+		dequantize(C, s, z, F);
+		fprintf(stderr, "%s: %.1f GOPS, relative L2 error %g\n", name, 2e-6 * M * N * Q / ms, norm(F, R, cv::NORM_L2) / norm(R, cv::NORM_L2));
+
+		e = matmul_i8(M, N, Q, a, za[0], b, zbuf, sbuf, zc[0], d);
+		CheckCLError(clEnqueueReadBuffer(cqueue, d, CL_TRUE, 0, D.total() * D.elemSize(), D.data, 1, &e, NULL));
+		ms = getCLTime(e, "requantize");
+		CheckCLError(err = clReleaseEvent(e));
+		dequantize(D, sc, zc, F);
+		fprintf(stderr, "%s + requantize: %.1f GOPS, relative L2 error %g\n", name, 2e-6 * M * N * Q / ms, norm(F, R, cv::NORM_L2) / norm(R, cv::NORM_L2));
+		fflush(stderr);
+		CheckCLError(err = clReleaseMemObject(a));
+		CheckCLError(err = clReleaseMemObject(b));
+		CheckCLError(err = clReleaseMemObject(zbuf));
+		CheckCLError(err = clReleaseMemObject(sbuf));
+		CheckCLError(err = clReleaseMemObject(c));
+		CheckCLError(err = clReleaseMemObject(d));
+	}
+}
+
+// B is N x Q, or Q x N if trans
+Packed OCL::pack(cl_mem B, int N, int Q, bool trans)
+{
+	cl_int err;
+	Packed P;
+	int const tr = trans;
+	size_t const npanel = (Q + TS * WS - 1) / (TS * WS);
+	size_t const ntile = (N + TS - 1) / TS;
+	P.N = N, P.Q = Q;
+	CheckCLError(P.P = clCreateBuffer(context, CL_MEM_READ_WRITE, npanel * ntile * TS * TS * WS * sizeof(float), NULL, &err));
+	Vec4z szlocal(TS, TS), sztotal(npanel * TS, ntile * TS);
+	CheckCLError(cl_kernel K = clCreateKernel(program, "matpack", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(Q), &Q));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(tr), &tr));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(B), &B));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(P.P), &P.P));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, NULL));
+	CheckCLError(err = clReleaseKernel(K));
+	return P;
+}
+
+// C = A * B, A is M x P.N
+cl_event OCL::matmul_packed(int M, Packed const& P, cl_mem A, cl_mem C)
+{
+	cl_int err;
+	cl_event e;
+	Vec4z szlocal(TS, TS), sztotal((P.Q + WS - 1) / WS, M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, "matmul_packed", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(P.N), &P.N));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(P.Q), &P.Q));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(P.P), &P.P));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(C), &C));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	return e;
+}
+
+void OCL::release(Packed& P)
+{
+	if (P.P) clReleaseMemObject(P.P);
+	P.P = NULL;
+}
+
+void OCL::packed()
+{
+	cl_int err;
+	cl_int const M = 1024, N = 8192, Q = 1024;
+	Mat A(M, N, CV_32F), B(N, Q, CV_32F), Bt(Q, N, CV_32F), C(M, Q, CV_32F), D(M, Q, CV_32F);
+	randu(A, -8.0, nextafter(8.0, 9.0));
+	randu(B, -8.0, nextafter(8.0, 9.0));
+	transpose(B, Bt);
+	CheckCLError(cl_mem a = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, A.total() * A.elemSize(), A.data, &err));
+	CheckCLError(cl_mem b = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, B.total() * B.elemSize(), B.data, &err));
+	CheckCLError(cl_mem bt = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, Bt.total() * Bt.elemSize(), Bt.data, &err));
+	CheckCLError(cl_mem c = clCreateBuffer(context, CL_MEM_WRITE_ONLY, C.total() * C.elemSize(), NULL, &err));
+	cl_event e = matmul_lp(FP32, M, N, Q, a, b, c);
+	CheckCLError(clEnqueueReadBuffer(cqueue, c, CL_TRUE, 0, D.total() * D.elemSize(), D.data, 1, &e, NULL));
+	getCLTime(e, "matmul2");
+	CheckCLError(err = clReleaseEvent(e));
+
+	for (int trans = 0; trans < 2; ++trans)
+	{
+		int64_t t = cv::getTickCount();
+		Packed P = pack(trans ? bt : b, N, Q, trans != 0);
+		clFinish(cqueue);
+		fprintf(stderr, "pack%s: %.2fms\n", trans ? " transposed" : "", (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency());
+		// the packed B is reused by every call
+		for (int i = 0; i < 2; ++i)
+		{
+			e = matmul_packed(M, P, a, c);
+			CheckCLError(clEnqueueReadBuffer(cqueue, c, CL_TRUE, 0, C.total() * C.elemSize(), C.data, 1, &e, NULL));
+			getCLTime(e, "matmul_packed");
+			CheckCLError(err = clReleaseEvent(e));
+		}
+		absdiff(C, D, C);
+		fprintf(stderr, "difference = %f\n", sum(C)[0]);
+		fflush(stderr);
+		release(P);
+	}
+	CheckCLError(err = clReleaseMemObject(a));
+	CheckCLError(err = clReleaseMemObject(b));
+	CheckCLError(err = clReleaseMemObject(bt));
+	CheckCLError(err = clReleaseMemObject(c));
+}
+
+// C = A * B on the host matrices using at most budget bytes of device memory,
+// returns the wall time in ms
+double OCL::gemm_ooc(Mat const& A, Mat const& B, Mat& C, size_t budget)
+{
+	cl_int err;
+	cl_uint align;
+	int const M = A.rows, N = A.cols, Q = B.cols;
+	int const G = TS * WS;
+	CheckCLError(err = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(align), &align, NULL));
+	align /= 8;
+	// two T x T blocks for each of the A panel, the B panel and the C tile
+	int T = static_cast<int>(sqrt(max(budget / 6.0 - align, 0.0) / sizeof(float))) / G * G;
+	T = min(T, (max(max(M, N), Q) + G - 1) / G * G);
+	if (T <= 0)
+	{
+		fprintf(stderr, "gemm_ooc: budget %zu is too small\n", budget);
+		return 0;
+	}
+	size_t const blk = (T * T * sizeof(float) + align - 1) / align * align;
+	C.create(M, Q, CV_32F);
+
+	// A0, A1, B0, B1, C0, C1 are sub-buffers of one pool
+	cl_mem buf[6];
+	CheckCLError(cl_mem pool = clCreateBuffer(context, CL_MEM_READ_WRITE, 6 * blk, NULL, &err));
+	for (int i = 0; i < 6; ++i)
+	{
+		cl_buffer_region r = {blk * i, blk};
+		CheckCLError(buf[i] = clCreateSubBuffer(pool, CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &r, &err));
+	}
+	// uploads, kernels and downloads go to three queues and are ordered by events
+	CheckCLError(cl_command_queue uq = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
+	CheckCLError(cl_command_queue dq = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
+	CheckCLError(cl_kernel K = clCreateKernel(program, "matmul_acc", &err));
+	vector<cl_event> xev, kev;
+	cl_event up[2] = {NULL, NULL}, run[2] = {NULL, NULL}, back[2] = {NULL, NULL};
+	int64_t t = cv::getTickCount();
+	int step = 0, tile = 0;
+	for (int i = 0; i < M; i += T)
+		for (int j = 0; j < Q; j += T, tile ^= 1)
+		{
+			int const m = min(T, M - i), q = min(T, Q - j);
+			cl_mem c = buf[4 + tile];
+			for (int k = 0; k < N; k += T, step ^= 1)
+			{
+				int const n = min(T, N - k), acc = k > 0;
+				cl_mem a = buf[step], b = buf[2 + step];
+				cl_event wait[2];
+				cl_uint nwait = 0;
+				size_t bo[3] = {0, 0, 0}, ho[3] = {k * sizeof(float), static_cast<size_t>(i), 0};
+				size_t reg[3] = {n * sizeof(float), static_cast<size_t>(m), 1};
+				// the panels of this slot may still be read by the previous kernel
+				CheckCLError(err = clEnqueueWriteBufferRect(uq, a, CL_FALSE, bo, ho, reg, n * sizeof(float), 0,
+					A.step[0], 0, A.data, run[step] ? 1 : 0, run[step] ? &run[step] : NULL, &up[step]));
+				xev.push_back(up[step]);
+				ho[0] = j * sizeof(float), ho[1] = k;
+				reg[0] = q * sizeof(float), reg[1] = n;
+				CheckCLError(err = clEnqueueWriteBufferRect(uq, b, CL_FALSE, bo, ho, reg, q * sizeof(float), 0,
+					B.step[0], 0, B.data, 0, NULL, &up[step]));
+				xev.push_back(up[step]);
+				wait[nwait++] = up[step];
+				// the tile of this slot may still be read back
+				if (k == 0 && back[tile])
+					wait[nwait++] = back[tile];
+				Vec4z szlocal(TS, TS), sztotal((q + WS - 1) / WS, m);
+				makeDiv(sztotal, szlocal);
+				CheckCLError(err = clSetKernelArg(K, 0, sizeof(m), &m));
+				CheckCLError(err = clSetKernelArg(K, 1, sizeof(n), &n));
+				CheckCLError(err = clSetKernelArg(K, 2, sizeof(q), &q));
+				CheckCLError(err = clSetKernelArg(K, 3, sizeof(a), &a));
+				CheckCLError(err = clSetKernelArg(K, 4, sizeof(b), &b));
+				CheckCLError(err = clSetKernelArg(K, 5, sizeof(c), &c));
+				CheckCLError(err = clSetKernelArg(K, 6, sizeof(acc), &acc));
+				CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, nwait, wait, &run[step]));
+				kev.push_back(run[step]);
+				clFlush(uq), clFlush(cqueue);
+			}
+			size_t bo[3] = {0, 0, 0}, ho[3] = {j * sizeof(float), static_cast<size_t>(i), 0};
+			size_t reg[3] = {q * sizeof(float), static_cast<size_t>(m), 1};
+			CheckCLError(err = clEnqueueReadBufferRect(dq, c, CL_FALSE, bo, ho, reg, q * sizeof(float), 0,
+				C.step[0], 0, C.data, 1, &run[step ^ 1], &back[tile]));
+			xev.push_back(back[tile]);
+			clFlush(dq);
+		}
+	clFinish(uq), clFinish(cqueue), clFinish(dq);
+	double wall = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+
+	// overlap efficiency: the part of the shorter of transfer and compute time hidden under the other
+	double tx = 0, tk = 0;
+	for (size_t i = 0; i < xev.size() + kev.size(); ++i)
+	{
+		cl_event e = i < xev.size() ? xev[i] : kev[i - xev.size()];
+		(i < xev.size() ? tx : tk) += getCLTime(e, NULL);
+		CheckCLError(err = clReleaseEvent(e));
+	}
+	double eff = clamp((tx + tk - wall) / max(min(tx, tk), 1e-9), 0.0, 1.0);
+	fprintf(stderr, "gemm_ooc: T = %d, device memory %.1f MB, wall %.2fms, transfer %.2fms, kernel %.2fms, overlap efficiency %.0f%%\n",
+		T, 6.0 * blk / 1048576, wall, tx, tk, eff * 100);
+	fflush(stderr);
+
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clReleaseCommandQueue(uq));
+	CheckCLError(err = clReleaseCommandQueue(dq));
+	for (int i = 0; i < 6; ++i)
+	{
+		CheckCLError(err = clReleaseMemObject(buf[i]));
+	}
+	CheckCLError(err = clReleaseMemObject(pool));
+	return wall;
+}
+
+void OCL::outofcore()
+{
+	cl_ulong maxalloc, global;
+	int const M = 4096, N = 5120, Q = 3072;
+	Mat A(M, N, CV_32F), B(N, Q, CV_32F), C;
+	randu(A, -8.0, nextafter(8.0, 9.0));
+	randu(B, -8.0, nextafter(8.0, 9.0));
+	clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxalloc), &maxalloc, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global), &global, NULL);
+	// far less than the 3 x 64 MB of A, B and C, so that they have to be streamed
+	size_t budget = static_cast<size_t>(min(min(maxalloc, global / 2), static_cast<cl_ulong>(48) << 20));
+	double ms = gemm_ooc(A, B, C, budget);
+	fprintf(stderr, "gemm_ooc: %.1f GFLOPS\n", 2e-6 * M * N * Q / ms);
+
+	// check some entries
+	cv::RNG rng;
+	double dif = 0;
+	for (int i = 0; i < 1000; ++i)
+	{
+		int const h = rng.uniform(0, M), w = rng.uniform(0, Q);
+		double val = 0;
+		for (int k = 0; k < N; ++k)
+			val += A.at<float>(h, k) * B.at<float>(k, w);
+		dif = max(dif, fabs(val - C.at<float>(h, w)) / max(fabs(val), 1.0));
+	}
+	fprintf(stderr, "max relative difference = %g\n", dif);
+	fflush(stderr);
+}
+
+// C = A + beta * B
+void OCL::matadd(cl_command_queue q, cl_kernel K, int M, int Q, View A, View B, float beta, View C)
+{
+	cl_int err;
+	Vec4z szlocal(TS, TS), sztotal(Q, M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(Q), &Q));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(A.m), &A.m));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(A.off), &A.off));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(A.ld), &A.ld));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(B.m), &B.m));
+	CheckCLError(err = clSetKernelArg(K, 6, sizeof(B.off), &B.off));
+	CheckCLError(err = clSetKernelArg(K, 7, sizeof(B.ld), &B.ld));
+	CheckCLError(err = clSetKernelArg(K, 8, sizeof(beta), &beta));
+	CheckCLError(err = clSetKernelArg(K, 9, sizeof(C.m), &C.m));
+	CheckCLError(err = clSetKernelArg(K, 10, sizeof(C.off), &C.off));
+	CheckCLError(err = clSetKernelArg(K, 11, sizeof(C.ld), &C.ld));
+	CheckCLError(err = clEnqueueNDRangeKernel(q, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, NULL));
+}
+
+// C = A * B
+void OCL::matmul_view(cl_command_queue q, cl_kernel K, int M, int N, int Q, View A, View B, View C)
+{
+	cl_int err;
+	Vec4z szlocal(TS, TS), sztotal((Q + WS - 1) / WS, M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(Q), &Q));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(A.m), &A.m));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(A.off), &A.off));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(A.ld), &A.ld));
+	CheckCLError(err = clSetKernelArg(K, 6, sizeof(B.m), &B.m));
+	CheckCLError(err = clSetKernelArg(K, 7, sizeof(B.off), &B.off));
+	CheckCLError(err = clSetKernelArg(K, 8, sizeof(B.ld), &B.ld));
+	CheckCLError(err = clSetKernelArg(K, 9, sizeof(C.m), &C.m));
+	CheckCLError(err = clSetKernelArg(K, 10, sizeof(C.off), &C.off));
+	CheckCLError(err = clSetKernelArg(K, 11, sizeof(C.ld), &C.ld));
+	CheckCLError(err = clEnqueueNDRangeKernel(q, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, NULL));
+}
+
+// C = A * B for n x n views with Strassen-Winograd (7 products, 15 additions), recursing while n > cutoff.
+// K is {matmul_view, matadd}. The seven products of this level go round-robin to q[0 .. nq - 1],
+// lower levels stay on the queue of their product, the result is complete in order on q[0]
+void OCL::winograd(cl_command_queue* q, int nq, cl_kernel* K, int n, View A, View B, View C, int cutoff)
+{
+	if (n <= cutoff || n % 2)
+	{
+		matmul_view(q[0], K[0], n, n, n, A, B, C);
+		return;
+	}
+	cl_int err;
+	int const h = n / 2;
+	CheckCLError(cl_mem tmp = clCreateBuffer(context, CL_MEM_READ_WRITE, 15 * sizeof(float) * h * h, NULL, &err));
+	View T[15];
+	for (int i = 0; i < 15; ++i)
+	{
+		View v = {tmp, i * h * h, h};
+		T[i] = v;
+	}
+	View *S = T, *R = T + 4, *P = T + 8;
+	View A11 = A.at(0, 0), A12 = A.at(0, h), A21 = A.at(h, 0), A22 = A.at(h, h);
+	View B11 = B.at(0, 0), B12 = B.at(0, h), B21 = B.at(h, 0), B22 = B.at(h, h);
+	matadd(q[0], K[1], h, h, A21, A22, 1, S[0]);
+	matadd(q[0], K[1], h, h, S[0], A11, -1, S[1]);
+	matadd(q[0], K[1], h, h, A11, A21, -1, S[2]);
+	matadd(q[0], K[1], h, h, A12, S[1], -1, S[3]);
+	matadd(q[0], K[1], h, h, B12, B11, -1, R[0]);
+	matadd(q[0], K[1], h, h, B22, R[0], -1, R[1]);
+	matadd(q[0], K[1], h, h, B22, B12, -1, R[2]);
+	matadd(q[0], K[1], h, h, R[1], B21, -1, R[3]);
+
+	View const X[7] = {A11, A12, S[3], A22, S[0], S[1], S[2]};
+	View const Y[7] = {B11, B21, B22, R[3], R[0], R[1], R[2]};
+	cl_event ready, done[8];
+	if (nq > 1)
+	{
+		CheckCLError(err = clEnqueueMarkerWithWaitList(q[0], 0, NULL, &ready));
+	}
+	for (int i = 1; i < nq; ++i)
+	{
+		CheckCLError(err = clEnqueueBarrierWithWaitList(q[i], 1, &ready, NULL));
+	}
+	for (int i = 0; i < 7; ++i)
+		winograd(q + i % nq, 1, K, h, X[i], Y[i], P[i], cutoff);
+	for (int i = 1; i < nq; ++i)
+	{
+		CheckCLError(err = clEnqueueMarkerWithWaitList(q[i], 0, NULL, &done[i]));
+		clFlush(q[i]);
+	}
+	if (nq > 1)
+	{
+		CheckCLError(err = clEnqueueBarrierWithWaitList(q[0], nq - 1, done + 1, NULL));
+		CheckCLError(err = clReleaseEvent(ready));
+		for (int i = 1; i < nq; ++i)
+		{
+			CheckCLError(err = clReleaseEvent(done[i]));
+		}
+	}
+
+	matadd(q[0], K[1], h, h, P[0], P[1], 1, C.at(0, 0));
+	matadd(q[0], K[1], h, h, P[0], P[5], 1, P[5]);
+	matadd(q[0], K[1], h, h, P[5], P[6], 1, P[6]);
+	matadd(q[0], K[1], h, h, P[5], P[4], 1, P[5]);
+	matadd(q[0], K[1], h, h, P[5], P[2], 1, C.at(0, h));
+	matadd(q[0], K[1], h, h, P[6], P[3], -1, C.at(h, 0));
+	matadd(q[0], K[1], h, h, P[6], P[4], 1, C.at(h, h));
+	// freed by the runtime after the queued commands are done
+	CheckCLError(err = clReleaseMemObject(tmp));
+}
+
+// C = A * B for n x n buffers, returns the wall time in ms.
+// n is zero padded so that it can be halved until it is no more than cutoff
+double OCL::gemm_strassen(int n, cl_mem A, cl_mem B, cl_mem C, int cutoff)
+{
+	cl_int err;
+	int d = 0;
+	while (((n + (1 << d) - 1) >> d) > cutoff)
+		++d;
+	int const m = ((n + (1 << d) - 1) >> d) << d;
+	cl_command_queue q[4];
+	cl_kernel K[2];
+	cl_mem pad[3] = {A, B, C};
+	q[0] = cqueue;
+	for (size_t i = 1; i < _countof(q); ++i)
+	{
+		CheckCLError(q[i] = clCreateCommandQueue(context, device, 0, &err));
+	}
+	CheckCLError(K[0] = clCreateKernel(program, "matmul_view", &err));
+	CheckCLError(K[1] = clCreateKernel(program, "matadd", &err));
+	size_t org[3] = {0, 0, 0}, reg[3] = {n * sizeof(float), static_cast<size_t>(n), 1};
+	float const zero = 0;
+	int64_t t = cv::getTickCount();
+	if (m != n)
+		for (int i = 0; i < 3; ++i)
+		{
+			CheckCLError(pad[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * m * m, NULL, &err));
+			CheckCLError(err = clEnqueueFillBuffer(cqueue, pad[i], &zero, sizeof(zero), 0, sizeof(float) * m * m, 0, NULL, NULL));
+			if (i < 2)
+			{
+				CheckCLError(err = clEnqueueCopyBufferRect(cqueue, i ? B : A, pad[i], org, org, reg,
+					n * sizeof(float), 0, m * sizeof(float), 0, 0, NULL, NULL));
+			}
+		}
+	View a = {pad[0], 0, m}, b = {pad[1], 0, m}, c = {pad[2], 0, m};
+	winograd(q, _countof(q), K, m, a, b, c, cutoff);
+	if (m != n)
+	{
+		CheckCLError(err = clEnqueueCopyBufferRect(cqueue, pad[2], C, org, org, reg,
+			m * sizeof(float), 0, n * sizeof(float), 0, 0, NULL, NULL));
+	}
+	clFinish(cqueue);
+	double ms = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+	for (int i = 0; i < 3 && m != n; ++i)
+	{
+		CheckCLError(err = clReleaseMemObject(pad[i]));
+	}
+	CheckCLError(err = clReleaseKernel(K[0]));
+	CheckCLError(err = clReleaseKernel(K[1]));
+	for (size_t i = 1; i < _countof(q); ++i)
+	{
+		CheckCLError(err = clReleaseCommandQueue(q[i]));
+	}
+	return ms;
+}
+
+// the cutoff for gemm_strassen: half of the smallest power of two size, up to n,
+// for which one level of recursion is faster than matmul_view alone
+int OCL::tune_strassen(int n)
+{
+	cl_int err;
+	for (int s = 256; s <= n; s *= 2)
+	{
+		Mat A(s, s, CV_32F);
+		randu(A, -8.0, nextafter(8.0, 9.0));
+		size_t const sz = A.total() * A.elemSize();
+		CheckCLError(cl_mem a = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, sz, A.data, &err));
+		CheckCLError(cl_mem c = clCreateBuffer(context, CL_MEM_READ_WRITE, sz, NULL, &err));
+		// the first call of each warms up
+		gemm_strassen(s, a, a, c, s);
+		double direct = gemm_strassen(s, a, a, c, s);
+		gemm_strassen(s, a, a, c, s / 2);
+		double level = gemm_strassen(s, a, a, c, s / 2);
+		fprintf(stderr, "tune_strassen: %d, matmul_view %.2fms, one level %.2fms\n", s, direct, level);
+		CheckCLError(err = clReleaseMemObject(a));
+		CheckCLError(err = clReleaseMemObject(c));
+		if (level < direct)
+			return s / 2;
+	}
+	return n;
+}
+
+void OCL::strassen()
+{
+	cl_int err;
+	int const n = 4096;
+	Mat A(n, n, CV_32F), B(n, n, CV_32F), C(n, n, CV_32F), D(n, n, CV_32F);
+	size_t const sz = A.total() * A.elemSize();
+	randu(A, -8.0, nextafter(8.0, 9.0));
+	randu(B, -8.0, nextafter(8.0, 9.0));
+	CheckCLError(cl_mem a = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, sz, A.data, &err));
+	CheckCLError(cl_mem b = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, sz, B.data, &err));
+	CheckCLError(cl_mem c = clCreateBuffer(context, CL_MEM_READ_WRITE, sz, NULL, &err));
+	int const cutoff = tune_strassen(n);
+	double ms = gemm_strassen(n, a, b, c, n);
+	CheckCLError(clEnqueueReadBuffer(cqueue, c, CL_TRUE, 0, sz, D.data, 0, NULL, NULL));
+	fprintf(stderr, "classical: %.2fms, %.1f GFLOPS\n", ms, 2e-6 * n * n * n / ms);
+	ms = gemm_strassen(n, a, b, c, cutoff);
+	CheckCLError(clEnqueueReadBuffer(cqueue, c, CL_TRUE, 0, sz, C.data, 0, NULL, NULL));
+	fprintf(stderr, "strassen, cutoff %d: %.2fms, %.1f effective GFLOPS\n", cutoff, ms, 2e-6 * n * n * n / ms);
+
+	// error of both against double precision on some entries
+	cv::RNG rng;
+	double ec = 0, es = 0;
+	for (int i = 0; i < 1000; ++i)
+	{
+		int const h = rng.uniform(0, n), w = rng.uniform(0, n);
+		double val = 0, nrm = 0;
+		for (int k = 0; k < n; ++k)
+		{
+			val += static_cast<double>(A.at<float>(h, k)) * B.at<float>(k, w);
+			nrm += fabs(A.at<float>(h, k) * B.at<float>(k, w));
+		}
+		ec = max(ec, fabs(D.at<float>(h, w) - val) / nrm);
+		es = max(es, fabs(C.at<float>(h, w) - val) / nrm);
+	}
+	fprintf(stderr, "max error / sum |a * b|: classical %g, strassen %g, growth %.2fx\n", ec, es, es / max(ec, 1e-30));
+	fflush(stderr);
+	CheckCLError(err = clReleaseMemObject(a));
+	CheckCLError(err = clReleaseMemObject(b));
+	CheckCLError(err = clReleaseMemObject(c));
+}
+
+// C = alpha * op(A) * op(B) + beta * C with BLAS naming, row-major,
+// op(A) is M x K, op(B) is K x N, offsets (oa, ob, oc) and leading dimensions are in elements
+cl_event OCL::sgemm(bool ta, bool tb, int M, int N, int K, float alpha, cl_mem A, int oa, int lda,
+	cl_mem B, int ob, int ldb, float beta, cl_mem C, int oc, int ldc)
+{
+	// the square tiles of sgemm_tile are mostly idle when N is small
+	if (N <= NS)
+		return skinny(ta, tb, M, N, K, alpha, A, oa, lda, B, ob, ldb, beta, C, oc, ldc);
+	return sgemm_tile(ta, tb, M, N, K, alpha, A, oa, lda, B, ob, ldb, beta, C, oc, ldc);
+}
+
+cl_event OCL::sgemm_tile(bool ta, bool tb, int M, int N, int K, float alpha, cl_mem A, int oa, int lda,
+	cl_mem B, int ob, int ldb, float beta, cl_mem C, int oc, int ldc)
+{
+	cl_int err;
+	cl_event e;
+	char const* name[] = {"sgemm_nn", "sgemm_nt", "sgemm_tn", "sgemm_tt"};
+	Vec4z szlocal(TS, TS), sztotal((N + WS - 1) / WS, M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel Ker = clCreateKernel(program, name[ta * 2 + tb], &err));
+	CheckCLError(err = clSetKernelArg(Ker, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(Ker, 1, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(Ker, 2, sizeof(K), &K));
+	CheckCLError(err = clSetKernelArg(Ker, 3, sizeof(alpha), &alpha));
+	CheckCLError(err = clSetKernelArg(Ker, 4, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(Ker, 5, sizeof(oa), &oa));
+	CheckCLError(err = clSetKernelArg(Ker, 6, sizeof(lda), &lda));
+	CheckCLError(err = clSetKernelArg(Ker, 7, sizeof(B), &B));
+	CheckCLError(err = clSetKernelArg(Ker, 8, sizeof(ob), &ob));
+	CheckCLError(err = clSetKernelArg(Ker, 9, sizeof(ldb), &ldb));
+	CheckCLError(err = clSetKernelArg(Ker, 10, sizeof(beta), &beta));
+	CheckCLError(err = clSetKernelArg(Ker, 11, sizeof(C), &C));
+	CheckCLError(err = clSetKernelArg(Ker, 12, sizeof(oc), &oc));
+	CheckCLError(err = clSetKernelArg(Ker, 13, sizeof(ldc), &ldc));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, Ker, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(Ker));
+	return e;
+}
+
+void OCL::blas()
+{
+	cl_int err;
+	// operands are views into larger matrices, no copies are made
+	int const M = 1000, N = 900, K = 700, S = 1200;
+	float const alpha = 1.5f, beta = -0.5f;
+	Mat X(S, S, CV_32F), Y(S, S, CV_32F), Z(S, S, CV_32F), R;
+	size_t const sz = X.total() * X.elemSize();
+	randu(X, -8.0, nextafter(8.0, 9.0));
+	randu(Y, -8.0, nextafter(8.0, 9.0));
+	randu(Z, -8.0, nextafter(8.0, 9.0));
+	CheckCLError(cl_mem x = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, sz, X.data, &err));
+	CheckCLError(cl_mem y = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, sz, Y.data, &err));
+	CheckCLError(cl_mem z = clCreateBuffer(context, CL_MEM_READ_WRITE, sz, NULL, &err));
+	for (int i = 0; i < 4; ++i)
+	{
+		bool const ta = (i & 2) != 0, tb = (i & 1) != 0;
+		int const ha = 3, wa = 5, hb = 7, wb = 11, hc = 13, wc = 17;
+		Mat A = X(cv::Rect(wa, ha, ta ? M : K, ta ? K : M));
+		Mat B = Y(cv::Rect(wb, hb, tb ? K : N, tb ? N : K));
+		Mat C = Z(cv::Rect(wc, hc, N, M)), D(S, S, CV_32F);
+		CheckCLError(err = clEnqueueWriteBuffer(cqueue, z, CL_TRUE, 0, sz, Z.data, 0, NULL, NULL));
+		cl_event e = sgemm(ta, tb, M, N, K, alpha, x, ha * S + wa, S, y, hb * S + wb, S, beta, z, hc * S + wc, S);
+		CheckCLError(clEnqueueReadBuffer(cqueue, z, CL_TRUE, 0, sz, D.data, 1, &e, NULL));
+		char name[16];
+		snprintf(name, sizeof(name), "sgemm_%c%c", ta ? 't' : 'n', tb ? 't' : 'n');
+		double ms = getCLTime(e, name);
+		CheckCLError(err = clReleaseEvent(e));
+		gemm(A, B, alpha, C, beta, R, (ta ? cv::GEMM_1_T : 0) + (tb ? cv::GEMM_2_T : 0));
+		Mat V = D(cv::Rect(wc, hc, N, M));
+		fprintf(stderr, "%s: %.1f GFLOPS, max relative difference = %g\n", name, 2e-6 * M * N * K / ms,
+			norm(V, R, cv::NORM_INF) / norm(R, cv::NORM_INF));
+		// everything outside of the view must be untouched
+		C.copyTo(V);
+		absdiff(D, Z, D);
+		fprintf(stderr, "%s: outside difference = %f\n", name, sum(D)[0]);
+		fflush(stderr);
+	}
+	CheckCLError(err = clReleaseMemObject(x));
+	CheckCLError(err = clReleaseMemObject(y));
+	CheckCLError(err = clReleaseMemObject(z));
+}
+
+// sgemm for N <= NS that reads A once, with gemv_n and gemv_t when N is 1
+cl_event OCL::skinny(bool ta, bool tb, int M, int N, int K, float alpha, cl_mem A, int oa, int lda,
+	cl_mem B, int ob, int ldb, float beta, cl_mem C, int oc, int ldc)
+{
+	cl_int err;
+	cl_event e;
+	int arg = 0;
+	int const sk = tb ? 1 : ldb, sw = tb ? ldb : 1;
+	char const* name[] = {"skinny_n", "skinny_t", "gemv_n", "gemv_t"};
+	// A: a row per GV lanes, A^T: a column per lane
+	Vec4z szlocal(GV, GR), sztotal(ta ? M : GV, ta ? GR : M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel Ker = clCreateKernel(program, name[(N == 1) * 2 + ta], &err));
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(M), &M));
+	if (N > 1)
+	{
+		CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(N), &N));
+	}
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(K), &K));
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(alpha), &alpha));
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(oa), &oa));
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(lda), &lda));
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(B), &B));
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(ob), &ob));
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(sk), &sk));
+	if (N > 1)
+	{
+		CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(sw), &sw));
+	}
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(beta), &beta));
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(C), &C));
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(oc), &oc));
+	CheckCLError(err = clSetKernelArg(Ker, arg++, sizeof(ldc), &ldc));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, Ker, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(Ker));
+	return e;
+}
+
+void OCL::tallskinny()
+{
+	cl_int err;
+	int const M = 8192, K = 8192, S = 8200;
+	float const alpha = 1.5f, beta = -0.5f;
+	int const width[] = {1, 2, 4, 8, 16};
+	Mat X(S, S, CV_32F), Y(S, NS * 2, CV_32F), Z(S, NS * 2, CV_32F), D(S, NS * 2, CV_32F), R;
+	randu(X, -1.0, 1.0);
+	randu(Y, -1.0, 1.0);
+	randu(Z, -1.0, 1.0);
+	CheckCLError(cl_mem x = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, X.total() * X.elemSize(), X.data, &err));
+	CheckCLError(cl_mem y = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, Y.total() * Y.elemSize(), Y.data, &err));
+	CheckCLError(cl_mem z = clCreateBuffer(context, CL_MEM_READ_WRITE, Z.total() * Z.elemSize(), NULL, &err));
+	// A is a view into X, B a view into Y or its transpose in X, C is Z(1 : M + 1, 1 : N + 1)
+	for (int i = 0; i < 4; ++i)
+		for (size_t n = 0; n < _countof(width); ++n)
+		{
+			bool const ta = (i & 2) != 0, tb = (i & 1) != 0;
+			int const N = width[n];
+			Mat A = X(cv::Rect(3, 5, ta ? M : K, ta ? K : M));
+			Mat B = tb ? X(cv::Rect(0, 0, K, N)) : Y(cv::Rect(2, 0, N, K));
+			Mat C = Z(cv::Rect(1, 1, N, M));
+			int const ob = tb ? 0 : 2, ldb = tb ? S : NS * 2;
+			CheckCLError(err = clEnqueueWriteBuffer(cqueue, z, CL_TRUE, 0, Z.total() * Z.elemSize(), Z.data, 0, NULL, NULL));
+			cl_event e = skinny(ta, tb, M, N, K, alpha, x, 5 * S + 3, S, tb ? x : y, ob, ldb, beta, z, NS * 2 + 1, NS * 2);
+			CheckCLError(err = clEnqueueReadBuffer(cqueue, z, CL_TRUE, 0, D.total() * D.elemSize(), D.data, 1, &e, NULL));
+			char name[16];
+			snprintf(name, sizeof(name), "%s N = %d", N == 1 ? (ta ? "gemv_t" : "gemv_n") : (ta ? "skinny_t" : "skinny_n"), N);
+			double ms = getCLTime(e, name);
+			CheckCLError(err = clReleaseEvent(e));
+			gemm(A, B, alpha, C, beta, R, (ta ? cv::GEMM_1_T : 0) + (tb ? cv::GEMM_2_T : 0));
+			double dif = norm(D(cv::Rect(1, 1, N, M)), R, cv::NORM_INF) / norm(R, cv::NORM_INF);
+			e = sgemm_tile(ta, tb, M, N, K, alpha, x, 5 * S + 3, S, tb ? x : y, ob, ldb, beta, z, NS * 2 + 1, NS * 2);
+			CheckCLError(err = clWaitForEvents(1, &e));
+			double tile = getCLTime(e, "sgemm_tile");
+			CheckCLError(err = clReleaseEvent(e));
+			// A dominates the traffic
+			fprintf(stderr, "%s%s: %.1f GB/s, sgemm_tile %.1f GB/s, max relative difference = %g\n",
+				name, tb ? " B^T" : "", 4e-6 * M * K / ms, 4e-6 * M * K / tile, dif);
+			fflush(stderr);
+		}
+	CheckCLError(err = clReleaseMemObject(x));
+	CheckCLError(err = clReleaseMemObject(y));
+	CheckCLError(err = clReleaseMemObject(z));
+}
+
+// a program whose sgemm_ep runs the steps in order before storing C, as half if set;
+// NULL for more than the 4 steps (EP0 .. EP3) sgemm_ep has
+cl_program OCL::build_ep(EpStep const* step, int nstep, bool half, bool ta, bool tb)
+{
+	char const* name[] = {"bias_row", "bias_col", "relu", "gelu", "residual"};
+	char defs[256];
+	if (nstep > 4)
+	{
+		fprintf(stderr, "sgemm_ep has at most 4 epilogue steps, got %d\n", nstep);
+		return NULL;
+	}
+	int n = snprintf(defs, sizeof(defs), "-DTA=%d -DTB=%d%s", ta, tb, half ? " -DOUT_HALF" : "");
+	for (int i = 0; i < nstep; ++i)
+		n += snprintf(defs + n, sizeof(defs) - n, " -DEP%d=%s", i, name[step[i]]);
+	return build(defs);
+}
+
+// sgemm of prog with its epilogue, bias and R are only read if a step needs them
+cl_event OCL::sgemm_ep(cl_program prog, int M, int N, int K, float alpha, cl_mem A, int oa, int lda,
+	cl_mem B, int ob, int ldb, float beta, cl_mem C, int oc, int ldc, cl_mem bias, cl_mem R, int ldr)
+{
+	cl_int err;
+	cl_event e;
+	Vec4z szlocal(TS, TS), sztotal((N + WS - 1) / WS, M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel Ker = clCreateKernel(prog, "sgemm_ep", &err));
+	CheckCLError(err = clSetKernelArg(Ker, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(Ker, 1, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(Ker, 2, sizeof(K), &K));
+	CheckCLError(err = clSetKernelArg(Ker, 3, sizeof(alpha), &alpha));
+	CheckCLError(err = clSetKernelArg(Ker, 4, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(Ker, 5, sizeof(oa), &oa));
+	CheckCLError(err = clSetKernelArg(Ker, 6, sizeof(lda), &lda));
+	CheckCLError(err = clSetKernelArg(Ker, 7, sizeof(B), &B));
+	CheckCLError(err = clSetKernelArg(Ker, 8, sizeof(ob), &ob));
+	CheckCLError(err = clSetKernelArg(Ker, 9, sizeof(ldb), &ldb));
+	CheckCLError(err = clSetKernelArg(Ker, 10, sizeof(beta), &beta));
+	CheckCLError(err = clSetKernelArg(Ker, 11, sizeof(C), &C));
+	CheckCLError(err = clSetKernelArg(Ker, 12, sizeof(oc), &oc));
+	CheckCLError(err = clSetKernelArg(Ker, 13, sizeof(ldc), &ldc));
+	CheckCLError(err = clSetKernelArg(Ker, 14, sizeof(bias), &bias));
+	CheckCLError(err = clSetKernelArg(Ker, 15, sizeof(R), &R));
+	CheckCLError(err = clSetKernelArg(Ker, 16, sizeof(ldr), &ldr));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, Ker, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(Ker));
+	return e;
+}
+
+void OCL::epilogue()
+{
+	cl_int err;
+	int const M = 2048, N = 2048, K = 1024;
+	EpStep const step[] = {BIAS_COL, GELU, RESIDUAL};
+	cl_program prog = build_ep(step, _countof(step), true, false, false);
+	if (!prog)
+		return;
+	Mat A(M, K, CV_32F), B(K, N, CV_32F), R(M, N, CV_32F), bias(1, N, CV_32F);
+	Mat C(M, N, CV_16U), D(M, N, CV_16U);
+	randu(A, -1.0, 1.0);
+	randu(B, -1.0, 1.0);
+	randu(R, -1.0, 1.0);
+	randu(bias, -1.0, 1.0);
+	CheckCLError(cl_mem a = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, A.total() * A.elemSize(), A.data, &err));
+	CheckCLError(cl_mem b = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, B.total() * B.elemSize(), B.data, &err));
+	CheckCLError(cl_mem r = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, R.total() * R.elemSize(), R.data, &err));
+	CheckCLError(cl_mem s = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, bias.total() * bias.elemSize(), bias.data, &err));
+	CheckCLError(cl_mem c = clCreateBuffer(context, CL_MEM_READ_WRITE, R.total() * R.elemSize(), NULL, &err));
+	CheckCLError(cl_mem h = clCreateBuffer(context, CL_MEM_READ_WRITE, C.total() * C.elemSize(), NULL, &err));
+
+	// separate passes: sgemm, bias, gelu, residual and conversion to half
+	vector<cl_event> ev;
+	ev.push_back(sgemm(false, false, M, N, K, 1, a, 0, K, b, 0, N, 0, c, 0, N));
+	CheckCLError(cl_kernel Ker = clCreateKernel(program, "ep_pass", &err));
+	Vec4z szlocal(TS, TS), sztotal(N, M);
+	makeDiv(sztotal, szlocal);
+	for (size_t i = 0; i < _countof(step); ++i)
+	{
+		int const st = step[i];
+		CheckCLError(err = clSetKernelArg(Ker, 0, sizeof(M), &M));
+		CheckCLError(err = clSetKernelArg(Ker, 1, sizeof(N), &N));
+		CheckCLError(err = clSetKernelArg(Ker, 2, sizeof(c), &c));
+		CheckCLError(err = clSetKernelArg(Ker, 3, sizeof(N), &N));
+		CheckCLError(err = clSetKernelArg(Ker, 4, sizeof(s), &s));
+		CheckCLError(err = clSetKernelArg(Ker, 5, sizeof(r), &r));
+		CheckCLError(err = clSetKernelArg(Ker, 6, sizeof(N), &N));
+		CheckCLError(err = clSetKernelArg(Ker, 7, sizeof(st), &st));
+		ev.push_back(NULL);
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, Ker, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &ev.back()));
+	}
+	CheckCLError(err = clReleaseKernel(Ker));
+	int const n = M * N;
+	CheckCLError(Ker = clCreateKernel(program, "to_half", &err));
+	CheckCLError(err = clSetKernelArg(Ker, 0, sizeof(n), &n));
+	CheckCLError(err = clSetKernelArg(Ker, 1, sizeof(c), &c));
+	CheckCLError(err = clSetKernelArg(Ker, 2, sizeof(h), &h));
+	szlocal = Vec4z(TS * TS), sztotal = Vec4z(n);
+	makeDiv(sztotal, szlocal);
+	ev.push_back(NULL);
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, Ker, 1, NULL, sztotal.val, szlocal.val, 0, NULL, &ev.back()));
+	CheckCLError(err = clReleaseKernel(Ker));
+	CheckCLError(clEnqueueReadBuffer(cqueue, h, CL_TRUE, 0, D.total() * D.elemSize(), D.data, 0, NULL, NULL));
+	double sep = 0;
+	for (size_t i = 0; i < ev.size(); ++i)
+	{
+		sep += getCLTime(ev[i], NULL);
+		CheckCLError(err = clReleaseEvent(ev[i]));
+	}
+
+	cl_event e = sgemm_ep(prog, M, N, K, 1, a, 0, K, b, 0, N, 0, h, 0, N, s, r, N);
+	CheckCLError(clEnqueueReadBuffer(cqueue, h, CL_TRUE, 0, C.total() * C.elemSize(), C.data, 1, &e, NULL));
+	double ms = getCLTime(e, "sgemm_ep");
+	CheckCLError(err = clReleaseEvent(e));
+	fprintf(stderr, "bias + gelu + residual + half: separate passes %.2fms, fused %.2fms\n", sep, ms);
+	// bits of the half results, which may differ by contraction into fma
+	double lo, hi;
+	Mat E;
+	C.convertTo(E, CV_32S);
+	D.convertTo(D, CV_32S);
+	absdiff(E, D, E);
+	minMaxLoc(E, &lo, &hi);
+	fprintf(stderr, "max difference = %g ulp\n", hi);
+	fflush(stderr);
+	CheckCLError(err = clReleaseProgram(prog));
+	CheckCLError(err = clReleaseMemObject(a));
+	CheckCLError(err = clReleaseMemObject(b));
+	CheckCLError(err = clReleaseMemObject(r));
+	CheckCLError(err = clReleaseMemObject(s));
+	CheckCLError(err = clReleaseMemObject(c));
+	CheckCLError(err = clReleaseMemObject(h));
+}
+
 int main(int argc, char** argv)
 {
 	if (argc > 1) TS = atoi(argv[1]);
 	if (argc > 2) WS = atoi(argv[2]);
+	if (argc > 3) WPTM = atoi(argv[3]);
+	if (argc > 4) WPTQ = atoi(argv[4]);
+	if (argc > 5) SM = atoi(argv[5]);
+	// matmul3 loads its K-slices as 4-vectors
+	if (TS < 4 || TS % 4)
+	{
+		fprintf(stderr, "TS = %d is not a multiple of 4\n", TS);
+		return 1;
+	}
 	OCL ocl;
 	ocl.init_ocl();
 	ocl.init_prog();
-	ocl.work();
+	ocl.work(false);
+	ocl.fp64();
+	ocl.batch();
+	ocl.lowp();
+	ocl.quant();
+	ocl.packed();
+	ocl.outofcore();
+	ocl.strassen();
+	ocl.blas();
+	ocl.tallskinny();
+	ocl.epilogue();
 	fputs("Game Over!\n", stderr);
 }
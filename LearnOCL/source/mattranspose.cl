@@ -57,3 +57,194 @@ __kernel void matt2(int const M, int const N, __global float const* A, __global
 			B[mad24(h + i, M, w)] = lbuf[lw][lh + i];
 	}
 }
+
+
+// in-place transpose of the N x N matrix at A + get_group_id(2) * N * N, the work-group of tile (gh, gw)
+// with gh < gw swaps it with tile (gw, gh) through lbuf, a diagonal tile is transposed by itself
+// and the groups below the diagonal have nothing to do
+__kernel void mattip_square(int const N, __global float* A)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const gw = get_group_id(0);
+	int const gh = get_group_id(1);
+	if (gh > gw)
+		return;
+	__local float lbuf[2][TS][TS + 1];
+	A += (size_t)get_group_id(2) * N * N;
+	// both tiles are read and written row by row
+	int h = gh * TS + lh;
+	int w = gw * TS + lw;
+	if (h < N && w < N)
+		lbuf[0][lh][lw] = A[(size_t)h * N + w];
+	h = gw * TS + lh;
+	w = gh * TS + lw;
+	if (gh != gw && h < N && w < N)
+		lbuf[1][lh][lw] = A[(size_t)h * N + w];
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	if (h < N && w < N)
+		A[(size_t)h * N + w] = lbuf[0][lw][lh];
+	h = gh * TS + lh;
+	w = gw * TS + lw;
+	if (gh != gw && h < N && w < N)
+		A[(size_t)h * N + w] = lbuf[1][lw][lh];
+}
+
+// in-place transpose of the R x C matrix of E-float elements at A + get_group_id(1) * stride by cycle following:
+// element p of the C x R result is element p * C % (R * C - 1) of the source, lead[] holds the smallest position
+// of every cycle of that permutation, one work-group per cycle, the work-items move the E floats of an element
+__kernel void mattip_cycle(int const R, int const C, int const E, int const stride,
+	__global int const* lead, __global float* A)
+{
+	ulong const n = (ulong)R * C - 1;
+	ulong const s = lead[get_group_id(0)];
+	A += (size_t)get_group_id(1) * stride;
+	for (int l = get_local_id(0); l < E; l += get_local_size(0))
+	{
+		float const t = A[s * E + l];
+		ulong p = s, q = s * C % n;
+		for (; q != s; p = q, q = q * C % n)
+			A[p * E + l] = A[q * E + l];
+		A[p * E + l] = t;
+	}
+}
+
+
+// offsets in X and Y of batch b of permute1 and permute2: b runs over 8 axes of bd elements,
+// the last one fastest, with strides bi in X and bo in Y, unused axes are 1
+inline void permute_batch(int b, int8 const bd, int8 const bi, int8 const bo, size_t* xo, size_t* yo)
+{
+	int const* d = (int const*)&bd;
+	int const* s = (int const*)&bi;
+	int const* t = (int const*)&bo;
+	*xo = *yo = 0;
+	for (int k = 7; k >= 0; --k)
+	{
+		int const i = b % d[k];
+		b /= d[k];
+		*xo += (size_t)i * s[k];
+		*yo += (size_t)i * t[k];
+	}
+}
+
+// permute that keeps the last axis: rows of W floats from X to Y
+__kernel void permute1(int const W, int8 const bd, int8 const bi, int8 const bo,
+	__global float const* X, __global float* Y)
+{
+	int const w = get_global_id(0);
+	if (w >= W)
+		return;
+	size_t xo, yo;
+	permute_batch(get_global_id(1), bd, bi, bo, &xo, &yo);
+	Y[yo + w] = X[xo + w];
+}
+
+// permute that moves the last axis: matt2 of the H x W slice at X + xo, element (h, w) at X[h * sh + w]
+// and at Y[w * dw + h] of the slice at Y + yo, one slice for every batch
+__kernel void permute2(int const H, int const W, int const sh, int const dw, int8 const bd, int8 const bi, int8 const bo,
+	__global float const* X, __global float* Y)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const pw = get_group_id(0) * TS * WS;
+	int const ph = get_group_id(1) * TS;
+	__local float lbuf[TS][TS * WS + 1];
+	size_t xo, yo;
+	permute_batch(get_global_id(2), bd, bi, bo, &xo, &yo);
+	X += xo, Y += yo;
+	int h = ph + lh;
+	int w = pw + lw;
+	for (int i = 0; i < TS * WS; i += TS)
+	{
+		if (h < H && w + i < W)
+			lbuf[lh][lw + i] = X[(size_t)h * sh + w + i];
+	}
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	h = pw + lh;
+	w = ph + lw;
+	for (int i = 0; i < TS * WS; i += TS)
+	{
+		if (h + i < W && w < H)
+			Y[(size_t)(h + i) * dw + w] = lbuf[lw][lh + i];
+	}
+}
+
+
+// transposes of any element: ELEM is uchar, ushort, uint or ulong by the element size (double is moved
+// as ulong), each work-item of mattv moves a VW x VW block with VW * sizeof(ELEM) >= 16 bytes per access
+#ifdef ELEM
+#	define CAT_(a, b) a##b
+#	define CAT(a, b) CAT_(a, b)
+#	define VLOAD CAT(vload, VW)
+#	define VSTORE CAT(vstore, VW)
+
+// matt1 with ELEM
+__kernel void mattg(int const M, int const N, __global ELEM const* A, __global ELEM* B)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const pw = get_group_id(0) * TS;
+	int const ph = get_group_id(1) * TS;
+	__local ELEM lbuf[TS][TS + 1];
+	int h = ph + lh;
+	int w = pw + lw;
+	if (h < M && w < N)
+		lbuf[lh][lw] = A[(size_t)h * N + w];
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	h = pw + lh;
+	w = ph + lw;
+	if (h < N && w < M)
+		B[(size_t)h * M + w] = lbuf[lw][lh];
+}
+
+// the VW x VW block at (h, w) = (get_global_id(1), get_global_id(0)) * VW goes through registers,
+// VW vector loads of its rows and VW vector stores of its columns, VW divides M and N
+__kernel void mattv(int const M, int const N, __global ELEM const* A, __global ELEM* B)
+{
+	int const w = get_global_id(0) * VW;
+	int const h = get_global_id(1) * VW;
+	if (h >= M || w >= N)
+		return;
+	ELEM a[VW][VW], b[VW];
+	for (int i = 0; i < VW; ++i)
+		VSTORE(VLOAD(0, A + (size_t)(h + i) * N + w), 0, a[i]);
+	for (int j = 0; j < VW; ++j)
+	{
+		for (int i = 0; i < VW; ++i)
+			b[i] = a[i][j];
+		VSTORE(VLOAD(0, b), 0, B + (size_t)(w + j) * M + h);
+	}
+}
+#endif
+
+
+// pack B (N x Q, or Q x N if trans) into panels for matmul_packed in matmul.cl:
+// panel p holds columns [p * TS * WS, (p + 1) * TS * WS) of B, as (N + TS - 1) / TS
+// tiles of TS x TS * WS stored one after another, row by row and zero padded
+__kernel void matpack(int const N, int const Q, int const trans, __global float const* B, __global float* P)
+{
+	int const lw = get_local_id(0);
+	int const lh = get_local_id(1);
+	int const pw = get_group_id(0) * TS * WS;
+	int const ph = get_group_id(1) * TS;
+	int const nk = (N + TS - 1) / TS;
+	__local float lbuf[TS][TS * WS + 1];
+	for (int i = 0; i < TS * WS; i += TS)
+	{
+		int h = ph + lh;
+		int w = pw + lw + i;
+		if (trans)
+		{
+			// same as matt2, TS * WS rows of Bt to TS * WS columns of the tile
+			h = pw + lh + i;
+			w = ph + lw;
+			lbuf[lw][lh + i] = (h < Q && w < N) ? B[mad24(h, N, w)] : 0;
+		}
+		else
+			lbuf[lh][lw + i] = (h < N && w < Q) ? B[mad24(h, Q, w)] : 0;
+	}
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	P += (get_group_id(0) * nk + get_group_id(1)) * TS * TS * WS;
+	for (int i = 0; i < TS * WS; i += TS)
+		P[mad24(lh, TS * WS, lw + i)] = lbuf[lh][lw + i];
+}
@@ -1,4 +1,5 @@
 ﻿#define _CRT_SECURE_NO_WARNINGS
+#include <cctype>
 #include <cmath>
 #include "base.hpp"
 
@@ -20,8 +21,17 @@ public:
 	~OCL();
 
 	void init_ocl();
+	cl_program build(char const* defs);
 	void init_prog();
+	double matt(int i, cl_mem a, cl_mem b, cl_int M, cl_int N);
+	double square(cl_mem a, cl_int N, int batch);
+	double cycle(cl_mem a, cl_int R, cl_int C, cl_int E, cl_int stride, int count);
+	double mattip(cl_mem a, cl_int M, cl_int N);
+	double permute(cl_mem x, cl_mem y, int rank, int const* dims, int const* perm);
 	void work();
+	void inplace();
+	void tensors();
+	void elemsize();
 };
 
 OCL::OCL()
@@ -114,7 +124,8 @@ void OCL::init_ocl()
 	CheckCLError(cqueue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
 }
 
-void OCL::init_prog()
+// build mattranspose.cl with TS, WS and the extra defines, NULL on error
+cl_program OCL::build(char const* defs)
 {
 	cl_int err;
 	char info[4096];
@@ -122,29 +133,263 @@ void OCL::init_prog()
 	K = K.substr(0, K.size() - 4) + ".cl";
 	K = loadCLFile(K.data());
 	char const* KS[] = {K.data()};
-	snprintf(info, sizeof(info), "-cl-std=CL2.0 -cl-kernel-arg-info -Werror -DTS=%d -DWS=%d", TS, WS);
-	CheckCLError(program = clCreateProgramWithSource(context, 1, KS, 0, &err));
-	err = clBuildProgram(program, 1, &device, info, NULL, NULL);
-	clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
+	snprintf(info, sizeof(info), "-cl-std=CL2.0 -cl-kernel-arg-info -Werror -DTS=%d -DWS=%d%s", TS, WS, defs);
+	CheckCLError(cl_program P = clCreateProgramWithSource(context, 1, KS, 0, &err));
+	err = clBuildProgram(P, 1, &device, info, NULL, NULL);
+	clGetProgramBuildInfo(P, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
 	if (err)
 	{
 		fprintf(stderr, "%s (%d), error:\n%s", clErrorString(err), err, info);
-		return;
+		clReleaseProgram(P);
+		return NULL;
 	}
-	fprintf(stderr, "build program end with code %d, log:\n%s", err, info);
+	fprintf(stderr, "build program%s end with code %d, log:\n%s", defs, err, info);
+	return P;
+}
+
+void OCL::init_prog()
+{
+	cl_int err;
+	char info[4096];
+	program = build("");
+	if (!program)
+		return;
 	CheckCLError(err = clGetProgramInfo(program, CL_PROGRAM_KERNEL_NAMES, sizeof(info), info, NULL));
 	fprintf(stderr, "kernel names: %s\n", info);
-	nkernel = info[0] != 0;
-	for (size_t i = 1; i < _countof(info) && info[i]; ++i)
-		nkernel += info[i] == ';';
+	// only matt0, matt1, ... take part in work()
+	for (char const* p = strstr(info, "matt"); p; p = strstr(p + 4, "matt"))
+		nkernel += (p == info || p[-1] == ';') && isdigit(p[4]);
 }
 
-void OCL::work()
+// smallest positions of the cycles (longer than 1) of p -> p * C % (R * C - 1), see mattip_cycle
+static void cycles(int R, int C, vector<cl_int>& lead)
+{
+	size_t const n = static_cast<size_t>(R) * C - 1;
+	vector<bool> seen(n, false);
+	lead.clear();
+	for (size_t s = 1; s < n; ++s)
+	{
+		if (seen[s])
+			continue;
+		seen[s] = true;
+		size_t p = s * C % n;
+		if (p == s)
+			continue;
+		lead.push_back(static_cast<cl_int>(s));
+		for (; p != s; p = p * C % n)
+			seen[p] = true;
+	}
+}
+
+// Y = X permuted on the host, see OCL::permute
+static void permute(float const* X, float* Y, int rank, int const* dims, int const* perm)
+{
+	int sx[8], idx[8] = {0};
+	size_t total = 1;
+	for (int a = rank - 1; a >= 0; total *= dims[a--])
+		sx[a] = static_cast<int>(total);
+	for (size_t o = 0; o < total; ++o)
+	{
+		size_t i = 0;
+		for (int k = 0; k < rank; ++k)
+			i += static_cast<size_t>(idx[k]) * sx[perm[k]];
+		Y[o] = X[i];
+		for (int k = rank - 1; k >= 0 && ++idx[k] == dims[perm[k]]; --k)
+			idx[k] = 0;
+	}
+}
+
+// out-of-place matt<i> of the M x N matrix in a to b, returns the kernel time in ms
+double OCL::matt(int i, cl_mem a, cl_mem b, cl_int M, cl_int N)
 {
 	cl_int err;
 	cl_event e;
+	char KS[32];
+	Vec4z szlocal(TS, TS), sztotal(i < 2 ? N : (N + WS - 1) / WS, M);
+	snprintf(KS, sizeof(KS), "matt%d", i);
+	CheckCLError(cl_kernel K = clCreateKernel(program, KS, &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(M), &N));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(a), &a));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(b), &b));
+	makeDiv(sztotal, szlocal);
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clWaitForEvents(1, &e));
+	double const ms = getCLTime(e, KS);
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clReleaseEvent(e));
+	return ms;
+}
+
+// in-place transpose of batch N x N matrices one after another in a
+double OCL::square(cl_mem a, cl_int N, int batch)
+{
+	cl_int err;
+	cl_event e;
+	char KS[64];
+	Vec4z szlocal(TS, TS, 1), sztotal(N, N, batch);
+	snprintf(KS, sizeof(KS), "mattip_square %d x %d x %d", batch, N, N);
+	CheckCLError(cl_kernel K = clCreateKernel(program, "mattip_square", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(a), &a));
+	makeDiv(sztotal, szlocal);
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 3, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clWaitForEvents(1, &e));
+	double const ms = getCLTime(e, KS);
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clReleaseEvent(e));
+	return ms;
+}
+
+// in-place transpose of count R x C matrices of E-float elements, stride floats apart in a
+double OCL::cycle(cl_mem a, cl_int R, cl_int C, cl_int E, cl_int stride, int count)
+{
+	cl_int err;
+	cl_event e;
+	char KS[64];
+	vector<cl_int> lead;
+	cycles(R, C, lead);
+	if (lead.empty())
+		return 0;
+	Vec4z szlocal(min(E, 256), 1), sztotal(lead.size() * min(E, 256), count);
+	snprintf(KS, sizeof(KS), "mattip_cycle %d x %d x %d (%d)", R, C, E, static_cast<int>(lead.size()));
+	CheckCLError(cl_mem l = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, lead.size() * sizeof(cl_int), lead.data(), &err));
+	CheckCLError(cl_kernel K = clCreateKernel(program, "mattip_cycle", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(R), &R));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(C), &C));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(E), &E));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(stride), &stride));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(l), &l));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(a), &a));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clWaitForEvents(1, &e));
+	double const ms = getCLTime(e, KS);
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clReleaseEvent(e));
+	CheckCLError(err = clReleaseMemObject(l));
+	return ms;
+}
+
+// in-place transpose of the M x N matrix in a to N x M, returns the kernel time in ms.
+// a long cycle over single floats is slow and serial, so when TS divides M and N the matrix is
+// seen as [m][TS][n][TS] with m = M / TS, n = N / TS and reaches [n][TS][m][TS] in four passes:
+// TS x n transposes of TS-float rows, m x n of whole tiles, each tile by itself, m x TS of rows
+double OCL::mattip(cl_mem a, cl_int M, cl_int N)
+{
+	if (M == N)
+		return square(a, N, 1);
+	if (M % TS || N % TS)
+		return cycle(a, M, N, 1, 0, 1);
+	cl_int const m = M / TS, n = N / TS;
+	double ms = cycle(a, TS, n, TS, TS * N, m);
+	ms += cycle(a, m, n, TS * TS, 0, 1);
+	ms += square(a, TS, m * n);
+	ms += cycle(a, m, TS, TS, TS * M, n);
+	return ms;
+}
+
+// Y = X permuted: axis i of Y is axis perm[i] of X, rank <= 8, returns the kernel time in ms.
+// axes of 1 are dropped and axes next to each other in both X and Y are merged, then the last axis
+// of X either stays last (permute1) or is transposed with the axis that becomes the last of Y
+// (permute2), the others make up the batch
+double OCL::permute(cl_mem x, cl_mem y, int rank, int const* dims, int const* perm)
+{
+	cl_int err;
+	cl_event e;
+	int kd[8], first[8], size[8], p[8], d[8], sx[8], sy[8], n = 0, r = 0;
+	size_t total = 1;
+	for (int a = 0; a < rank; ++a)
+	{
+		if (dims[a] > 1)
+			kd[n++] = dims[a];
+		total *= dims[a];
+	}
+	// runs of axes consecutive in X in the order of Y, first[j] is the first (kept) axis of run j
+	for (int i = 0, last = -2; i < rank; ++i)
+	{
+		if (dims[perm[i]] == 1)
+			continue;
+		int a = 0;
+		for (int k = 0; k < perm[i]; ++k)
+			a += dims[k] > 1;
+		if (a != last + 1)
+			first[r] = a, size[r++] = 1;
+		size[r - 1] *= kd[a];
+		last = a;
+	}
+	// run j is axis p[j] of the merged X
+	for (int j = 0; j < r; ++j)
+	{
+		p[j] = 0;
+		for (int k = 0; k < r; ++k)
+			p[j] += first[k] < first[j];
+	}
+	for (int j = 0; j < r; ++j)
+		d[p[j]] = size[j];
+	for (int a = r - 1, s = 1; a >= 0; s *= d[a--])
+		sx[a] = s;
+	for (int j = r - 1, s = 1; j >= 0; s *= size[j--])
+		sy[j] = s;
+	if (r <= 1)
+	{
+		CheckCLError(err = clEnqueueCopyBuffer(cqueue, x, y, 0, 0, total * sizeof(float), 0, NULL, &e));
+		CheckCLError(err = clWaitForEvents(1, &e));
+		double const ms = getCLTime(e, "permute copy");
+		CheckCLError(err = clReleaseEvent(e));
+		return ms;
+	}
+
+	int const L = r - 1, P = p[r - 1];
+	int batch = 1, dw = 0;
+	cl_int8 bd, bi, bo;
+	for (int k = 0; k < 8; ++k)
+		bd.s[k] = 1, bi.s[k] = bo.s[k] = 0;
+	for (int j = r - 1, k = 7; j >= 0; --j)
+	{
+		if (p[j] == L)
+			dw = sy[j];
+		if (p[j] == L || p[j] == P)
+			continue;
+		bd.s[k] = d[p[j]], bi.s[k] = sx[p[j]], bo.s[k] = sy[j];
+		batch *= bd.s[k--];
+	}
+	cl_int const H = d[P], W = d[L], sh = sx[P];
+	cl_kernel K;
+	Vec4z szlocal, sztotal;
+	if (P == L)
+	{
+		CheckCLError(K = clCreateKernel(program, "permute1", &err));
+		CheckCLError(err = clSetKernelArg(K, 0, sizeof(W), &W));
+		szlocal = Vec4z(TS * WS, 1), sztotal = Vec4z(W, batch);
+	}
+	else
+	{
+		CheckCLError(K = clCreateKernel(program, "permute2", &err));
+		CheckCLError(err = clSetKernelArg(K, 0, sizeof(H), &H));
+		CheckCLError(err = clSetKernelArg(K, 1, sizeof(W), &W));
+		CheckCLError(err = clSetKernelArg(K, 2, sizeof(sh), &sh));
+		CheckCLError(err = clSetKernelArg(K, 3, sizeof(dw), &dw));
+		szlocal = Vec4z(TS, TS, 1), sztotal = Vec4z((W + WS - 1) / WS, H, batch);
+	}
+	cl_uint const i = P == L ? 1 : 4;
+	CheckCLError(err = clSetKernelArg(K, i + 0, sizeof(bd), &bd));
+	CheckCLError(err = clSetKernelArg(K, i + 1, sizeof(bi), &bi));
+	CheckCLError(err = clSetKernelArg(K, i + 2, sizeof(bo), &bo));
+	CheckCLError(err = clSetKernelArg(K, i + 3, sizeof(x), &x));
+	CheckCLError(err = clSetKernelArg(K, i + 4, sizeof(y), &y));
+	makeDiv(sztotal, szlocal);
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, P == L ? 2 : 3, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clWaitForEvents(1, &e));
+	double const ms = getCLTime(e, P == L ? "permute1" : "permute2");
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clReleaseEvent(e));
+	return ms;
+}
+
+void OCL::work()
+{
+	cl_int err;
 	cl_int const M = 10240, N = 5120;
-	Vec4z szlocal(TS, TS), sztotal(N, M);
 	Mat A(M, N, CV_32F), B(N, M, CV_32F), C(N, M, CV_32F);
 	size_t srcsize = A.total() * A.elemSize();
 	size_t dstsize = B.total() * B.elemSize();
@@ -160,26 +405,146 @@ void OCL::work()
 		CheckCLError(err = clEnqueueFillBuffer(cqueue, b, A.data, sizeof(float), 0, dstsize, 0, NULL, NULL));
 		clFlush(cqueue), clFinish(cqueue);
 		snprintf(KS, sizeof(KS), "matt%d", i);
-		CheckCLError(cl_kernel K = clCreateKernel(program, KS, &err));
-		CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
-		CheckCLError(err = clSetKernelArg(K, 1, sizeof(M), &N));
-		CheckCLError(err = clSetKernelArg(K, 2, sizeof(a), &a));
-		CheckCLError(err = clSetKernelArg(K, 3, sizeof(b), &b));
-		sztotal[0] = i < 2 ? N : (N + WS - 1) / WS;
-		makeDiv(sztotal, szlocal);
-		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
-		CheckCLError(clEnqueueReadBuffer(cqueue, b, CL_TRUE, 0, dstsize, B.data, 1, &e, NULL));
-		clFlush(cqueue), clFinish(cqueue);
-		CheckCLError(err = clWaitForEvents(1, &e));
-		getCLTime(e, KS);
-		CheckCLError(err = clReleaseKernel(K));
+		matt(i, a, b, M, N);
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, b, CL_TRUE, 0, dstsize, B.data, 0, NULL, NULL));
 		absdiff(B, C, B);
 		double dif = sum(B)[0];
 		fprintf(stderr, "%s: difference = %f\n", KS, dif);
 	}
 	CheckCLError(err = clReleaseMemObject(a));
 	CheckCLError(err = clReleaseMemObject(b));
-	CheckCLError(err = clReleaseEvent(e));
+}
+
+// in-place transposes against matt<nkernel - 1> out of place, on an N x N, the M x N of work() and a shape
+// TS does not divide, the in-place ones need one matrix of device memory instead of two
+void OCL::inplace()
+{
+	cl_int err;
+	cl_int const shape[][2] = {{5120, 5120}, {10240, 5120}, {1000, 3000}};
+	for (auto const& s : shape)
+	{
+		cl_int const M = s[0], N = s[1];
+		Mat A(M, N, CV_32F), B(N, M, CV_32F), C(N, M, CV_32F);
+		size_t const size = A.total() * A.elemSize();
+		randu(A, -8.0, nextafter(8.0, 9.0));
+		transpose(A, C);
+		fprintf(stderr, "\n%d x %d: out of place %.0f MB, in place %.0f MB\n", M, N, size * 2 / 1048576.0, size / 1048576.0);
+		CheckCLError(cl_mem a = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_WRITE, size, A.data, &err));
+		CheckCLError(cl_mem b = clCreateBuffer(context, CL_MEM_WRITE_ONLY, size, NULL, &err));
+		double ms = matt(nkernel - 1, a, b, M, N);
+		fprintf(stderr, "out of place: %.2f GB/s\n", size * 2 / ms * 1e-6);
+		CheckCLError(err = clReleaseMemObject(b));
+		ms = mattip(a, M, N);
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, a, CL_TRUE, 0, size, B.data, 0, NULL, NULL));
+		absdiff(B, C, B);
+		fprintf(stderr, "in place: %.2fms, %.2f GB/s, difference = %f\n", ms, size * 2 / ms * 1e-6, sum(B)[0]);
+		CheckCLError(err = clReleaseMemObject(a));
+	}
+}
+
+// permutes between NCHW and NHWC and of a few other tensors, in GB/s against a copy of the same size
+void OCL::tensors()
+{
+	struct
+	{
+		int rank, dims[6], perm[6];
+	} const T[] = {
+		{4, {32, 64, 56, 56}, {0, 2, 3, 1}},
+		{4, {32, 56, 56, 64}, {0, 3, 1, 2}},
+		{4, {32, 3, 224, 224}, {0, 2, 3, 1}},
+		{4, {64, 32, 16, 128}, {2, 0, 1, 3}},
+		{2, {10240, 5120}, {1, 0}},
+		{5, {8, 16, 32, 24, 10}, {4, 3, 2, 1, 0}},
+		{6, {4, 8, 1, 16, 32, 64}, {5, 1, 2, 3, 0, 4}},
+	};
+	cl_int err;
+	cl_event e;
+	char info[128];
+	for (auto const& t : T)
+	{
+		size_t total = 1;
+		int len = 0;
+		for (int a = 0; a < t.rank; ++a)
+		{
+			total *= t.dims[a];
+			len += snprintf(info + len, sizeof(info) - len, "%s%d", a ? " x " : "", t.dims[a]);
+		}
+		len += snprintf(info + len, sizeof(info) - len, " by");
+		for (int a = 0; a < t.rank; ++a)
+			len += snprintf(info + len, sizeof(info) - len, " %d", t.perm[a]);
+		fprintf(stderr, "\n%s\n", info);
+		Mat X(1, static_cast<int>(total), CV_32F), Y(X.size(), CV_32F), Z(X.size(), CV_32F);
+		size_t const size = total * sizeof(float);
+		randu(X, -8.0, nextafter(8.0, 9.0));
+		::permute(X.ptr<float>(), Z.ptr<float>(), t.rank, t.dims, t.perm);
+		CheckCLError(cl_mem x = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, size, X.data, &err));
+		CheckCLError(cl_mem y = clCreateBuffer(context, CL_MEM_WRITE_ONLY, size, NULL, &err));
+		CheckCLError(err = clEnqueueCopyBuffer(cqueue, x, y, 0, 0, size, 0, NULL, &e));
+		CheckCLError(err = clWaitForEvents(1, &e));
+		double const copy = getCLTime(e, "copy");
+		CheckCLError(err = clReleaseEvent(e));
+		double const ms = permute(x, y, t.rank, t.dims, t.perm);
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, y, CL_TRUE, 0, size, Y.data, 0, NULL, NULL));
+		absdiff(Y, Z, Y);
+		fprintf(stderr, "permute %.2f GB/s, copy %.2f GB/s, difference = %f\n",
+			size * 2 / ms * 1e-6, size * 2 / copy * 1e-6, sum(Y)[0]);
+		CheckCLError(err = clReleaseMemObject(x));
+		CheckCLError(err = clReleaseMemObject(y));
+	}
+}
+
+// mattg and mattv for 1, 2, 4 and 8 byte elements, each from a program of its own built with
+// -DELEM and -DVW, VW * sizeof(ELEM) = 16 bytes but at least 4
+void OCL::elemsize()
+{
+	struct
+	{
+		char const* elem;
+		int type, vw;
+	} const T[] = {{"uchar", CV_8U, 16}, {"ushort", CV_16U, 8}, {"uint", CV_32S, 4}, {"ulong", CV_64F, 4}};
+	cl_int err;
+	cl_event e;
+	cl_int const M = 10240, N = 5120;
+	char info[128];
+	for (auto const& t : T)
+	{
+		snprintf(info, sizeof(info), " -DELEM=%s -DVW=%d", t.elem, t.vw);
+		cl_program P = build(info);
+		if (!P)
+			continue;
+		Mat A(M, N, t.type), B(N, M, t.type), C(N, M, t.type);
+		size_t const size = A.total() * A.elemSize();
+		randu(A, 0, 255);
+		transpose(A, C);
+		CheckCLError(cl_mem a = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY, size, A.data, &err));
+		CheckCLError(cl_mem b = clCreateBuffer(context, CL_MEM_WRITE_ONLY, size, NULL, &err));
+		for (int i = 0; i < 2; ++i)
+		{
+			// mattv has no tails
+			if (i == 1 && (M % t.vw || N % t.vw))
+				continue;
+			Vec4z szlocal(TS, TS), sztotal(N, M);
+			if (i == 1)
+				sztotal = Vec4z(N / t.vw, M / t.vw);
+			snprintf(info, sizeof(info), "%s %s", i ? "mattv" : "mattg", t.elem);
+			CheckCLError(err = clEnqueueFillBuffer(cqueue, b, A.data, 1, 0, size, 0, NULL, NULL));
+			CheckCLError(cl_kernel K = clCreateKernel(P, i ? "mattv" : "mattg", &err));
+			CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+			CheckCLError(err = clSetKernelArg(K, 1, sizeof(N), &N));
+			CheckCLError(err = clSetKernelArg(K, 2, sizeof(a), &a));
+			CheckCLError(err = clSetKernelArg(K, 3, sizeof(b), &b));
+			makeDiv(sztotal, szlocal);
+			CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+			CheckCLError(err = clEnqueueReadBuffer(cqueue, b, CL_TRUE, 0, size, B.data, 1, &e, NULL));
+			double const ms = getCLTime(e, info);
+			fprintf(stderr, "%s: %.2f GB/s, difference = %f\n", info, size * 2 / ms * 1e-6, norm(B, C, cv::NORM_INF));
+			CheckCLError(err = clReleaseKernel(K));
+			CheckCLError(err = clReleaseEvent(e));
+		}
+		CheckCLError(err = clReleaseMemObject(a));
+		CheckCLError(err = clReleaseMemObject(b));
+		CheckCLError(err = clReleaseProgram(P));
+	}
 }
 
 int main(int argc, char** argv)
@@ -190,5 +555,8 @@ int main(int argc, char** argv)
 	ocl.init_ocl();
 	ocl.init_prog();
 	ocl.work();
+	ocl.inplace();
+	ocl.tensors();
+	ocl.elemsize();
 	fputs("Game Over!\n", stderr);
 }
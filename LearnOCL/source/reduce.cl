@@ -21,4 +21,347 @@ __kernel void reduce(__global uchar const* src, int const len, __global uint* ds
 		dst[pi] = S[0];
 }
 
+// reduce with one work_group_reduce_add instead of the log2(WGS) barriers (OpenCL C 2.0)
+#ifdef WG_REDUCE
+__kernel void reduce_wg(__global uchar const* src, int const len, __global uint* dst)
+{
+	uint s = 0;
+	for (int i = get_global_id(0); i < len; i += get_global_size(0))
+		s += src[i];
+	s = work_group_reduce_add(s);
+	if (get_local_id(0) == 0)
+		dst[get_group_id(0)] = s;
+}
+#endif
+
+// reduce with sub_group_reduce_add: every sub-group puts its sum to S[],
+// then every sub-group adds them up (no early return, so sub-groups stay uniform), one barrier in all
+#ifdef SUB_GROUPS
+#ifdef cl_khr_subgroups
+#	pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+__kernel void reduce_sg(__global uchar const* src, int const len, __global uint* dst)
+{
+	__local uint S[WGS];
+	uint const sl = get_sub_group_local_id();
+	uint s = 0;
+	for (int i = get_global_id(0); i < len; i += get_global_size(0))
+		s += src[i];
+	s = sub_group_reduce_add(s);
+	if (sl == 0)
+		S[get_sub_group_id()] = s;
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	s = 0;
+	for (uint i = sl; i < get_num_sub_groups(); i += get_sub_group_size())
+		s += S[i];
+	s = sub_group_reduce_add(s);
+	if (get_local_id(0) == 0)
+		dst[get_group_id(0)] = s;
+}
+#endif
+
+
+// single pass reductions of T (a program for each T): every work-group reduces its part of src to
+// part[group], the last group to finish (counted by done) reduces part[] and writes the result to dst[0],
+// A is the type of sum and sumsq, F that of the mean and variance, TMIN and TMAX the range of T,
+// below them the same ops over the rows, columns (CT wide tiles) and segments of a matrix
+#ifdef T
+#ifdef FP64
+#	pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+typedef struct
+{
+	T v;
+	int i;
+} arg;
+
+// count, mean and sum of squared differences from the mean, the variance after welford_final
+typedef struct
+{
+	F n, mean, m2;
+} welford;
+
+inline A sum_init(void) { return 0; }
+inline A sum_load(T x, int i) { return x; }
+inline A sum_merge(A a, A b) { return a + b; }
+inline A sum_final(A a) { return a; }
+
+inline A sumsq_init(void) { return 0; }
+inline A sumsq_load(T x, int i) { return (A)x * x; }
+inline A sumsq_merge(A a, A b) { return a + b; }
+inline A sumsq_final(A a) { return a; }
+
+inline T min_init(void) { return TMAX; }
+inline T min_load(T x, int i) { return x; }
+inline T min_merge(T a, T b) { return min(a, b); }
+inline T min_final(T a) { return a; }
+
+inline T max_init(void) { return TMIN; }
+inline T max_load(T x, int i) { return x; }
+inline T max_merge(T a, T b) { return max(a, b); }
+inline T max_final(T a) { return a; }
+
+// the first index of the extreme value
+inline arg argmin_init(void) { arg r = {TMAX, INT_MAX}; return r; }
+inline arg argmin_load(T x, int i) { arg r = {x, i}; return r; }
+inline arg argmin_merge(arg a, arg b) { return (b.v < a.v || (b.v == a.v && b.i < a.i)) ? b : a; }
+inline arg argmin_final(arg a) { return a; }
+
+inline arg argmax_init(void) { arg r = {TMIN, INT_MAX}; return r; }
+inline arg argmax_load(T x, int i) { arg r = {x, i}; return r; }
+inline arg argmax_merge(arg a, arg b) { return (b.v > a.v || (b.v == a.v && b.i < a.i)) ? b : a; }
+inline arg argmax_final(arg a) { return a; }
+
+// Chan et al. for merging two partial (n, mean, m2)
+inline welford welford_init(void) { welford r = {0, 0, 0}; return r; }
+inline welford welford_load(T x, int i) { welford r = {1, x, 0}; return r; }
+inline welford welford_merge(welford a, welford b)
+{
+	F const n = a.n + b.n;
+	if (n == 0)
+		return a;
+	F const d = b.mean - a.mean;
+	welford r = {n, a.mean + d * (b.n / n), a.m2 + b.m2 + d * d * (a.n * b.n / n)};
+	return r;
+}
+inline welford welford_final(welford a)
+{
+	a.m2 = a.n > 0 ? a.m2 / a.n : 0;
+	return a;
+}
+
+#define REDUCE_TREE(OP)                          \
+	L[li] = s;                                   \
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);     \
+	for (int i = WGS >> 1; i > 0; i >>= 1)       \
+	{                                            \
+		if (li < i)                              \
+			L[li] = OP##_merge(L[li], L[li + i]); \
+		work_group_barrier(CLK_LOCAL_MEM_FENCE); \
+	}
+
+// the body of the kernels below, with L[WGS] of S and last in local memory
+#define REDUCE(OP, S)                                                                            \
+	int const li = get_local_id(0);                                                              \
+	uint const ng = get_num_groups(0);                                                           \
+	S s = OP##_init();                                                                           \
+	for (int i = get_global_id(0); i < len; i += get_global_size(0))                             \
+		s = OP##_merge(s, OP##_load(src[i], i));                                                 \
+	REDUCE_TREE(OP)                                                                              \
+	if (li == 0)                                                                                 \
+	{                                                                                            \
+		part[get_group_id(0)] = L[0];                                                            \
+		uint const n = atomic_fetch_add_explicit(done, 1, memory_order_acq_rel, memory_scope_device); \
+		last = n == ng - 1;                                                                      \
+	}                                                                                            \
+	work_group_barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);                              \
+	if (!last)                                                                                   \
+		return;                                                                                  \
+	s = OP##_init();                                                                             \
+	for (uint i = li; i < ng; i += WGS)                                                          \
+		s = OP##_merge(s, part[i]);                                                              \
+	REDUCE_TREE(OP)                                                                              \
+	if (li == 0)                                                                                 \
+	{                                                                                            \
+		dst[0] = OP##_final(L[0]);                                                               \
+		atomic_store_explicit(done, 0, memory_order_relaxed, memory_scope_device);               \
+	}
+
+__kernel void reduce_sum(__global T const* src, int const len, __global A* part,
+	__global atomic_uint* done, __global A* dst)
+{
+	__local A L[WGS];
+	__local int last;
+	REDUCE(sum, A)
+}
+
+__kernel void reduce_sumsq(__global T const* src, int const len, __global A* part,
+	__global atomic_uint* done, __global A* dst)
+{
+	__local A L[WGS];
+	__local int last;
+	REDUCE(sumsq, A)
+}
+
+__kernel void reduce_min(__global T const* src, int const len, __global T* part,
+	__global atomic_uint* done, __global T* dst)
+{
+	__local T L[WGS];
+	__local int last;
+	REDUCE(min, T)
+}
+
+__kernel void reduce_max(__global T const* src, int const len, __global T* part,
+	__global atomic_uint* done, __global T* dst)
+{
+	__local T L[WGS];
+	__local int last;
+	REDUCE(max, T)
+}
+
+__kernel void reduce_argmin(__global T const* src, int const len, __global arg* part,
+	__global atomic_uint* done, __global arg* dst)
+{
+	__local arg L[WGS];
+	__local int last;
+	REDUCE(argmin, arg)
+}
+
+__kernel void reduce_argmax(__global T const* src, int const len, __global arg* part,
+	__global atomic_uint* done, __global arg* dst)
+{
+	__local arg L[WGS];
+	__local int last;
+	REDUCE(argmax, arg)
+}
+
+__kernel void reduce_welford(__global T const* src, int const len, __global welford* part,
+	__global atomic_uint* done, __global welford* dst)
+{
+	__local welford L[WGS];
+	__local int last;
+	REDUCE(welford, welford)
+}
+
+// reduce of src[BEGIN, END) for each of the n segments g by V work-items (V a power of 2 up to WGS),
+// so a work-group takes WGS / V short segments or works on a part of a long one. with np > 1 each
+// segment is cut in np parts and dst[p][g] has the (not final) result of part p, for reduce_colm_<op>;
+// L[WGS] of S in local memory. an empty segment gives OP##_init(), 0 for sum and sumsq and TMIN for max;
+// sumsq is the squared L2 norm, its sqrt is left to the caller
+#define REDUCE_SEG(OP, S, BEGIN, END)                             \
+	int const li = get_local_id(0);                               \
+	int const lane = li & (V - 1);                                \
+	int const u = get_global_id(0) / V;                           \
+	int const g = u % n, p = u / n;                               \
+	S s = OP##_init();                                            \
+	if (p < np)                                                   \
+	{                                                             \
+		int const b0 = BEGIN, e0 = END;                           \
+		int const b = b0 + (int)((long)(e0 - b0) * p / np);       \
+		int const e = b0 + (int)((long)(e0 - b0) * (p + 1) / np); \
+		for (int i = b + lane; i < e; i += V)                     \
+			s = OP##_merge(s, OP##_load(src[i], i - b0));         \
+	}                                                             \
+	L[li] = s;                                                    \
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);                      \
+	for (int d = V >> 1; d > 0; d >>= 1)                          \
+	{                                                             \
+		if (lane < d)                                             \
+			L[li] = OP##_merge(L[li], L[li + d]);                 \
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);                  \
+	}                                                             \
+	if (lane == 0 && p < np)                                      \
+		dst[u] = np > 1 ? L[li] : OP##_final(L[li]);
+
+// a CT x (WGS / CT) work-group over columns x and rows y, y + get_global_size(1), ...: neighbouring
+// work-items read neighbouring columns, then the tile of partial results is reduced over its rows
+// in L[WGS] and part[get_group_id(1)][x] written, reduce_colm_<op> merges the parts of each column
+#define REDUCE_COLS(OP, S)                                                        \
+	int const tx = get_local_id(0), ty = get_local_id(1);                         \
+	int const x = get_global_id(0);                                               \
+	S s = OP##_init();                                                            \
+	if (x < cols)                                                                 \
+		for (int y = get_global_id(1); y < rows; y += get_global_size(1))         \
+			s = OP##_merge(s, OP##_load(src[y * ld + x], y));                     \
+	L[ty * CT + tx] = s;                                                          \
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);                                      \
+	for (int d = get_local_size(1) >> 1; d > 0; d >>= 1)                          \
+	{                                                                             \
+		if (ty < d)                                                               \
+			L[ty * CT + tx] = OP##_merge(L[ty * CT + tx], L[(ty + d) * CT + tx]); \
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);                                  \
+	}                                                                             \
+	if (ty == 0 && x < cols)                                                      \
+		part[get_group_id(1) * cols + x] = L[tx];
+
+#define REDUCE_COLM(OP, S)                     \
+	int const x = get_global_id(0);            \
+	if (x >= cols)                             \
+		return;                                \
+	S s = part[x];                             \
+	for (int g = 1; g < n; ++g)                \
+		s = OP##_merge(s, part[g * cols + x]); \
+	dst[x] = OP##_final(s);
+
+// the cols elements of each of the n rows, ld apart
+__kernel void reduce_rows_sum(__global T const* src, int const n, int const cols, int const ld,
+	int const V, int const np, __global A* dst)
+{
+	__local A L[WGS];
+	REDUCE_SEG(sum, A, g * ld, g * ld + cols)
+}
+
+__kernel void reduce_rows_sumsq(__global T const* src, int const n, int const cols, int const ld,
+	int const V, int const np, __global A* dst)
+{
+	__local A L[WGS];
+	REDUCE_SEG(sumsq, A, g * ld, g * ld + cols)
+}
+
+__kernel void reduce_rows_max(__global T const* src, int const n, int const cols, int const ld,
+	int const V, int const np, __global T* dst)
+{
+	__local T L[WGS];
+	REDUCE_SEG(max, T, g * ld, g * ld + cols)
+}
+
+// segment g is src[off[g], off[g + 1])
+__kernel void reduce_seg_sum(__global T const* src, __global int const* off, int const n,
+	int const V, int const np, __global A* dst)
+{
+	__local A L[WGS];
+	REDUCE_SEG(sum, A, off[g], off[g + 1])
+}
 
+__kernel void reduce_seg_sumsq(__global T const* src, __global int const* off, int const n,
+	int const V, int const np, __global A* dst)
+{
+	__local A L[WGS];
+	REDUCE_SEG(sumsq, A, off[g], off[g + 1])
+}
+
+__kernel void reduce_seg_max(__global T const* src, __global int const* off, int const n,
+	int const V, int const np, __global T* dst)
+{
+	__local T L[WGS];
+	REDUCE_SEG(max, T, off[g], off[g + 1])
+}
+
+__kernel void reduce_cols_sum(__global T const* src, int const rows, int const cols, int const ld,
+	__global A* part)
+{
+	__local A L[WGS];
+	REDUCE_COLS(sum, A)
+}
+
+__kernel void reduce_cols_sumsq(__global T const* src, int const rows, int const cols, int const ld,
+	__global A* part)
+{
+	__local A L[WGS];
+	REDUCE_COLS(sumsq, A)
+}
+
+__kernel void reduce_cols_max(__global T const* src, int const rows, int const cols, int const ld,
+	__global T* part)
+{
+	__local T L[WGS];
+	REDUCE_COLS(max, T)
+}
+
+// the n parts of each column from reduce_cols_<op> or of each segment from the two above
+__kernel void reduce_colm_sum(__global A const* part, int const n, int const cols, __global A* dst)
+{
+	REDUCE_COLM(sum, A)
+}
+
+__kernel void reduce_colm_sumsq(__global A const* part, int const n, int const cols, __global A* dst)
+{
+	REDUCE_COLM(sumsq, A)
+}
+
+__kernel void reduce_colm_max(__global T const* part, int const n, int const cols, __global T* dst)
+{
+	REDUCE_COLM(max, T)
+}
+#endif
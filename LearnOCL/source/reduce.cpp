@@ -1,7 +1,27 @@
 ﻿#define _CRT_SECURE_NO_WARNINGS
 #include <cmath>
+#include <deque>
+#include <functional>
+#include <limits>
 #include "base.hpp"
 
+// the width of the column tiles of reduce_cols_<op>
+static int const CT = 32;
+
+template <class T>
+struct Arg
+{
+	T v;
+	cl_int i;
+};
+
+// count, mean and variance from reduce_welford
+template <class F>
+struct Welford
+{
+	F n, mean, var;
+};
+
 class OCL
 {
 	cl_platform_id platform;
@@ -11,13 +31,32 @@ class OCL
 	cl_program program;
 	cl_uint cunits;
 	size_t cwgs;
+	// the fastest kernel of reduce, reduce_wg and reduce_sg
+	char const* variant;
 
 public:
 	OCL();
 	~OCL();
 
 	void init();
+	cl_program build(char const* opts);
+	void calibrate();
 	void work();
+	template <class S>
+	double reduce(cl_program P, char const* op, cl_mem src, int len, cl_mem done, S& r);
+	int lanes(double len);
+	double segmented(cl_program P, char const* op, cl_kernel K, cl_uint narg, int n, double len, size_t ssize, cl_mem dst);
+	double rows(cl_program P, char const* op, cl_mem src, int rows, int cols, int ld, size_t ssize, cl_mem dst);
+	double segments(cl_program P, char const* op, cl_mem src, cl_mem off, int nseg, int len, size_t ssize, cl_mem dst);
+	double cols(cl_program P, char const* op, cl_mem src, int rows, int cols, int ld, size_t ssize, cl_mem dst);
+	template <class T, class A>
+	void axes(cl_program P, Mat const& src, cl_mem M1);
+	template <class T, class A, class F>
+	void family(char const* name, char const* defs, int type, double lo, double hi);
+	void ops();
+	template <class T, class S, class Merge>
+	void stream(cl_program P, char const* op, FILE* fid, int chunk, S& r, Merge merge);
+	void streams();
 };
 
 OCL::OCL()
@@ -46,18 +85,93 @@ void OCL::init()
 	CheckCLError(err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cunits), &cunits, NULL));
 	CheckCLError(err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(cwgs), &cwgs, NULL));
 	char info[4096] = {0};
+	snprintf(info, sizeof(info), "-cl-kernel-arg-info -Werror -DWGS=%zd", cwgs);
+	// reduce_wg needs OpenCL C 2.0, reduce_sg sub-groups too,
+	// without them (or if that build fails) only the classic reduce is there
+	char ver[64] = {0}, ext[4096] = {0};
+	int major = 0, minor = 0;
+	clGetDeviceInfo(device, CL_DEVICE_OPENCL_C_VERSION, sizeof(ver), ver, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, sizeof(ext), ext, NULL);
+	sscanf(ver, "OpenCL C %d.%d", &major, &minor);
+	string opts = info;
+	if (major >= 2)
+		opts += " -cl-std=CL2.0 -DWG_REDUCE";
+	if ((major >= 2 && strstr(ext, "cl_khr_subgroups")) || strstr(ext, "cl_intel_subgroups"))
+		opts += " -DSUB_GROUPS";
+	program = build(opts.data());
+	if (!program)
+		program = build(info);
+	variant = "reduce";
+}
+
+cl_program OCL::build(char const* opts)
+{
+	cl_int err;
+	char info[4096] = {0};
 	string K = string(__FILE__);
 	K = K.substr(0, K.size() - 4) + ".cl";
 	K = loadCLFile(K.data());
 	char const* KS[] = {K.data()};
-	snprintf(info, sizeof(info), "-cl-kernel-arg-info -Werror -DWGS=%zd", cwgs);
-	CheckCLError(program = clCreateProgramWithSource(context, 1, KS, 0, &err));
-	err = clBuildProgram(program, 1, &device, info, NULL, NULL);
-	clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
+	CheckCLError(cl_program P = clCreateProgramWithSource(context, 1, KS, 0, &err));
+	err = clBuildProgram(P, 1, &device, opts, NULL, NULL);
+	clGetProgramBuildInfo(P, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
 	fprintf(stderr, "build program with code %d, log:\n%s", err, info);
-	CheckCLError((void)(err));
-	CheckCLError(err = clGetProgramInfo(program, CL_PROGRAM_KERNEL_NAMES, sizeof(info), info, NULL));
+	if (err)
+	{
+		clReleaseProgram(P);
+		return NULL;
+	}
+	CheckCLError(err = clGetProgramInfo(P, CL_PROGRAM_KERNEL_NAMES, sizeof(info), info, NULL));
 	fprintf(stderr, "kernel names: %s\n", info);
+	return P;
+}
+
+// time every variant of reduce in the program once on data like that of work(),
+// the fastest one that gets the right sum is used from now on
+void OCL::calibrate()
+{
+	cl_int err;
+	cl_event e;
+	char const* const name[] = {"reduce", "reduce_wg", "reduce_sg"};
+	AutoBuffer<cl_uint> S(cunits);
+	Mat src(4096, 4096, CV_8U);
+	int const total = static_cast<int>(src.total());
+	size_t const szloc = cwgs, sztot = cwgs * cunits;
+	randu(src, 0, 127);
+	cl_uint sum = 0;
+	for (int i = 0; i < total; ++i)
+		sum += src.data[i];
+	CheckCLError(cl_mem M1 = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, total, src.data, &err));
+	CheckCLError(cl_mem M2 = clCreateBuffer(context, CL_MEM_WRITE_ONLY, cunits * sizeof(S[0]), NULL, &err));
+	double best = HUGE_VAL;
+	for (char const* n : name)
+	{
+		cl_kernel K = clCreateKernel(program, n, &err);
+		if (err)
+		{
+			fprintf(stderr, "%s: not built for this device\n", n);
+			continue;
+		}
+		CheckCLError(err = clSetKernelArg(K, 0, sizeof(M1), &M1));
+		CheckCLError(err = clSetKernelArg(K, 1, sizeof(int), &total));
+		CheckCLError(err = clSetKernelArg(K, 2, sizeof(M2), &M2));
+		// the first run warms up
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, &sztot, &szloc, 0, NULL, NULL));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, &sztot, &szloc, 0, NULL, &e));
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, M2, CL_TRUE, 0, cunits * sizeof(S[0]), S, 1, &e, NULL));
+		double const ms = getCLTime(e, n);
+		for (cl_uint i = 1; i < cunits; ++i)
+			S[0] += S[i];
+		if (S[0] != sum)
+			fprintf(stderr, "%s: wrong sum %u, expect %u\n", n, S[0], sum);
+		else if (ms < best)
+			best = ms, variant = n;
+		CheckCLError(err = clReleaseKernel(K));
+		CheckCLError(err = clReleaseEvent(e));
+	}
+	fprintf(stderr, "calibrate: use %s\n", variant);
+	CheckCLError(err = clReleaseMemObject(M2));
+	CheckCLError(err = clReleaseMemObject(M1));
 }
 
 void OCL::work()
@@ -72,7 +186,7 @@ void OCL::work()
 	randu(src, 0, 127);
 	CheckCLError(cl_mem M1 = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, total * src.elemSize(), src.data, &err));
 	CheckCLError(cl_mem M2 = clCreateBuffer(context, CL_MEM_WRITE_ONLY, cunits * sizeof(S[0]), NULL, &err));
-	CheckCLError(cl_kernel K1 = clCreateKernel(program, "reduce", &err));
+	CheckCLError(cl_kernel K1 = clCreateKernel(program, variant, &err));
 	CheckCLError(clSetKernelArg(K1, 0, sizeof(M1), &M1));
 	CheckCLError(clSetKernelArg(K1, 1, sizeof(int), &total));
 	CheckCLError(clSetKernelArg(K1, 2, sizeof(M2), &M2));
@@ -81,7 +195,7 @@ void OCL::work()
 	clFlush(cqueue), clFinish(cqueue);
 	CheckCLError(clWaitForEvents(1, &e1));
 	CheckCLError(clWaitForEvents(1, &e2));
-	getCLTime(e1, "reduce");
+	getCLTime(e1, variant);
 	for (cl_uint i = 1; i < cunits; ++i)
 		S[0] += S[i];
 	for (int i = 0; i < total; ++i)
@@ -94,10 +208,457 @@ void OCL::work()
 	CheckCLError(clReleaseEvent(e1));
 }
 
+// one reduce_<op> of the len elements in src, the result in r, returns the kernel time in ms
+template <class S>
+double OCL::reduce(cl_program P, char const* op, cl_mem src, int len, cl_mem done, S& r)
+{
+	cl_int err;
+	cl_event e;
+	char name[32];
+	size_t const szloc = cwgs, sztot = cwgs * cunits;
+	snprintf(name, sizeof(name), "reduce_%s", op);
+	CheckCLError(cl_mem part = clCreateBuffer(context, CL_MEM_READ_WRITE, cunits * sizeof(S), NULL, &err));
+	CheckCLError(cl_mem dst = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(S), NULL, &err));
+	CheckCLError(cl_kernel K = clCreateKernel(P, name, &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(src), &src));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(len), &len));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(part), &part));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(done), &done));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(dst), &dst));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, &sztot, &szloc, 0, NULL, &e));
+	CheckCLError(err = clEnqueueReadBuffer(cqueue, dst, CL_TRUE, 0, sizeof(S), &r, 1, &e, NULL));
+	double const ms = getCLTime(e, name);
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clReleaseMemObject(dst));
+	CheckCLError(err = clReleaseMemObject(part));
+	CheckCLError(err = clReleaseEvent(e));
+	return ms;
+}
+
+// work-items for each segment of about len elements: a power of 2 with a few elements each, up to cwgs
+int OCL::lanes(double len)
+{
+	int V = 1;
+	while (V < static_cast<int>(cwgs) && V * 4 < len)
+		V <<= 1;
+	return V;
+}
+
+// run K, reduce_rows_<op> or reduce_seg_<op> with all but its last 3 args (V, np and dst) set,
+// over n segments of about len elements to dst[n]; few long segments are cut in parts so that
+// the device is full, then reduce_colm_<op> merges them (the state of op is ssize bytes)
+double OCL::segmented(cl_program P, char const* op, cl_kernel K, cl_uint narg, int n, double len, size_t ssize, cl_mem dst)
+{
+	cl_int err;
+	cl_event e1, e2;
+	char name[32];
+	int const V = lanes(len);
+	int np = 1;
+	if (V == static_cast<int>(cwgs) && n < static_cast<int>(cunits) * 4)
+		np = clamp(static_cast<int>(cunits) * 4 / n, 1, static_cast<int>(len / (cwgs * 4)) + 1);
+	size_t const szloc = cwgs, sztot = (static_cast<size_t>(n) * np * V + cwgs - 1) / cwgs * cwgs;
+	cl_mem out = dst;
+	if (np > 1)
+	{
+		CheckCLError(out = clCreateBuffer(context, CL_MEM_READ_WRITE, np * n * ssize, NULL, &err));
+	}
+	CheckCLError(err = clSetKernelArg(K, narg - 3, sizeof(V), &V));
+	CheckCLError(err = clSetKernelArg(K, narg - 2, sizeof(np), &np));
+	CheckCLError(err = clSetKernelArg(K, narg - 1, sizeof(out), &out));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, &sztot, &szloc, 0, NULL, &e1));
+	CheckCLError(err = clWaitForEvents(1, &e1));
+	CheckCLError(err = clGetKernelInfo(K, CL_KERNEL_FUNCTION_NAME, sizeof(name), name, NULL));
+	double ms = getCLTime(e1, name);
+	if (np > 1)
+	{
+		size_t const szm = (n + cwgs - 1) / cwgs * cwgs;
+		snprintf(name, sizeof(name), "reduce_colm_%s", op);
+		CheckCLError(cl_kernel K2 = clCreateKernel(P, name, &err));
+		CheckCLError(err = clSetKernelArg(K2, 0, sizeof(out), &out));
+		CheckCLError(err = clSetKernelArg(K2, 1, sizeof(np), &np));
+		CheckCLError(err = clSetKernelArg(K2, 2, sizeof(n), &n));
+		CheckCLError(err = clSetKernelArg(K2, 3, sizeof(dst), &dst));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K2, 1, NULL, &szm, &cwgs, 0, NULL, &e2));
+		CheckCLError(err = clWaitForEvents(1, &e2));
+		ms += getCLTime(e2, "merge");
+		CheckCLError(err = clReleaseKernel(K2));
+		CheckCLError(err = clReleaseMemObject(out));
+		CheckCLError(err = clReleaseEvent(e2));
+	}
+	CheckCLError(err = clReleaseEvent(e1));
+	return ms;
+}
+
+// reduce_rows_<op> of the cols elements in each of the rows, ld apart, to dst[rows]
+double OCL::rows(cl_program P, char const* op, cl_mem src, int rows, int cols, int ld, size_t ssize, cl_mem dst)
+{
+	cl_int err;
+	char name[32];
+	snprintf(name, sizeof(name), "reduce_rows_%s", op);
+	CheckCLError(cl_kernel K = clCreateKernel(P, name, &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(src), &src));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(rows), &rows));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(cols), &cols));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(ld), &ld));
+	double const ms = segmented(P, op, K, 7, rows, cols, ssize, dst);
+	CheckCLError(err = clReleaseKernel(K));
+	return ms;
+}
+
+// reduce_seg_<op> of the nseg segments src[off[g], off[g + 1]) to dst[nseg], len = off[nseg]
+double OCL::segments(cl_program P, char const* op, cl_mem src, cl_mem off, int nseg, int len, size_t ssize, cl_mem dst)
+{
+	cl_int err;
+	char name[32];
+	snprintf(name, sizeof(name), "reduce_seg_%s", op);
+	CheckCLError(cl_kernel K = clCreateKernel(P, name, &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(src), &src));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(off), &off));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(nseg), &nseg));
+	double const ms = segmented(P, op, K, 6, nseg, static_cast<double>(len) / nseg, ssize, dst);
+	CheckCLError(err = clReleaseKernel(K));
+	return ms;
+}
+
+// reduce_cols_<op> of the rows x cols matrix (ld apart) to dst[cols], the state of op is ssize bytes;
+// the rows are split among enough work-groups to fill the device, reduce_colm_<op> merges them
+double OCL::cols(cl_program P, char const* op, cl_mem src, int rows, int cols, int ld, size_t ssize, cl_mem dst)
+{
+	cl_int err;
+	cl_event e1, e2;
+	char name[32];
+	size_t const RT = cwgs / CT;
+	size_t const gx = (cols + CT - 1) / CT;
+	int const n = static_cast<int>(clamp(cunits * 4 / gx, static_cast<size_t>(1), (rows + RT - 1) / RT));
+	size_t const szloc[] = {static_cast<size_t>(CT), RT}, sztot[] = {gx * CT, n * RT};
+	size_t const szm = (cols + cwgs - 1) / cwgs * cwgs;
+	CheckCLError(cl_mem part = clCreateBuffer(context, CL_MEM_READ_WRITE, n * cols * ssize, NULL, &err));
+	snprintf(name, sizeof(name), "reduce_cols_%s", op);
+	CheckCLError(cl_kernel K1 = clCreateKernel(P, name, &err));
+	snprintf(name, sizeof(name), "reduce_colm_%s", op);
+	CheckCLError(cl_kernel K2 = clCreateKernel(P, name, &err));
+	CheckCLError(err = clSetKernelArg(K1, 0, sizeof(src), &src));
+	CheckCLError(err = clSetKernelArg(K1, 1, sizeof(rows), &rows));
+	CheckCLError(err = clSetKernelArg(K1, 2, sizeof(cols), &cols));
+	CheckCLError(err = clSetKernelArg(K1, 3, sizeof(ld), &ld));
+	CheckCLError(err = clSetKernelArg(K1, 4, sizeof(part), &part));
+	CheckCLError(err = clSetKernelArg(K2, 0, sizeof(part), &part));
+	CheckCLError(err = clSetKernelArg(K2, 1, sizeof(n), &n));
+	CheckCLError(err = clSetKernelArg(K2, 2, sizeof(cols), &cols));
+	CheckCLError(err = clSetKernelArg(K2, 3, sizeof(dst), &dst));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K1, 2, NULL, sztot, szloc, 0, NULL, &e1));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K2, 1, NULL, &szm, &cwgs, 1, &e1, &e2));
+	CheckCLError(err = clWaitForEvents(1, &e2));
+	snprintf(name, sizeof(name), "reduce_cols_%s", op);
+	double const ms = getCLTime(e1, name) + getCLTime(e2, "merge");
+	CheckCLError(err = clReleaseKernel(K2));
+	CheckCLError(err = clReleaseKernel(K1));
+	CheckCLError(err = clReleaseMemObject(part));
+	CheckCLError(err = clReleaseEvent(e2));
+	CheckCLError(err = clReleaseEvent(e1));
+	return ms;
+}
+
+// max |got - ref| / max(1, |ref|) of n results of type S read from dst, infinity if any is NaN;
+// equal values (-INFINITY of an empty segment too) differ by 0
+template <class S>
+static double difference(cl_command_queue cqueue, cl_mem dst, vector<double> const& ref)
+{
+	cl_int err;
+	vector<S> got(ref.size());
+	CheckCLError(err = clEnqueueReadBuffer(cqueue, dst, CL_TRUE, 0, got.size() * sizeof(S), got.data(), 0, NULL, NULL));
+	double d = 0;
+	for (size_t i = 0; i < got.size(); ++i)
+	{
+		double const g = static_cast<double>(got[i]);
+		if (g == ref[i])
+			continue;
+		double const e = std::abs(g - ref[i]) / max(1.0, std::abs(ref[i]));
+		d = std::isnan(e) ? HUGE_VAL : max(d, e);
+	}
+	return d;
+}
+
+// sum, sumsq and max over the rows and the columns of src (M1 on the device) without its last 3 columns,
+// and over many short (some empty) and a few long segments of all of it, against the host;
+// max of an empty segment is TMIN of the program, the lowest T or -INFINITY
+template <class T, class A>
+void OCL::axes(cl_program P, Mat const& src, cl_mem M1)
+{
+	cl_int err;
+	char const* const op[] = {"sum", "sumsq", "max"};
+	int const R = src.rows, C = src.cols - 3, ld = src.cols;
+	int const total = static_cast<int>(src.total());
+	cv::RNG rng(total);
+	vector<int> shorts(1, 0), longs;
+	while (shorts.back() < total)
+		shorts.push_back(min(total, shorts.back() + static_cast<int>(rng(17))));
+	for (int i = 0; i <= 8; ++i)
+		longs.push_back(static_cast<int>(static_cast<int64_t>(total) * i / 8));
+	int const nmax = max(max(R, ld), static_cast<int>(shorts.size()));
+	CheckCLError(cl_mem dst = clCreateBuffer(context, CL_MEM_WRITE_ONLY, nmax * sizeof(A), NULL, &err));
+
+	// host results of op k for each row, column or segment
+	double const tmin = std::numeric_limits<T>::has_infinity ? -HUGE_VAL : static_cast<double>(std::numeric_limits<T>::lowest());
+	auto apply = [](int k, double r, double x) { return k == 0 ? r + x : (k == 1 ? r + x * x : max(r, x)); };
+	auto reference = [&](int k, int n, std::function<int(int)> begin, std::function<int(int)> end, int step) {
+		vector<double> ref(n);
+		for (int g = 0; g < n; ++g)
+		{
+			double r = k == 2 ? tmin : 0;
+			for (int i = begin(g); i < end(g); i += step)
+				r = apply(k, r, static_cast<double>(src.ptr<T>()[i]));
+			ref[g] = r;
+		}
+		return ref;
+	};
+	for (int k = 0; k < 3; ++k)
+	{
+		vector<double> ref;
+		ref = reference(k, R, [&](int g) { return g * ld; }, [&](int g) { return g * ld + C; }, 1);
+		rows(P, op[k], M1, R, C, ld, k < 2 ? sizeof(A) : sizeof(T), dst);
+		fprintf(stderr, "rows %s: max diff %g\n", op[k], k < 2 ? difference<A>(cqueue, dst, ref) : difference<T>(cqueue, dst, ref));
+		ref = reference(k, C, [&](int g) { return g; }, [&](int g) { return g + R * ld; }, ld);
+		cols(P, op[k], M1, R, C, ld, k < 2 ? sizeof(A) : sizeof(T), dst);
+		fprintf(stderr, "cols %s: max diff %g\n", op[k], k < 2 ? difference<A>(cqueue, dst, ref) : difference<T>(cqueue, dst, ref));
+		for (vector<int> const* off : {&shorts, &longs})
+		{
+			int const nseg = static_cast<int>(off->size()) - 1;
+			CheckCLError(cl_mem M2 = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, off->size() * sizeof(int), const_cast<int*>(off->data()), &err));
+			ref = reference(k, nseg, [&](int g) { return (*off)[g]; }, [&](int g) { return (*off)[g + 1]; }, 1);
+			segments(P, op[k], M1, M2, nseg, total, k < 2 ? sizeof(A) : sizeof(T), dst);
+			fprintf(stderr, "%d segments %s: max diff %g\n", nseg, op[k], k < 2 ? difference<A>(cqueue, dst, ref) : difference<T>(cqueue, dst, ref));
+			CheckCLError(err = clReleaseMemObject(M2));
+		}
+	}
+	CheckCLError(err = clReleaseMemObject(dst));
+}
+
+// every reduce_<op> over 4096 x 4096 T in [lo, hi), against the host
+template <class T, class A, class F>
+void OCL::family(char const* name, char const* defs, int type, double lo, double hi)
+{
+	cl_int err;
+	char info[256];
+	snprintf(info, sizeof(info), "-cl-std=CL2.0 -cl-kernel-arg-info -Werror -DWGS=%zd -DCT=%d %s", cwgs, CT, defs);
+	fprintf(stderr, "\n%s\n", name);
+	cl_program P = build(info);
+	if (!P)
+		return;
+	Mat src(4096, 4096, type);
+	randu(src, lo, hi);
+	int const total = static_cast<int>(src.total());
+	T const* x = src.ptr<T>();
+	cl_uint zero = 0;
+	CheckCLError(cl_mem M1 = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, total * sizeof(T), src.data, &err));
+	CheckCLError(cl_mem done = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_WRITE, sizeof(zero), &zero, &err));
+
+	double sum = 0, sumsq = 0, var = 0;
+	Arg<T> amin = {x[0], 0}, amax = {x[0], 0};
+	for (int i = 0; i < total; ++i)
+	{
+		sum += x[i];
+		sumsq += static_cast<double>(x[i]) * x[i];
+		if (x[i] < amin.v)
+			amin.v = x[i], amin.i = i;
+		if (x[i] > amax.v)
+			amax.v = x[i], amax.i = i;
+	}
+	double const mean = sum / total;
+	for (int i = 0; i < total; ++i)
+		var += (x[i] - mean) * (x[i] - mean);
+	var /= total;
+
+	A s;
+	T m;
+	Arg<T> a;
+	Welford<F> w;
+	reduce(P, "sum", M1, total, done, s);
+	fprintf(stderr, "sum %.9g, host %.9g\n", static_cast<double>(s), sum);
+	reduce(P, "sumsq", M1, total, done, s);
+	fprintf(stderr, "sumsq %.9g, host %.9g\n", static_cast<double>(s), sumsq);
+	reduce(P, "min", M1, total, done, m);
+	fprintf(stderr, "min %.9g, host %.9g\n", static_cast<double>(m), static_cast<double>(amin.v));
+	reduce(P, "max", M1, total, done, m);
+	fprintf(stderr, "max %.9g, host %.9g\n", static_cast<double>(m), static_cast<double>(amax.v));
+	reduce(P, "argmin", M1, total, done, a);
+	fprintf(stderr, "argmin %d, host %d\n", a.i, amin.i);
+	reduce(P, "argmax", M1, total, done, a);
+	fprintf(stderr, "argmax %d, host %d\n", a.i, amax.i);
+	reduce(P, "welford", M1, total, done, w);
+	fprintf(stderr, "mean %.9g, var %.9g, host %.9g, %.9g\n", static_cast<double>(w.mean), static_cast<double>(w.var), mean, var);
+	axes<T, A>(P, src, M1);
+	CheckCLError(err = clReleaseMemObject(done));
+	CheckCLError(err = clReleaseMemObject(M1));
+	CheckCLError(err = clReleaseProgram(P));
+}
+
+void OCL::ops()
+{
+	family<cl_uchar, cl_ulong, cl_float>("uchar", "-DT=uchar -DA=ulong -DF=float -DTMIN=0 -DTMAX=UCHAR_MAX", CV_8U, 0, 256);
+	family<cl_int, cl_long, cl_float>("int", "-DT=int -DA=long -DF=float -DTMIN=INT_MIN -DTMAX=INT_MAX", CV_32S, -1000, 1000);
+	family<cl_float, cl_float, cl_float>("float", "-DT=float -DA=float -DF=float -DTMIN=-INFINITY -DTMAX=INFINITY", CV_32F, -1, 1);
+	cl_device_fp_config fp = 0;
+	clGetDeviceInfo(device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp), &fp, NULL);
+	if (!fp)
+	{
+		fputs("\ndevice does not support FP64, skip double\n", stderr);
+		return;
+	}
+	family<cl_double, cl_double, cl_double>("double",
+		"-DFP64 -DT=double -DA=double -DF=double -DTMIN=-INFINITY -DTMAX=INFINITY", CV_64F, -1, 1);
+}
+
+// reduce_<op> of the T in fid, chunk elements at a time: fread into NB pinned staging buffers,
+// uploads on their own queue and reduce_<op> on cqueue overlap with the next reads, and the result
+// of every chunk comes back asynchronously to be merged on the host at the end.
+// fid is read from its start until EOF, so its size never goes through a (32-bit on MSVC) long
+template <class T, class S, class Merge>
+void OCL::stream(cl_program P, char const* op, FILE* fid, int chunk, S& r, Merge merge)
+{
+	static int const NB = 3;
+	cl_int err;
+	cl_uint zero = 0;
+	char name[32];
+	size_t const bytes = chunk * sizeof(T);
+	size_t const szloc = cwgs, sztot = cwgs * cunits;
+	rewind(fid);
+	int64_t fsize = 0;
+	int nchunk = 0;
+	// the reads into res are in flight while it grows, a deque does not move them
+	std::deque<S> res;
+	vector<cl_event> up, red;
+	cl_mem stage[NB], D[NB];
+	T* host[NB];
+	CheckCLError(cl_command_queue uqueue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
+	for (int b = 0; b < NB; ++b)
+	{
+		CheckCLError(stage[b] = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR + CL_MEM_READ_ONLY, bytes, NULL, &err));
+		CheckCLError(host[b] = static_cast<T*>(clEnqueueMapBuffer(uqueue, stage[b], CL_TRUE, CL_MAP_WRITE, 0, bytes, 0, NULL, NULL, &err)));
+		CheckCLError(D[b] = clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, NULL, &err));
+	}
+	CheckCLError(cl_mem part = clCreateBuffer(context, CL_MEM_READ_WRITE, cunits * sizeof(S), NULL, &err));
+	CheckCLError(cl_mem done = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_WRITE, sizeof(zero), &zero, &err));
+	CheckCLError(cl_mem dst = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(S), NULL, &err));
+	snprintf(name, sizeof(name), "reduce_%s", op);
+	CheckCLError(cl_kernel K = clCreateKernel(P, name, &err));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(part), &part));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(done), &done));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(dst), &dst));
+
+	double io = 0;
+	int64_t const t0 = cv::getTickCount();
+	for (int i = 0;; ++i)
+	{
+		int const b = i % NB;
+		// staging b is free once chunk i - NB is uploaded, D[b] once it is reduced
+		if (i >= NB)
+		{
+			CheckCLError(err = clWaitForEvents(1, &up[i - NB]));
+		}
+		int64_t t = cv::getTickCount();
+		int const n = static_cast<int>(fread(host[b], sizeof(T), chunk, fid));
+		io += (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+		if (n == 0)
+			break;
+		nchunk = i + 1, fsize += n * sizeof(T);
+		up.push_back(NULL), red.push_back(NULL), res.push_back(S());
+		CheckCLError(err = clEnqueueWriteBuffer(uqueue, D[b], CL_FALSE, 0, n * sizeof(T), host[b], i >= NB, i >= NB ? &red[i - NB] : NULL, &up[i]));
+		clFlush(uqueue);
+		CheckCLError(err = clSetKernelArg(K, 0, sizeof(D[b]), D + b));
+		CheckCLError(err = clSetKernelArg(K, 1, sizeof(n), &n));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, &sztot, &szloc, 1, &up[i], &red[i]));
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, dst, CL_FALSE, 0, sizeof(S), &res[i], 0, NULL, NULL));
+		clFlush(cqueue);
+	}
+	clFinish(uqueue), clFinish(cqueue);
+	double const ms = (cv::getTickCount() - t0) * 1e3 / cv::getTickFrequency();
+
+	double upload = 0, compute = 0;
+	r = nchunk ? res[0] : S();
+	for (int i = 0; i < nchunk; ++i)
+	{
+		if (i)
+			r = merge(r, res[i]);
+		upload += getCLTime(up[i], NULL), compute += getCLTime(red[i], NULL);
+		CheckCLError(err = clReleaseEvent(red[i]));
+		CheckCLError(err = clReleaseEvent(up[i]));
+	}
+	fprintf(stderr, "stream %s of %d chunks (%lld bytes): %.2fms, read %.2fms, upload %.2fms, %s %.2fms, %.2f GB/s\n",
+		op, nchunk, static_cast<long long>(fsize), ms, io, upload, name, compute, 1e-6 * fsize / ms);
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clReleaseMemObject(dst));
+	CheckCLError(err = clReleaseMemObject(done));
+	CheckCLError(err = clReleaseMemObject(part));
+	for (int b = 0; b < NB; ++b)
+	{
+		CheckCLError(err = clEnqueueUnmapMemObject(uqueue, stage[b], host[b], 0, NULL, NULL));
+		CheckCLError(err = clReleaseMemObject(D[b]));
+	}
+	clFinish(uqueue);
+	for (int b = 0; b < NB; ++b)
+	{
+		CheckCLError(err = clReleaseMemObject(stage[b]));
+	}
+	CheckCLError(err = clReleaseCommandQueue(uqueue));
+}
+
+// sum and max of a temporary file of 128.25 chunks of 16M uchar (over 2 GiB, past what a 32-bit
+// offset can reach), streamed, against the host
+void OCL::streams()
+{
+	cl_int err;
+	char info[256];
+	int const chunk = 1 << 24;
+	snprintf(info, sizeof(info), "-cl-std=CL2.0 -cl-kernel-arg-info -Werror -DWGS=%zd -DCT=%d %s", cwgs, CT,
+		"-DT=uchar -DA=ulong -DF=float -DTMIN=0 -DTMAX=UCHAR_MAX");
+	fputs("\nstream\n", stderr);
+	cl_program P = build(info);
+	if (!P)
+		return;
+	FILE* fid = tmpfile();
+	if (!fid)
+	{
+		fputs("can't create a temporary file\n", stderr);
+		CheckCLError(err = clReleaseProgram(P));
+		return;
+	}
+	Mat src(1, chunk, CV_8U);
+	cl_ulong sum = 0, s;
+	cl_uchar mx = 0, m;
+	bool ok = true;
+	for (int i = 0; ok && i <= 128; ++i)
+	{
+		int const n = i < 128 ? chunk : chunk / 4;
+		randu(src, 0, 256);
+		for (int k = 0; k < n; ++k)
+			sum += src.data[k], mx = max(mx, src.data[k]);
+		ok = fwrite(src.data, 1, n, fid) == static_cast<size_t>(n);
+	}
+	// out of disk space, the host sum would count bytes that are not in the file
+	if (!ok || fflush(fid))
+	{
+		fputs("short write to the temporary file, skip stream\n", stderr);
+		fclose(fid);
+		CheckCLError(err = clReleaseProgram(P));
+		return;
+	}
+	// the second pass reads from the page cache
+	stream<cl_uchar>(P, "sum", fid, chunk, s, [](cl_ulong a, cl_ulong b) { return a + b; });
+	fprintf(stderr, "sum %llu, host %llu\n", static_cast<unsigned long long>(s), static_cast<unsigned long long>(sum));
+	stream<cl_uchar>(P, "max", fid, chunk, m, [](cl_uchar a, cl_uchar b) { return max(a, b); });
+	fprintf(stderr, "max %d, host %d\n", m, mx);
+	fclose(fid);
+	CheckCLError(err = clReleaseProgram(P));
+}
+
 int main()
 {
 	OCL ocl;
 	ocl.init();
+	ocl.calibrate();
 	ocl.work();
+	ocl.ops();
+	ocl.streams();
 	fputs("Game Over!\n", stderr);
 }
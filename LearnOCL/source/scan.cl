@@ -0,0 +1,158 @@
+﻿#ifndef WGS
+#	define WGS 0
+#endif
+#ifndef IPT
+#	define IPT 1
+#endif
+
+// scan of T (a program for each T) with the associative OP(a, b) and its identity ID, + by default,
+// -D'OP(a,b)=max(a,b)' -DID=INT_MIN for example; OP need not commute, a is always the earlier part.
+// a tile is the WGS * IPT elements one work-group scans, IPT consecutive ones in each work-item
+#ifdef T
+#ifndef OP
+#	define OP(a, b) ((a) + (b))
+#	define ID 0
+#endif
+
+// inclusive scan of s over the work-group, L[] holds the inclusive values after
+inline T scan_group(T s, __local T* L)
+{
+	int const li = get_local_id(0);
+	L[li] = s;
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	for (int d = 1; d < WGS; d <<= 1)
+	{
+		T const t = li >= d ? L[li - d] : ID;
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+		if (li >= d)
+			L[li] = OP(t, L[li]);
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	return L[li];
+}
+
+// x[] = inclusive scan of the IPT elements of this work-item in the tile at base (ID past len),
+// returns the OP of the elements of the work-items before it, the tile total is L[WGS - 1]
+inline T scan_load(__global T const* src, int const len, int const base,
+	__local T* B, __local T* L, T* x)
+{
+	int const li = get_local_id(0);
+	for (int k = 0; k < IPT; ++k)
+	{
+		int const i = k * WGS + li;
+		B[i] = base + i < len ? src[base + i] : ID;
+	}
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	T s = ID;
+	for (int k = 0; k < IPT; ++k)
+	{
+		s = OP(s, B[li * IPT + k]);
+		x[k] = s;
+	}
+	scan_group(s, L);
+	return li > 0 ? L[li - 1] : ID;
+}
+
+// dst[] of the tile at base, p is the OP of everything before this work-item
+inline void scan_store(__global T* dst, int const len, int const base, int const exclusive,
+	T const p, T const* x, __local T* B)
+{
+	int const li = get_local_id(0);
+	for (int k = 0; k < IPT; ++k)
+	{
+		T const y = exclusive ? (k > 0 ? x[k - 1] : ID) : x[k];
+		B[li * IPT + k] = OP(p, y);
+	}
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	for (int k = 0; k < IPT; ++k)
+	{
+		int const i = k * WGS + li;
+		if (base + i < len)
+			dst[base + i] = B[i];
+	}
+}
+
+// reduce-then-scan, works everywhere: part[tile] = OP of the tile,
+// the host scans part[] exclusively (recursively) and then scan_tiles adds it
+__kernel void scan_reduce(__global T const* src, int const len, __global T* part)
+{
+	__local T B[WGS * IPT];
+	__local T L[WGS];
+	T x[IPT];
+	int const base = get_group_id(0) * WGS * IPT;
+	scan_load(src, len, base, B, L, x);
+	if (get_local_id(0) == 0)
+		part[get_group_id(0)] = L[WGS - 1];
+}
+
+// src may be dst, part[tile] is the exclusive prefix of the tile (unused for a single tile)
+__kernel void scan_tiles(__global T const* src, __global T* dst, int const len, int const exclusive,
+	__global T const* part)
+{
+	__local T B[WGS * IPT];
+	__local T L[WGS];
+	T x[IPT];
+	int const base = get_group_id(0) * WGS * IPT;
+	T p = scan_load(src, len, base, B, L, x);
+	if (get_num_groups(0) > 1)
+		p = OP(part[get_group_id(0)], p);
+	scan_store(dst, len, base, exclusive, p, x, B);
+}
+
+// single pass with decoupled look-back (OpenCL C 2.0): tiles are taken in the order work-groups
+// start (counter), so every tile waits only on tiles already running. flag[tile] is 0 while unknown,
+// LB_AGG when agg[tile] (the OP of the tile) is there and LB_PRE when pre[tile] (the OP of all
+// tiles up to it) is. counter and flag[] must be 0 before each launch
+#ifdef LOOKBACK
+#define LB_AGG 1
+#define LB_PRE 2
+
+__kernel void scan_lookback(__global T const* src, __global T* dst, int const len, int const exclusive,
+	__global atomic_uint* counter, __global atomic_uint* flag, __global T* agg, __global T* pre)
+{
+	__local T B[WGS * IPT];
+	__local T L[WGS];
+	__local uint tile;
+	__local T prefix;
+	T x[IPT];
+	int const li = get_local_id(0);
+	if (li == 0)
+		tile = atomic_fetch_add_explicit(counter, 1, memory_order_relaxed, memory_scope_device);
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	uint const t = tile;
+	int const base = t * WGS * IPT;
+	T const p = scan_load(src, len, base, B, L, x);
+	if (li == 0)
+	{
+		T const total = L[WGS - 1];
+		T q = ID;
+		if (t == 0)
+		{
+			pre[0] = total;
+			atomic_store_explicit(flag, LB_PRE, memory_order_release, memory_scope_device);
+		}
+		else
+		{
+			agg[t] = total;
+			atomic_store_explicit(flag + t, LB_AGG, memory_order_release, memory_scope_device);
+			for (uint j = t - 1;;)
+			{
+				uint const f = atomic_load_explicit(flag + j, memory_order_acquire, memory_scope_device);
+				if (f == LB_PRE)
+				{
+					q = OP(pre[j], q);
+					break;
+				}
+				if (f == LB_AGG)
+					q = OP(agg[j], q), --j;
+			}
+			pre[t] = OP(q, total);
+			atomic_store_explicit(flag + t, LB_PRE, memory_order_release, memory_scope_device);
+		}
+		prefix = q;
+	}
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	scan_store(dst, len, base, exclusive, OP(prefix, p), x, B);
+}
+#endif
+#endif
@@ -0,0 +1,271 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+#include <climits>
+#include <cmath>
+#include <thread>
+#include "base.hpp"
+
+static int const IPT = 8;
+
+class OCL
+{
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue cqueue;
+	size_t wgs;
+	// OpenCL C 2.0, scan_lookback can be built
+	bool lookback;
+
+public:
+	OCL();
+	~OCL();
+
+	void init();
+	cl_program build(char const* defs);
+	void rts(cl_program P, cl_mem src, cl_mem dst, int len, int exclusive, size_t esize, vector<cl_event>& ev);
+	void single(cl_program P, cl_mem src, cl_mem dst, int len, int exclusive, size_t esize, vector<cl_event>& ev);
+	template <class T, class Op>
+	void family(char const* name, char const* defs, int type, double lo, double hi, Op op, T id);
+	void ops();
+};
+
+OCL::OCL()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+OCL::~OCL()
+{
+	if (cqueue) clReleaseCommandQueue(cqueue);
+	if (context) clReleaseContext(context);
+	if (device) clReleaseDevice(device);
+}
+
+void OCL::init()
+{
+	cl_int err;
+	CheckCLError(err = clGetPlatformIDs(1, &platform, NULL));
+	CheckCLError(err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL));
+	cl_context_properties prop[] = {
+		CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(platform),
+		0, 0};
+	CheckCLError(context = clCreateContext(prop, 1, &device, NULL, NULL, &err));
+	CheckCLError(cqueue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
+	CheckCLError(err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(wgs), &wgs, NULL));
+	// the tile of WGS * IPT elements is staged in local memory
+	wgs = min(wgs, static_cast<size_t>(256));
+	char ver[64] = {0};
+	int major = 0, minor = 0;
+	clGetDeviceInfo(device, CL_DEVICE_OPENCL_C_VERSION, sizeof(ver), ver, NULL);
+	sscanf(ver, "OpenCL C %d.%d", &major, &minor);
+	lookback = major >= 2;
+}
+
+// the program for one T and OP, with scan_lookback when the device has OpenCL C 2.0;
+// if that build fails lookback is cleared and it is built again for reduce-then-scan only
+cl_program OCL::build(char const* defs)
+{
+	cl_int err;
+	char info[4096] = {0};
+	string K = string(__FILE__);
+	K = K.substr(0, K.size() - 4) + ".cl";
+	K = loadCLFile(K.data());
+	char const* KS[] = {K.data()};
+	snprintf(info, sizeof(info), "%s-cl-kernel-arg-info -Werror -DWGS=%zd -DIPT=%d %s",
+		lookback ? "-cl-std=CL2.0 -DLOOKBACK " : "", wgs, IPT, defs);
+	CheckCLError(cl_program P = clCreateProgramWithSource(context, 1, KS, 0, &err));
+	err = clBuildProgram(P, 1, &device, info, NULL, NULL);
+	clGetProgramBuildInfo(P, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
+	fprintf(stderr, "build program with code %d, log:\n%s", err, info);
+	if (err)
+	{
+		clReleaseProgram(P);
+		if (!lookback)
+			return NULL;
+		lookback = false;
+		return build(defs);
+	}
+	CheckCLError(err = clGetProgramInfo(P, CL_PROGRAM_KERNEL_NAMES, sizeof(info), info, NULL));
+	fprintf(stderr, "kernel names: %s\n", info);
+	return P;
+}
+
+// reduce-then-scan of len elements of esize bytes: the OP of every tile, their exclusive scan (recursively), then every tile again;
+// the events of the kernels are appended to ev
+void OCL::rts(cl_program P, cl_mem src, cl_mem dst, int len, int exclusive, size_t esize, vector<cl_event>& ev)
+{
+	cl_int err;
+	cl_event e;
+	size_t const tile = wgs * IPT;
+	size_t const ntiles = (len + tile - 1) / tile;
+	size_t const sztot = ntiles * wgs;
+	CheckCLError(cl_mem part = clCreateBuffer(context, CL_MEM_READ_WRITE, ntiles * esize, NULL, &err));
+	CheckCLError(cl_kernel K = clCreateKernel(P, "scan_tiles", &err));
+	if (ntiles > 1)
+	{
+		CheckCLError(cl_kernel R = clCreateKernel(P, "scan_reduce", &err));
+		CheckCLError(err = clSetKernelArg(R, 0, sizeof(src), &src));
+		CheckCLError(err = clSetKernelArg(R, 1, sizeof(len), &len));
+		CheckCLError(err = clSetKernelArg(R, 2, sizeof(part), &part));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, R, 1, NULL, &sztot, &wgs, 0, NULL, &e));
+		CheckCLError(err = clReleaseKernel(R));
+		ev.push_back(e);
+		rts(P, part, part, static_cast<int>(ntiles), 1, esize, ev);
+	}
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(src), &src));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(dst), &dst));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(len), &len));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(exclusive), &exclusive));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(part), &part));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, &sztot, &wgs, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	ev.push_back(e);
+	CheckCLError(err = clReleaseMemObject(part));
+}
+
+// one scan_lookback over len elements of esize bytes, its event is appended to ev
+void OCL::single(cl_program P, cl_mem src, cl_mem dst, int len, int exclusive, size_t esize, vector<cl_event>& ev)
+{
+	cl_int err;
+	cl_event e;
+	cl_uint const zero = 0;
+	size_t const tile = wgs * IPT;
+	size_t const ntiles = (len + tile - 1) / tile;
+	size_t const sztot = ntiles * wgs;
+	CheckCLError(cl_mem counter = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(zero), NULL, &err));
+	CheckCLError(cl_mem flag = clCreateBuffer(context, CL_MEM_READ_WRITE, ntiles * sizeof(zero), NULL, &err));
+	CheckCLError(cl_mem agg = clCreateBuffer(context, CL_MEM_READ_WRITE, ntiles * esize, NULL, &err));
+	CheckCLError(cl_mem pre = clCreateBuffer(context, CL_MEM_READ_WRITE, ntiles * esize, NULL, &err));
+	CheckCLError(err = clEnqueueFillBuffer(cqueue, counter, &zero, sizeof(zero), 0, sizeof(zero), 0, NULL, NULL));
+	CheckCLError(err = clEnqueueFillBuffer(cqueue, flag, &zero, sizeof(zero), 0, ntiles * sizeof(zero), 0, NULL, NULL));
+	CheckCLError(cl_kernel K = clCreateKernel(P, "scan_lookback", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(src), &src));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(dst), &dst));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(len), &len));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(exclusive), &exclusive));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(counter), &counter));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(flag), &flag));
+	CheckCLError(err = clSetKernelArg(K, 6, sizeof(agg), &agg));
+	CheckCLError(err = clSetKernelArg(K, 7, sizeof(pre), &pre));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, &sztot, &wgs, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	ev.push_back(e);
+	CheckCLError(err = clReleaseMemObject(pre));
+	CheckCLError(err = clReleaseMemObject(agg));
+	CheckCLError(err = clReleaseMemObject(flag));
+	CheckCLError(err = clReleaseMemObject(counter));
+}
+
+template <class T, class Op>
+static void scan(T const* x, T* y, int n, int exclusive, Op op, T s)
+{
+	for (int i = 0; i < n; ++i)
+	{
+		T const t = op(s, x[i]);
+		y[i] = exclusive ? s : t;
+		s = t;
+	}
+}
+
+// the same in nt threads: the OP of every chunk, a serial scan of them, then every chunk again
+template <class T, class Op>
+static void scan_mt(T const* x, T* y, int n, int exclusive, Op op, T id, int nt)
+{
+	vector<std::thread> th(nt);
+	vector<T> part(nt + 1, id);
+	int const chunk = (n + nt - 1) / nt;
+	for (int t = 0; t < nt; ++t)
+		th[t] = std::thread([&, t]() {
+			for (int i = t * chunk, e = min(n, i + chunk); i < e; ++i)
+				part[t + 1] = op(part[t + 1], x[i]);
+		});
+	for (int t = 0; t < nt; ++t)
+		th[t].join();
+	for (int t = 0; t < nt; ++t)
+		part[t + 1] = op(part[t], part[t + 1]);
+	for (int t = 0; t < nt; ++t)
+		th[t] = std::thread([&, t]() {
+			int const i = t * chunk;
+			if (i < n)
+				scan(x + i, y + i, min(chunk, n - i), exclusive, op, part[t]);
+		});
+	for (int t = 0; t < nt; ++t)
+		th[t].join();
+}
+
+// inclusive and exclusive scans of 1 << 24 T in [lo, hi) by both kernels and the host threads,
+// against a serial scan on the host; the kernels are timed by their events, the host threads by the clock
+template <class T, class Op>
+void OCL::family(char const* name, char const* defs, int type, double lo, double hi, Op op, T id)
+{
+	cl_int err;
+	fprintf(stderr, "\n%s\n", name);
+	cl_program P = build(defs);
+	if (!P)
+		return;
+	Mat src(1 << 12, 1 << 12, type), ref(src.size(), type), dst(src.size(), type);
+	int const total = static_cast<int>(src.total());
+	int const nt = max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	randu(src, lo, hi);
+	CheckCLError(cl_mem M1 = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, total * sizeof(T), src.data, &err));
+	CheckCLError(cl_mem M2 = clCreateBuffer(context, CL_MEM_READ_WRITE, total * sizeof(T), NULL, &err));
+	for (int exclusive = 0; exclusive < 2; ++exclusive)
+	{
+		char const* mode = exclusive ? "exclusive" : "inclusive";
+		scan(src.ptr<T>(), ref.ptr<T>(), total, exclusive, op, id);
+		double const scale = max(1.0, norm(ref, cv::NORM_INF));
+		for (int k = 0; k < 3; ++k)
+		{
+			if (k == 0 && !lookback)
+				continue;
+			double ms = 0;
+			vector<cl_event> ev;
+			int64_t t = cv::getTickCount();
+			if (k == 0)
+				single(P, M1, M2, total, exclusive, sizeof(T), ev);
+			else if (k == 1)
+				rts(P, M1, M2, total, exclusive, sizeof(T), ev);
+			else
+			{
+				scan_mt(src.ptr<T>(), dst.ptr<T>(), total, exclusive, op, id, nt);
+				ms = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+			}
+			if (k < 2)
+			{
+				CheckCLError(err = clEnqueueReadBuffer(cqueue, M2, CL_TRUE, 0, total * sizeof(T), dst.data, 0, NULL, NULL));
+			}
+			for (size_t i = 0; i < ev.size(); ++i)
+			{
+				ms += getCLTime(ev[i], NULL);
+				clReleaseEvent(ev[i]);
+			}
+			char const* const how[] = {"lookback", "reduce-then-scan", "host threads"};
+			fprintf(stderr, "%s %s: %.2fms, %.2f Gelem/s, max |diff| / max |ref| = %g\n", how[k], mode, ms,
+				1e-6 * total / ms, norm(dst, ref, cv::NORM_INF) / scale);
+		}
+	}
+	CheckCLError(err = clReleaseMemObject(M2));
+	CheckCLError(err = clReleaseMemObject(M1));
+	CheckCLError(err = clReleaseProgram(P));
+}
+
+void OCL::ops()
+{
+	family<cl_int>("int", "-DT=int", CV_32S, -1000, 1000,
+		[](cl_int a, cl_int b) { return a + b; }, 0);
+	family<cl_uint>("uint", "-DT=uint", CV_32S, 0, 1000,
+		[](cl_uint a, cl_uint b) { return a + b; }, 0u);
+	family<cl_float>("float", "-DT=float", CV_32F, -1, 1,
+		[](cl_float a, cl_float b) { return a + b; }, 0.f);
+	// a custom OP, the running maximum
+	family<cl_int>("int max", "-DT=int -DOP(a,b)=max(a,b) -DID=INT_MIN", CV_32S, -1000000, 1000000,
+		[](cl_int a, cl_int b) { return max(a, b); }, INT_MIN);
+}
+
+int main()
+{
+	OCL ocl;
+	ocl.init();
+	ocl.ops();
+	fputs("Game Over!\n", stderr);
+}
@@ -0,0 +1,105 @@
+﻿#ifndef RADIX
+#	define RADIX 4
+#endif
+
+// LSD radix sort of KEY (uint or ulong) with optional uint values, RADIX bits a pass,
+// joined after scan.cl built with T=uint: the histograms are scanned with its kernels and the
+// ranks inside a tile with scan_group. a tile is the WGS * IPT keys of one work-group, as in scan.cl
+#ifdef KEY
+#define R (1 << RADIX)
+#define DIGIT(k) ((uint)((k) >> shift) & mask)
+
+// float (KEY = uint) or double (KEY = ulong) bits to keys that sort as unsigned, or back with inverse
+__kernel void sort_flip(__global KEY* keys, int const len, int const inverse)
+{
+	KEY const m = (KEY)1 << (sizeof(KEY) * 8 - 1);
+	int const i = get_global_id(0);
+	if (i >= len)
+		return;
+	KEY const k = keys[i];
+	if (inverse)
+		keys[i] = k ^ ((k & m) ? m : ~(KEY)0);
+	else
+		keys[i] = k ^ ((k & m) ? ~(KEY)0 : m);
+}
+
+// hist[d * tiles + tile] = the count of digit d = (key >> shift) & mask in the tile
+__kernel void sort_count(__global KEY const* keys, int const len, int const shift, uint const mask,
+	__global uint* hist)
+{
+	__local uint H[R];
+	int const li = get_local_id(0);
+	int const base = get_group_id(0) * WGS * IPT;
+	for (int i = li; i < R; i += WGS)
+		H[i] = 0;
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int k = 0; k < IPT; ++k)
+	{
+		int const i = base + k * WGS + li;
+		if (i < len)
+			atomic_inc(H + DIGIT(keys[i]));
+	}
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = li; i < R; i += WGS)
+		hist[i * get_num_groups(0) + get_group_id(0)] = H[i];
+}
+
+// hist[] scanned exclusively is where every digit of every tile starts in dst,
+// a key goes after the keys of the same digit before it in the tile, so each pass is stable
+__kernel void sort_scatter(__global KEY const* keys, __global uint const* vals, int const len,
+	int const shift, uint const mask, __global uint const* hist,
+	__global KEY* okeys, __global uint* ovals, int const with_val)
+{
+	__local uint C[R * WGS];
+	__local uint L[WGS];
+	__local uint G[R];
+	int const li = get_local_id(0);
+	int const tile = get_group_id(0);
+	int const base = tile * WGS * IPT + li * IPT;
+	KEY k[IPT];
+	uint c[R];
+	for (int d = 0; d < R; ++d)
+		c[d] = 0;
+	for (int j = 0; j < IPT; ++j)
+	{
+		int const i = base + j;
+		k[j] = i < len ? keys[i] : 0;
+		if (i < len)
+			++c[DIGIT(k[j])];
+	}
+	for (int d = 0; d < R; ++d)
+		C[d * WGS + li] = c[d];
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+
+	// exclusive scan of C[] in the order (digit, work-item), R entries in each work-item
+	uint s = 0;
+	for (int j = 0; j < R; ++j)
+		s += C[li * R + j];
+	s = scan_group(s, L) - s;
+	for (int j = 0; j < R; ++j)
+	{
+		uint const t = C[li * R + j];
+		C[li * R + j] = s;
+		s += t;
+	}
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	for (int d = li; d < R; d += WGS)
+		G[d] = hist[d * get_num_groups(0) + tile] - C[d * WGS];
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int d = 0; d < R; ++d)
+		c[d] = C[d * WGS + li] + G[d];
+	for (int j = 0; j < IPT; ++j)
+	{
+		int const i = base + j;
+		if (i >= len)
+			break;
+		uint const p = c[DIGIT(k[j])]++;
+		okeys[p] = k[j];
+		if (with_val)
+			ovals[p] = vals[i];
+	}
+}
+#endif
@@ -0,0 +1,325 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+#include <algorithm>
+#include <cmath>
+#include "base.hpp"
+
+static int const IPT = 8;
+static int const RADIX = 4;
+
+class OCL
+{
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue cqueue;
+	size_t wgs;
+	// OpenCL C 2.0, scan_lookback can be built
+	bool lookback;
+
+public:
+	OCL();
+	~OCL();
+
+	void init();
+	cl_program build(char const* key);
+	void scan(cl_program P, cl_mem buf, int len, vector<cl_event>& ev);
+	void sort(cl_program P, cl_mem keys, cl_mem vals, int len, size_t ksize, bool flip, int lo, int hi, vector<cl_event>& ev);
+	template <class K>
+	void bench(cl_program P, char const* name, int len, bool flip, bool with_val, int lo, int hi);
+	void work();
+};
+
+OCL::OCL()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+OCL::~OCL()
+{
+	if (cqueue) clReleaseCommandQueue(cqueue);
+	if (context) clReleaseContext(context);
+	if (device) clReleaseDevice(device);
+}
+
+void OCL::init()
+{
+	cl_int err;
+	CheckCLError(err = clGetPlatformIDs(1, &platform, NULL));
+	CheckCLError(err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL));
+	cl_context_properties prop[] = {
+		CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(platform),
+		0, 0};
+	CheckCLError(context = clCreateContext(prop, 1, &device, NULL, NULL, &err));
+	CheckCLError(cqueue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
+	CheckCLError(err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(wgs), &wgs, NULL));
+	wgs = min(wgs, static_cast<size_t>(256));
+	char ver[64] = {0};
+	int major = 0, minor = 0;
+	clGetDeviceInfo(device, CL_DEVICE_OPENCL_C_VERSION, sizeof(ver), ver, NULL);
+	sscanf(ver, "OpenCL C %d.%d", &major, &minor);
+	lookback = major >= 2;
+}
+
+// the program for one key type (uint or ulong); if the OpenCL C 2.0 build fails lookback is cleared
+// and it is built again, OCL::scan then takes reduce-then-scan
+cl_program OCL::build(char const* key)
+{
+	cl_int err;
+	char info[4096] = {0};
+	// the histograms are scanned by scan.cl, which has to come first
+	string K = string(__FILE__);
+	string G = K.substr(0, K.size() - strlen("sort.cpp")) + "scan.cl";
+	K = K.substr(0, K.size() - 4) + ".cl";
+	K = loadCLFile(K.data());
+	G = loadCLFile(G.data());
+	char const* KS[] = {G.data(), K.data()};
+	snprintf(info, sizeof(info), "%s-cl-kernel-arg-info -Werror -DWGS=%zd -DIPT=%d -DRADIX=%d -DT=uint -DKEY=%s",
+		lookback ? "-cl-std=CL2.0 -DLOOKBACK " : "", wgs, IPT, RADIX, key);
+	CheckCLError(cl_program P = clCreateProgramWithSource(context, 2, KS, 0, &err));
+	err = clBuildProgram(P, 1, &device, info, NULL, NULL);
+	clGetProgramBuildInfo(P, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
+	fprintf(stderr, "build program with code %d, log:\n%s", err, info);
+	if (err && lookback)
+	{
+		clReleaseProgram(P);
+		lookback = false;
+		return build(key);
+	}
+	CheckCLError((void)(err));
+	CheckCLError(err = clGetProgramInfo(P, CL_PROGRAM_KERNEL_NAMES, sizeof(info), info, NULL));
+	fprintf(stderr, "kernel names: %s\n", info);
+	return P;
+}
+
+// exclusive scan of len uint in place, as OCL::single and OCL::rts in scan.cpp,
+// the events of the enqueued commands are appended to ev
+void OCL::scan(cl_program P, cl_mem buf, int len, vector<cl_event>& ev)
+{
+	cl_int err;
+	cl_event e;
+	int const exclusive = 1;
+	cl_uint const zero = 0;
+	size_t const tile = wgs * IPT;
+	size_t const ntiles = (len + tile - 1) / tile;
+	size_t const sztot = ntiles * wgs;
+	CheckCLError(cl_mem part = clCreateBuffer(context, CL_MEM_READ_WRITE, ntiles * sizeof(zero), NULL, &err));
+	if (lookback)
+	{
+		CheckCLError(cl_mem counter = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(zero), NULL, &err));
+		CheckCLError(cl_mem flag = clCreateBuffer(context, CL_MEM_READ_WRITE, ntiles * sizeof(zero), NULL, &err));
+		CheckCLError(cl_mem agg = clCreateBuffer(context, CL_MEM_READ_WRITE, ntiles * sizeof(zero), NULL, &err));
+		CheckCLError(err = clEnqueueFillBuffer(cqueue, counter, &zero, sizeof(zero), 0, sizeof(zero), 0, NULL, &e));
+		ev.push_back(e);
+		CheckCLError(err = clEnqueueFillBuffer(cqueue, flag, &zero, sizeof(zero), 0, ntiles * sizeof(zero), 0, NULL, &e));
+		ev.push_back(e);
+		CheckCLError(cl_kernel K = clCreateKernel(P, "scan_lookback", &err));
+		CheckCLError(err = clSetKernelArg(K, 0, sizeof(buf), &buf));
+		CheckCLError(err = clSetKernelArg(K, 1, sizeof(buf), &buf));
+		CheckCLError(err = clSetKernelArg(K, 2, sizeof(len), &len));
+		CheckCLError(err = clSetKernelArg(K, 3, sizeof(exclusive), &exclusive));
+		CheckCLError(err = clSetKernelArg(K, 4, sizeof(counter), &counter));
+		CheckCLError(err = clSetKernelArg(K, 5, sizeof(flag), &flag));
+		CheckCLError(err = clSetKernelArg(K, 6, sizeof(agg), &agg));
+		CheckCLError(err = clSetKernelArg(K, 7, sizeof(part), &part));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, &sztot, &wgs, 0, NULL, &e));
+		CheckCLError(err = clReleaseKernel(K));
+		ev.push_back(e);
+		CheckCLError(err = clReleaseMemObject(agg));
+		CheckCLError(err = clReleaseMemObject(flag));
+		CheckCLError(err = clReleaseMemObject(counter));
+		CheckCLError(err = clReleaseMemObject(part));
+		return;
+	}
+	CheckCLError(cl_kernel K = clCreateKernel(P, "scan_tiles", &err));
+	if (ntiles > 1)
+	{
+		CheckCLError(cl_kernel R = clCreateKernel(P, "scan_reduce", &err));
+		CheckCLError(err = clSetKernelArg(R, 0, sizeof(buf), &buf));
+		CheckCLError(err = clSetKernelArg(R, 1, sizeof(len), &len));
+		CheckCLError(err = clSetKernelArg(R, 2, sizeof(part), &part));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, R, 1, NULL, &sztot, &wgs, 0, NULL, &e));
+		CheckCLError(err = clReleaseKernel(R));
+		ev.push_back(e);
+		scan(P, part, static_cast<int>(ntiles), ev);
+	}
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(buf), &buf));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(buf), &buf));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(len), &len));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(exclusive), &exclusive));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(part), &part));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, &sztot, &wgs, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	ev.push_back(e);
+	CheckCLError(err = clReleaseMemObject(part));
+}
+
+// sort len keys of ksize bytes by their bits [lo, hi), with the uint vals if not NULL, in place;
+// flip for float or double keys. the events of the enqueued commands are appended to ev
+void OCL::sort(cl_program P, cl_mem keys, cl_mem vals, int len, size_t ksize, bool flip, int lo, int hi, vector<cl_event>& ev)
+{
+	cl_int err;
+	cl_event e;
+	int const inverse[] = {0, 1};
+	int const with_val = vals != NULL;
+	size_t const tile = wgs * IPT;
+	size_t const ntiles = (len + tile - 1) / tile;
+	size_t const sztot = ntiles * wgs;
+	int const nhist = static_cast<int>(ntiles << RADIX);
+	cl_mem src[2] = {keys, vals}, dst[2];
+	CheckCLError(dst[0] = clCreateBuffer(context, CL_MEM_READ_WRITE, len * ksize, NULL, &err));
+	CheckCLError(dst[1] = clCreateBuffer(context, CL_MEM_READ_WRITE, with_val ? len * sizeof(cl_uint) : 1, NULL, &err));
+	CheckCLError(cl_mem hist = clCreateBuffer(context, CL_MEM_READ_WRITE, nhist * sizeof(cl_uint), NULL, &err));
+	CheckCLError(cl_kernel F = clCreateKernel(P, "sort_flip", &err));
+	CheckCLError(cl_kernel C = clCreateKernel(P, "sort_count", &err));
+	CheckCLError(cl_kernel S = clCreateKernel(P, "sort_scatter", &err));
+	CheckCLError(err = clSetKernelArg(F, 0, sizeof(keys), &keys));
+	CheckCLError(err = clSetKernelArg(F, 1, sizeof(len), &len));
+	if (flip)
+	{
+		size_t const szflip = (len + wgs - 1) / wgs * wgs;
+		CheckCLError(err = clSetKernelArg(F, 2, sizeof(int), inverse + 0));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, F, 1, NULL, &szflip, &wgs, 0, NULL, &e));
+		ev.push_back(e);
+	}
+	for (int shift = lo; shift < hi; shift += RADIX)
+	{
+		cl_uint const mask = (1u << min(RADIX, hi - shift)) - 1;
+		if (!with_val)
+			src[1] = dst[1];
+		CheckCLError(err = clSetKernelArg(C, 0, sizeof(src[0]), src + 0));
+		CheckCLError(err = clSetKernelArg(C, 1, sizeof(len), &len));
+		CheckCLError(err = clSetKernelArg(C, 2, sizeof(shift), &shift));
+		CheckCLError(err = clSetKernelArg(C, 3, sizeof(mask), &mask));
+		CheckCLError(err = clSetKernelArg(C, 4, sizeof(hist), &hist));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, C, 1, NULL, &sztot, &wgs, 0, NULL, &e));
+		ev.push_back(e);
+		scan(P, hist, nhist, ev);
+		CheckCLError(err = clSetKernelArg(S, 0, sizeof(src[0]), src + 0));
+		CheckCLError(err = clSetKernelArg(S, 1, sizeof(src[1]), src + 1));
+		CheckCLError(err = clSetKernelArg(S, 2, sizeof(len), &len));
+		CheckCLError(err = clSetKernelArg(S, 3, sizeof(shift), &shift));
+		CheckCLError(err = clSetKernelArg(S, 4, sizeof(mask), &mask));
+		CheckCLError(err = clSetKernelArg(S, 5, sizeof(hist), &hist));
+		CheckCLError(err = clSetKernelArg(S, 6, sizeof(dst[0]), dst + 0));
+		CheckCLError(err = clSetKernelArg(S, 7, sizeof(dst[1]), dst + 1));
+		CheckCLError(err = clSetKernelArg(S, 8, sizeof(with_val), &with_val));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, S, 1, NULL, &sztot, &wgs, 0, NULL, &e));
+		ev.push_back(e);
+		std::swap(src[0], dst[0]);
+		std::swap(src[1], dst[1]);
+	}
+	// an odd number of passes leaves the result in the scratch buffers
+	if (src[0] != keys)
+	{
+		CheckCLError(err = clEnqueueCopyBuffer(cqueue, src[0], keys, 0, 0, len * ksize, 0, NULL, &e));
+		ev.push_back(e);
+		if (with_val)
+		{
+			CheckCLError(err = clEnqueueCopyBuffer(cqueue, src[1], vals, 0, 0, len * sizeof(cl_uint), 0, NULL, &e));
+			ev.push_back(e);
+		}
+		std::swap(src[0], dst[0]);
+		std::swap(src[1], dst[1]);
+	}
+	if (flip)
+	{
+		size_t const szflip = (len + wgs - 1) / wgs * wgs;
+		CheckCLError(err = clSetKernelArg(F, 2, sizeof(int), inverse + 1));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, F, 1, NULL, &szflip, &wgs, 0, NULL, &e));
+		ev.push_back(e);
+	}
+	CheckCLError(err = clReleaseKernel(S));
+	CheckCLError(err = clReleaseKernel(C));
+	CheckCLError(err = clReleaseKernel(F));
+	CheckCLError(err = clReleaseMemObject(hist));
+	CheckCLError(err = clReleaseMemObject(dst[1]));
+	CheckCLError(err = clReleaseMemObject(dst[0]));
+}
+
+// the bits of float or double as sort_flip makes them
+template <class K>
+static K flipped(K k)
+{
+	K const m = static_cast<K>(1) << (sizeof(K) * 8 - 1);
+	return k ^ ((k & m) ? ~static_cast<K>(0) : m);
+}
+
+// sort len random K (the bits of a float or double if flip) by bits [lo, hi) against std::stable_sort,
+// the values are the original indices, so they check stability too. Mkeys/s is by the time of the
+// commands (events), the wall clock of sort() with its buffers and kernels is printed next to it
+template <class K>
+void OCL::bench(cl_program P, char const* name, int len, bool flip, bool with_val, int lo, int hi)
+{
+	cl_int err;
+	cv::RNG rng(len);
+	vector<K> key(len), res(len);
+	vector<cl_uint> val(len), idx(len), out(len);
+	for (int i = 0; i < len; ++i)
+	{
+		if (flip && sizeof(K) == 4)
+		{
+			float const f = rng.uniform(-1e3f, 1e3f);
+			memcpy(&key[i], &f, sizeof(f));
+		}
+		else if (flip)
+		{
+			double const f = rng.uniform(-1e3, 1e3);
+			memcpy(&key[i], &f, sizeof(f));
+		}
+		else
+			key[i] = static_cast<K>((static_cast<cl_ulong>(rng()) << 32) | rng());
+		val[i] = idx[i] = i;
+	}
+	CheckCLError(cl_mem M1 = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_WRITE, len * sizeof(K), key.data(), &err));
+	CheckCLError(cl_mem M2 = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_WRITE, len * sizeof(cl_uint), val.data(), &err));
+	clFinish(cqueue);
+	vector<cl_event> ev;
+	int64_t t = cv::getTickCount();
+	sort(P, M1, with_val ? M2 : NULL, len, sizeof(K), flip, lo, hi, ev);
+	clFinish(cqueue);
+	double const wall = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+	double ms = 0;
+	for (size_t i = 0; i < ev.size(); ++i)
+	{
+		ms += getCLTime(ev[i], NULL);
+		CheckCLError(err = clReleaseEvent(ev[i]));
+	}
+	CheckCLError(err = clEnqueueReadBuffer(cqueue, M1, CL_TRUE, 0, len * sizeof(K), res.data(), 0, NULL, NULL));
+	CheckCLError(err = clEnqueueReadBuffer(cqueue, M2, CL_TRUE, 0, len * sizeof(cl_uint), out.data(), 0, NULL, NULL));
+
+	K const mask = (hi - lo < static_cast<int>(sizeof(K) * 8)) ? (static_cast<K>(1) << (hi - lo)) - 1 : ~static_cast<K>(0);
+	auto digit = [&](K k) { return ((flip ? flipped(k) : k) >> lo) & mask; };
+	std::stable_sort(idx.begin(), idx.end(), [&](cl_uint a, cl_uint b) { return digit(key[a]) < digit(key[b]); });
+	int wrong = 0;
+	for (int i = 0; i < len; ++i)
+		wrong += res[i] != key[idx[i]] || (with_val && out[i] != idx[i]);
+	fprintf(stderr, "%s, %d keys: %.2fms, %.1f Mkeys/s, wall %.2fms, %d wrong\n", name, len, ms, 1e-3 * len / ms, wall, wrong);
+	CheckCLError(err = clReleaseMemObject(M2));
+	CheckCLError(err = clReleaseMemObject(M1));
+}
+
+void OCL::work()
+{
+	cl_int err;
+	cl_program P32 = build("uint");
+	cl_program P64 = build("ulong");
+	for (int len = 1 << 16; len <= (1 << 24); len <<= 4)
+	{
+		bench<cl_uint>(P32, "uint", len, false, false, 0, 32);
+		bench<cl_uint>(P32, "uint + value", len, false, true, 0, 32);
+		bench<cl_uint>(P32, "uint bits [8, 20) + value", len, false, true, 8, 20);
+		bench<cl_uint>(P32, "float", len, true, false, 0, 32);
+		bench<cl_ulong>(P64, "ulong", len, false, false, 0, 64);
+		bench<cl_ulong>(P64, "double + value", len, true, true, 0, 64);
+	}
+	CheckCLError(err = clReleaseProgram(P64));
+	CheckCLError(err = clReleaseProgram(P32));
+}
+
+int main()
+{
+	OCL ocl;
+	ocl.init();
+	ocl.work();
+	fputs("Game Over!\n", stderr);
+}
@@ -0,0 +1,194 @@
+﻿#ifndef WGS
+#	define WGS 256
+#endif
+
+// work-items per row of csr_vector and dense_gemv, a power of 2 dividing WGS
+#ifndef VS
+#	define VS 32
+#endif
+
+// rows + nonzeros per work-item of csr_merge
+#ifndef IPT
+#	define IPT 8
+#endif
+
+// A is M x N in CSR: the nonzeros of row h are val[ptr[h] .. ptr[h + 1]) in columns idx[...]
+
+// y = A * x, one work-item per row
+__kernel void csr_scalar(int const M, __global int const* ptr, __global int const* idx, __global float const* val,
+	__global float const* x, __global float* y)
+{
+	int const h = get_global_id(0);
+	if (h >= M)
+		return;
+	float s = 0;
+	for (int i = ptr[h]; i < ptr[h + 1]; ++i)
+		s += val[i] * x[idx[i]];
+	y[h] = s;
+}
+
+// y = A * x, VS work-items per row, reduced in local memory
+__kernel void csr_vector(int const M, __global int const* ptr, __global int const* idx, __global float const* val,
+	__global float const* x, __global float* y)
+{
+	int const li = get_local_id(0);
+	int const lane = li % VS;
+	int const h = get_global_id(0) / VS;
+	__local float S[WGS];
+	float s = 0;
+	if (h < M)
+		for (int i = ptr[h] + lane; i < ptr[h + 1]; i += VS)
+			s += val[i] * x[idx[i]];
+	S[li] = s;
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	for (int i = VS >> 1; i > 0; i >>= 1)
+	{
+		if (lane < i)
+			S[li] += S[li + i];
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lane == 0 && h < M)
+		y[h] = S[li];
+}
+
+// merge path: rows consumed at diagonal d of the merge of the row ends ptr[1 ..] with the nonzero indices
+inline int merge_search(int const d, int const M, int const nnz, __global int const* ptr)
+{
+	int lo = max(d - nnz, 0);
+	int hi = min(d, M);
+	while (lo < hi)
+	{
+		int const mid = (lo + hi) >> 1;
+		if (ptr[mid + 1] <= d - mid - 1)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// y = A * x, every work-item takes IPT rows + nonzeros whatever the row lengths are.
+// Rows ending inside a work-item are stored, the partial sum of the row it stops in goes to
+// (crow, cval) and is added by csr_fixup
+__kernel void csr_merge(int const M, int const nnz, __global int const* ptr, __global int const* idx, __global float const* val,
+	__global float const* x, __global float* y, __global int* crow, __global float* cval)
+{
+	int const gi = get_global_id(0);
+	int const total = M + nnz;
+	int const d0 = min(gi * IPT, total);
+	int const d1 = min(d0 + IPT, total);
+	int h = merge_search(d0, M, nnz, ptr);
+	int const h1 = merge_search(d1, M, nnz, ptr);
+	int i = d0 - h;
+	int const i1 = d1 - h1;
+	float s = 0;
+	for (; h < h1; ++h)
+	{
+		for (int e = ptr[h + 1]; i < e; ++i)
+			s += val[i] * x[idx[i]];
+		y[h] = s;
+		s = 0;
+	}
+	for (; i < i1; ++i)
+		s += val[i] * x[idx[i]];
+	crow[gi] = h1;
+	cval[gi] = s;
+}
+
+inline void atomic_addf(volatile __global float* p, float const v)
+{
+	uint old = as_uint(*p), cur;
+	do
+	{
+		cur = old;
+		old = atomic_cmpxchg((volatile __global uint*)(p), cur, as_uint(as_float(cur) + v));
+	} while (old != cur);
+}
+
+__kernel void csr_fixup(int const T, int const M, __global int const* crow, __global float const* cval, __global float* y)
+{
+	int const gi = get_global_id(0);
+	if (gi < T && crow[gi] < M && cval[gi] != 0)
+		atomic_addf(y + crow[gi], cval[gi]);
+}
+
+// y = A * x with A in ELL: W entries per row stored column by column, idx[k * M + h] < 0 pads
+__kernel void ell_spmv(int const M, int const W, __global int const* idx, __global float const* val,
+	__global float const* x, __global float* y)
+{
+	int const h = get_global_id(0);
+	if (h >= M)
+		return;
+	float s = 0;
+	for (int k = 0; k < W; ++k)
+	{
+		int const w = idx[mad24(k, M, h)];
+		if (w >= 0)
+			s += val[mad24(k, M, h)] * x[w];
+	}
+	y[h] = s;
+}
+
+// Y = A * X, X is N x Q and Y is M x Q, dense row-major
+__kernel void csr_spmm(int const M, int const Q, __global int const* ptr, __global int const* idx, __global float const* val,
+	__global float const* X, __global float* Y)
+{
+	int const w = get_global_id(0);
+	int const h = get_global_id(1);
+	if (h >= M || w >= Q)
+		return;
+	float s = 0;
+	for (int i = ptr[h]; i < ptr[h + 1]; ++i)
+		s += val[i] * X[mad24(idx[i], Q, w)];
+	Y[mad24(h, Q, w)] = s;
+}
+
+// y = A * x for a dense M x N A, as csr_vector
+__kernel void dense_gemv(int const M, int const N, __global float const* A, __global float const* x, __global float* y)
+{
+	int const li = get_local_id(0);
+	int const lane = li % VS;
+	int const h = get_global_id(0) / VS;
+	__local float S[WGS];
+	float s = 0;
+	if (h < M)
+		for (int i = lane; i < N; i += VS)
+			s += A[mad24(h, N, i)] * x[i];
+	S[li] = s;
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	for (int i = VS >> 1; i > 0; i >>= 1)
+	{
+		if (lane < i)
+			S[li] += S[li + i];
+		work_group_barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lane == 0 && h < M)
+		y[h] = S[li];
+}
+
+// dense M x N to CSR on the device: dense_count, exclusive scan of cnt into ptr, dense_fill
+__kernel void dense_count(int const M, int const N, __global float const* A, __global int* cnt)
+{
+	int const h = get_global_id(0);
+	if (h >= M)
+		return;
+	int n = 0;
+	for (int w = 0; w < N; ++w)
+		n += A[mad24(h, N, w)] != 0;
+	cnt[h] = n;
+}
+
+__kernel void dense_fill(int const M, int const N, __global float const* A, __global int const* ptr,
+	__global int* idx, __global float* val)
+{
+	int const h = get_global_id(0);
+	if (h >= M)
+		return;
+	int i = ptr[h];
+	for (int w = 0; w < N; ++w)
+	{
+		float const v = A[mad24(h, N, w)];
+		if (v != 0)
+			idx[i] = w, val[i++] = v;
+	}
+}
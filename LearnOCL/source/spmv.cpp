@@ -0,0 +1,505 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+#include <algorithm>
+#include <cmath>
+#include "base.hpp"
+
+static int const VS = 32;
+static int const IPT = 8;
+
+// compressed sparse rows, the nonzeros of row h are val[ptr[h] .. ptr[h + 1]) in columns idx[...]
+struct CSR
+{
+	int rows, cols;
+	vector<int> ptr, idx;
+	vector<float> val;
+};
+
+// CSR on the device
+struct DevCSR
+{
+	int rows, cols, nnz;
+	cl_mem ptr, idx, val;
+};
+
+enum SpMV
+{
+	SCALAR,
+	VECTOR,
+	MERGE,
+};
+
+static void dense2csr(Mat const& A, CSR& S)
+{
+	S.rows = A.rows, S.cols = A.cols;
+	S.ptr.assign(1, 0), S.idx.clear(), S.val.clear();
+	for (int h = 0; h < A.rows; ++h)
+	{
+		float const* a = A.ptr<float>(h);
+		for (int w = 0; w < A.cols; ++w)
+			if (a[w] != 0)
+				S.idx.push_back(w), S.val.push_back(a[w]);
+		S.ptr.push_back(static_cast<int>(S.idx.size()));
+	}
+}
+
+// COO triplets (h[i], w[i], v[i]) in any order, duplicates are summed
+static void coo2csr(int rows, int cols, vector<int> const& h, vector<int> const& w, vector<float> const& v, CSR& S)
+{
+	vector<int> order(h.size());
+	S.rows = rows, S.cols = cols;
+	S.ptr.assign(rows + 1, 0), S.idx.clear(), S.val.clear();
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = static_cast<int>(i);
+	std::sort(order.begin(), order.end(), [&](int a, int b) { return h[a] != h[b] ? h[a] < h[b] : w[a] < w[b]; });
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		int const k = order[i];
+		if (i && h[k] == h[order[i - 1]] && w[k] == w[order[i - 1]])
+		{
+			S.val.back() += v[k];
+			continue;
+		}
+		S.idx.push_back(w[k]), S.val.push_back(v[k]);
+		++S.ptr[h[k] + 1];
+	}
+	for (int i = 0; i < rows; ++i)
+		S.ptr[i + 1] += S.ptr[i];
+}
+
+// ELL as ell_spmv wants it, returns the width
+static int csr2ell(CSR const& S, vector<int>& idx, vector<float>& val)
+{
+	int W = 0;
+	for (int h = 0; h < S.rows; ++h)
+		W = max(W, S.ptr[h + 1] - S.ptr[h]);
+	idx.assign(static_cast<size_t>(W) * S.rows, -1);
+	val.assign(idx.size(), 0.f);
+	for (int h = 0; h < S.rows; ++h)
+		for (int i = S.ptr[h]; i < S.ptr[h + 1]; ++i)
+		{
+			size_t const k = static_cast<size_t>(i - S.ptr[h]) * S.rows + h;
+			idx[k] = S.idx[i], val[k] = S.val[i];
+		}
+	return W;
+}
+
+// random matrix with about density * cols nonzeros per row, every 64th row is 16 times longer
+static void sparse(Mat& A, double density, cv::RNG& rng)
+{
+	A.setTo(0);
+	for (int h = 0; h < A.rows; ++h)
+	{
+		double const n = density * A.cols * (h % 64 ? 64.0 / 79 : 16 * 64.0 / 79);
+		int const L = min(A.cols, static_cast<int>(n + rng.uniform(0.0, 1.0)));
+		for (int i = 0; i < L; ++i)
+			A.at<float>(h, rng.uniform(0, A.cols)) = rng.uniform(-1.f, 1.f);
+	}
+}
+
+// ms between start and end of e, which is released
+static double evtime(cl_event e)
+{
+	double const ms = getCLTime(e, NULL);
+	clReleaseEvent(e);
+	return ms;
+}
+
+class OCL
+{
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue cqueue;
+	cl_program program;
+	cl_uint cunits;
+	size_t cwgs;
+
+public:
+	OCL();
+	~OCL();
+
+	void init();
+	DevCSR upload(CSR const& S);
+	DevCSR dense2csr(cl_mem A, int M, int N);
+	void release(DevCSR& S);
+	double spmv(SpMV kind, DevCSR const& S, cl_mem x, cl_mem y);
+	double ell(int M, int W, cl_mem idx, cl_mem val, cl_mem x, cl_mem y);
+	double spmm(DevCSR const& S, int Q, cl_mem X, cl_mem Y);
+	double gemv(int M, int N, cl_mem A, cl_mem x, cl_mem y);
+	double gemm(int M, int N, int Q, cl_mem A, cl_mem B, cl_mem C);
+	void work();
+};
+
+OCL::OCL()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+OCL::~OCL()
+{
+	if (program) clReleaseProgram(program);
+	if (cqueue) clReleaseCommandQueue(cqueue);
+	if (context) clReleaseContext(context);
+	if (device) clReleaseDevice(device);
+}
+
+void OCL::init()
+{
+	cl_int err;
+	CheckCLError(err = clGetPlatformIDs(1, &platform, NULL));
+	CheckCLError(err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL));
+	cl_context_properties prop[] = {
+		CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(platform),
+		0, 0};
+	CheckCLError(context = clCreateContext(prop, 1, &device, NULL, NULL, &err));
+	CheckCLError(cqueue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
+	CheckCLError(err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cunits), &cunits, NULL));
+	CheckCLError(err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(cwgs), &cwgs, NULL));
+	cwgs = min(cwgs, static_cast<size_t>(256));
+	char info[4096] = {0};
+	// dense GEMM is matmul2 of matmul.cl
+	string K = string(__FILE__);
+	string G = K.substr(0, K.size() - strlen("spmv.cpp")) + "matmul.cl";
+	K = K.substr(0, K.size() - 4) + ".cl";
+	K = loadCLFile(K.data());
+	G = loadCLFile(G.data());
+	char const* KS[] = {K.data(), G.data()};
+	snprintf(info, sizeof(info), "-cl-kernel-arg-info -Werror -DWGS=%zd -DVS=%d -DIPT=%d -DTS=16 -DWS=4", cwgs, VS, IPT);
+	CheckCLError(program = clCreateProgramWithSource(context, 2, KS, 0, &err));
+	err = clBuildProgram(program, 1, &device, info, NULL, NULL);
+	clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
+	fprintf(stderr, "build program with code %d, log:\n%s", err, info);
+	CheckCLError((void)(err));
+	CheckCLError(err = clGetProgramInfo(program, CL_PROGRAM_KERNEL_NAMES, sizeof(info), info, NULL));
+	fprintf(stderr, "kernel names: %s\n", info);
+}
+
+DevCSR OCL::upload(CSR const& S)
+{
+	cl_int err;
+	DevCSR D;
+	D.rows = S.rows, D.cols = S.cols, D.nnz = static_cast<int>(S.idx.size());
+	// empty buffers are not allowed
+	size_t const n = max(S.idx.size(), static_cast<size_t>(1));
+	CheckCLError(D.ptr = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, S.ptr.size() * sizeof(int), const_cast<int*>(S.ptr.data()), &err));
+	CheckCLError(D.idx = clCreateBuffer(context, CL_MEM_READ_ONLY, n * sizeof(int), NULL, &err));
+	CheckCLError(D.val = clCreateBuffer(context, CL_MEM_READ_ONLY, n * sizeof(float), NULL, &err));
+	if (D.nnz)
+	{
+		CheckCLError(err = clEnqueueWriteBuffer(cqueue, D.idx, CL_TRUE, 0, D.nnz * sizeof(int), S.idx.data(), 0, NULL, NULL));
+		CheckCLError(err = clEnqueueWriteBuffer(cqueue, D.val, CL_TRUE, 0, D.nnz * sizeof(float), S.val.data(), 0, NULL, NULL));
+	}
+	return D;
+}
+
+// CSR of the dense M x N A on the device, the row counts are scanned on the host
+DevCSR OCL::dense2csr(cl_mem A, int M, int N)
+{
+	cl_int err;
+	DevCSR D;
+	vector<int> ptr(M + 1, 0);
+	Vec4z szlocal(cwgs), sztotal(M);
+	makeDiv(sztotal, szlocal);
+	D.rows = M, D.cols = N;
+	CheckCLError(D.ptr = clCreateBuffer(context, CL_MEM_READ_WRITE, ptr.size() * sizeof(int), NULL, &err));
+	CheckCLError(cl_kernel K = clCreateKernel(program, "dense_count", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(D.ptr), &D.ptr));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, sztotal.val, szlocal.val, 0, NULL, NULL));
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clEnqueueReadBuffer(cqueue, D.ptr, CL_TRUE, 0, M * sizeof(int), ptr.data() + 1, 0, NULL, NULL));
+	for (int i = 0; i < M; ++i)
+		ptr[i + 1] += ptr[i];
+	D.nnz = ptr[M];
+	size_t const n = max(D.nnz, 1);
+	CheckCLError(err = clEnqueueWriteBuffer(cqueue, D.ptr, CL_TRUE, 0, ptr.size() * sizeof(int), ptr.data(), 0, NULL, NULL));
+	CheckCLError(D.idx = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(int), NULL, &err));
+	CheckCLError(D.val = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(float), NULL, &err));
+	CheckCLError(K = clCreateKernel(program, "dense_fill", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(D.ptr), &D.ptr));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(D.idx), &D.idx));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(D.val), &D.val));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, sztotal.val, szlocal.val, 0, NULL, NULL));
+	CheckCLError(err = clReleaseKernel(K));
+	return D;
+}
+
+void OCL::release(DevCSR& S)
+{
+	if (S.ptr) clReleaseMemObject(S.ptr);
+	if (S.idx) clReleaseMemObject(S.idx);
+	if (S.val) clReleaseMemObject(S.val);
+	S.ptr = S.idx = S.val = NULL;
+}
+
+// y = S * x, returns the kernel time in ms, the merge path runs csr_merge and csr_fixup
+double OCL::spmv(SpMV kind, DevCSR const& S, cl_mem x, cl_mem y)
+{
+	cl_int err;
+	cl_event e;
+	char const* name[] = {"csr_scalar", "csr_vector", "csr_merge"};
+	int arg = 0;
+	int const T = (S.rows + S.nnz + IPT - 1) / IPT;
+	cl_mem crow = NULL, cval = NULL;
+	Vec4z szlocal(cwgs), sztotal(kind == SCALAR ? S.rows : kind == VECTOR ? S.rows * VS : T);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, name[kind], &err));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(S.rows), &S.rows));
+	if (kind == MERGE)
+	{
+		CheckCLError(err = clSetKernelArg(K, arg++, sizeof(S.nnz), &S.nnz));
+	}
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(S.ptr), &S.ptr));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(S.idx), &S.idx));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(S.val), &S.val));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(x), &x));
+	CheckCLError(err = clSetKernelArg(K, arg++, sizeof(y), &y));
+	if (kind == MERGE)
+	{
+		CheckCLError(crow = clCreateBuffer(context, CL_MEM_READ_WRITE, sztotal[0] * sizeof(int), NULL, &err));
+		CheckCLError(cval = clCreateBuffer(context, CL_MEM_READ_WRITE, sztotal[0] * sizeof(float), NULL, &err));
+		CheckCLError(err = clSetKernelArg(K, arg++, sizeof(crow), &crow));
+		CheckCLError(err = clSetKernelArg(K, arg++, sizeof(cval), &cval));
+	}
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	if (kind != MERGE)
+	{
+		CheckCLError(err = clWaitForEvents(1, &e));
+		return evtime(e);
+	}
+
+	cl_event f;
+	int const nt = static_cast<int>(sztotal[0]);
+	CheckCLError(K = clCreateKernel(program, "csr_fixup", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(nt), &nt));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(S.rows), &S.rows));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(crow), &crow));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(cval), &cval));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(y), &y));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, sztotal.val, szlocal.val, 0, NULL, &f));
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clReleaseMemObject(crow));
+	CheckCLError(err = clReleaseMemObject(cval));
+	CheckCLError(err = clWaitForEvents(1, &f));
+	return evtime(e) + evtime(f);
+}
+
+// y = A * x with A in ELL of width W
+double OCL::ell(int M, int W, cl_mem idx, cl_mem val, cl_mem x, cl_mem y)
+{
+	cl_int err;
+	cl_event e;
+	Vec4z szlocal(cwgs), sztotal(M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, "ell_spmv", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(W), &W));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(idx), &idx));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(val), &val));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(x), &x));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(y), &y));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clWaitForEvents(1, &e));
+	return evtime(e);
+}
+
+// Y = S * X, X has Q columns
+double OCL::spmm(DevCSR const& S, int Q, cl_mem X, cl_mem Y)
+{
+	cl_int err;
+	cl_event e;
+	Vec4z szlocal(16, 16), sztotal(Q, S.rows);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, "csr_spmm", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(S.rows), &S.rows));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(Q), &Q));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(S.ptr), &S.ptr));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(S.idx), &S.idx));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(S.val), &S.val));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(X), &X));
+	CheckCLError(err = clSetKernelArg(K, 6, sizeof(Y), &Y));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clWaitForEvents(1, &e));
+	return evtime(e);
+}
+
+double OCL::gemv(int M, int N, cl_mem A, cl_mem x, cl_mem y)
+{
+	cl_int err;
+	cl_event e;
+	Vec4z szlocal(cwgs), sztotal(M * VS);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, "dense_gemv", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(x), &x));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(y), &y));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 1, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clWaitForEvents(1, &e));
+	return evtime(e);
+}
+
+// C = A * B with matmul2
+double OCL::gemm(int M, int N, int Q, cl_mem A, cl_mem B, cl_mem C)
+{
+	cl_int err;
+	cl_event e;
+	Vec4z szlocal(16, 16), sztotal((Q + 3) / 4, M);
+	makeDiv(sztotal, szlocal);
+	CheckCLError(cl_kernel K = clCreateKernel(program, "matmul2", &err));
+	CheckCLError(err = clSetKernelArg(K, 0, sizeof(M), &M));
+	CheckCLError(err = clSetKernelArg(K, 1, sizeof(N), &N));
+	CheckCLError(err = clSetKernelArg(K, 2, sizeof(Q), &Q));
+	CheckCLError(err = clSetKernelArg(K, 3, sizeof(A), &A));
+	CheckCLError(err = clSetKernelArg(K, 4, sizeof(B), &B));
+	CheckCLError(err = clSetKernelArg(K, 5, sizeof(C), &C));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K, 2, NULL, sztotal.val, szlocal.val, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K));
+	CheckCLError(err = clWaitForEvents(1, &e));
+	return evtime(e);
+}
+
+void OCL::work()
+{
+	cl_int err;
+	int const M = 4096, N = 4096, Q = 64;
+	cv::RNG rng;
+	Mat A(M, N, CV_32F), X(N, Q, CV_32F), Y(M, Q, CV_32F), R(M, Q, CV_32F), y(M, 1, CV_32F);
+	randu(X, -1.0, 1.0);
+	CheckCLError(cl_mem a = clCreateBuffer(context, CL_MEM_READ_ONLY, A.total() * A.elemSize(), NULL, &err));
+	CheckCLError(cl_mem xm = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, X.total() * X.elemSize(), X.data, &err));
+	CheckCLError(cl_mem ym = clCreateBuffer(context, CL_MEM_READ_WRITE, Y.total() * Y.elemSize(), NULL, &err));
+	// the first column of X is the vector of SpMV
+	Mat x = X.col(0).clone();
+	CheckCLError(cl_mem xv = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, N * sizeof(float), x.data, &err));
+	CheckCLError(cl_mem yv = clCreateBuffer(context, CL_MEM_READ_WRITE, M * sizeof(float), NULL, &err));
+
+	// conversions and correctness
+	{
+		CSR S, T;
+		sparse(A, 0.01, rng);
+		CheckCLError(err = clEnqueueWriteBuffer(cqueue, a, CL_TRUE, 0, A.total() * A.elemSize(), A.data, 0, NULL, NULL));
+		::dense2csr(A, S);
+		DevCSR D = dense2csr(a, M, N);
+		T.rows = M, T.cols = N, T.ptr.resize(M + 1), T.idx.resize(D.nnz), T.val.resize(D.nnz);
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, D.ptr, CL_TRUE, 0, T.ptr.size() * sizeof(int), T.ptr.data(), 0, NULL, NULL));
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, D.idx, CL_TRUE, 0, T.idx.size() * sizeof(int), T.idx.data(), 0, NULL, NULL));
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, D.val, CL_TRUE, 0, T.val.size() * sizeof(float), T.val.data(), 0, NULL, NULL));
+		fprintf(stderr, "dense2csr host == device: %d\n", S.ptr == T.ptr && S.idx == T.idx && S.val == T.val);
+		// shuffled COO with every value split into two halves
+		vector<int> ch, cw;
+		vector<float> cval;
+		for (int h = 0; h < M; ++h)
+			for (int i = S.ptr[h]; i < S.ptr[h + 1]; ++i)
+				for (int k = 0; k < 2; ++k)
+					ch.push_back(h), cw.push_back(S.idx[i]), cval.push_back(S.val[i] * 0.5f);
+		for (size_t i = ch.size(); i > 1; --i)
+		{
+			size_t const j = rng.uniform(0, static_cast<int>(i));
+			std::swap(ch[i - 1], ch[j]), std::swap(cw[i - 1], cw[j]), std::swap(cval[i - 1], cval[j]);
+		}
+		coo2csr(M, N, ch, cw, cval, T);
+		fprintf(stderr, "coo2csr == dense2csr: %d\n", S.ptr == T.ptr && S.idx == T.idx && S.val == T.val);
+
+		vector<double> ref(M, 0.0);
+		double nrm = 0;
+		for (int h = 0; h < M; ++h)
+		{
+			for (int i = S.ptr[h]; i < S.ptr[h + 1]; ++i)
+				ref[h] += static_cast<double>(S.val[i]) * x.at<float>(S.idx[i]);
+			nrm = max(nrm, fabs(ref[h]));
+		}
+		char const* name[] = {"csr_scalar", "csr_vector", "csr_merge"};
+		for (int k = SCALAR; k <= MERGE; ++k)
+		{
+			// every row must be written
+			float const junk = 1e30f;
+			CheckCLError(err = clEnqueueFillBuffer(cqueue, yv, &junk, sizeof(junk), 0, M * sizeof(float), 0, NULL, NULL));
+			double ms = spmv(static_cast<SpMV>(k), D, xv, yv);
+			CheckCLError(err = clEnqueueReadBuffer(cqueue, yv, CL_TRUE, 0, M * sizeof(float), y.data, 0, NULL, NULL));
+			double dif = 0;
+			for (int h = 0; h < M; ++h)
+				dif = max(dif, fabs(y.at<float>(h) - ref[h]));
+			fprintf(stderr, "%s: %.3fms, max difference = %g\n", name[k], ms, dif / nrm);
+		}
+		vector<int> ei;
+		vector<float> ev;
+		int const W = csr2ell(S, ei, ev);
+		CheckCLError(cl_mem ii = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, ei.size() * sizeof(int), ei.data(), &err));
+		CheckCLError(cl_mem vv = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, ev.size() * sizeof(float), ev.data(), &err));
+		double ms = ell(M, W, ii, vv, xv, yv);
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, yv, CL_TRUE, 0, M * sizeof(float), y.data, 0, NULL, NULL));
+		double dif = 0;
+		for (int h = 0; h < M; ++h)
+			dif = max(dif, fabs(y.at<float>(h) - ref[h]));
+		fprintf(stderr, "ell_spmv (width %d): %.3fms, max difference = %g\n", W, ms, dif / nrm);
+		CheckCLError(err = clReleaseMemObject(ii));
+		CheckCLError(err = clReleaseMemObject(vv));
+
+		ms = spmm(D, Q, xm, ym);
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, ym, CL_TRUE, 0, Y.total() * Y.elemSize(), Y.data, 0, NULL, NULL));
+		cv::gemm(A, X, 1, Mat(), 0, R);
+		fprintf(stderr, "csr_spmm: %.3fms, max difference = %g\n", ms, norm(Y, R, cv::NORM_INF) / norm(R, cv::NORM_INF));
+		release(D);
+		fflush(stderr);
+	}
+
+	// density sweep, the crossover is the lowest density at which the dense kernel wins
+	double const density[] = {1e-4, 1e-3, 3e-3, 0.01, 0.03, 0.1, 0.2, 0.4};
+	double cross1 = 0, cross2 = 0;
+	fprintf(stderr, "\ndensity  scalar  vector   merge     ell  | gemv  ||  spmm  | gemm (ms)\n");
+	for (size_t d = 0; d < _countof(density); ++d)
+	{
+		CSR S;
+		vector<int> ei;
+		vector<float> ev;
+		sparse(A, density[d], rng);
+		::dense2csr(A, S);
+		int const W = csr2ell(S, ei, ev);
+		CheckCLError(err = clEnqueueWriteBuffer(cqueue, a, CL_TRUE, 0, A.total() * A.elemSize(), A.data, 0, NULL, NULL));
+		CheckCLError(cl_mem ii = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, ei.size() * sizeof(int), ei.data(), &err));
+		CheckCLError(cl_mem vv = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, ev.size() * sizeof(float), ev.data(), &err));
+		DevCSR D = upload(S);
+		double t[7];
+		for (int k = SCALAR; k <= MERGE; ++k)
+			t[k] = spmv(static_cast<SpMV>(k), D, xv, yv);
+		t[3] = ell(M, W, ii, vv, xv, yv);
+		t[4] = gemv(M, N, a, xv, yv);
+		t[5] = spmm(D, Q, xm, ym);
+		t[6] = gemm(M, N, Q, a, xm, ym);
+		fprintf(stderr, "%7.4f %7.3f %7.3f %7.3f %7.3f | %7.3f || %7.3f | %7.3f\n",
+			density[d], t[0], t[1], t[2], t[3], t[4], t[5], t[6]);
+		double const best = std::min(std::min(t[0], t[1]), std::min(t[2], t[3]));
+		if (!cross1 && t[4] < best)
+			cross1 = density[d];
+		if (!cross2 && t[6] < t[5])
+			cross2 = density[d];
+		release(D);
+		CheckCLError(err = clReleaseMemObject(ii));
+		CheckCLError(err = clReleaseMemObject(vv));
+	}
+	fprintf(stderr, "dense wins from density %g for SpMV, %g for SpMM (0: never)\n", cross1, cross2);
+	CheckCLError(err = clReleaseMemObject(a));
+	CheckCLError(err = clReleaseMemObject(xm));
+	CheckCLError(err = clReleaseMemObject(ym));
+	CheckCLError(err = clReleaseMemObject(xv));
+	CheckCLError(err = clReleaseMemObject(yv));
+}
+
+int main()
+{
+	OCL ocl;
+	ocl.init();
+	ocl.work();
+	fputs("Game Over!\n", stderr);
+}
@@ -0,0 +1,167 @@
+﻿#ifndef WGS
+#	define WGS 0
+#endif
+
+// the k largest of each row of a rows x cols float matrix, with their column indices (no NaN):
+// small k by bitonic sorts of tiles merged level by level, large k by radix select
+#define TILE (WGS * 2)
+
+// float bits that order as uint, as sort_flip in sort.cl
+inline uint flip(float x)
+{
+	uint const u = as_uint(x);
+	return u ^ ((u >> 31) ? 0xffffffffu : 0x80000000u);
+}
+
+// V[TILE], I[TILE] in local memory sorted by value descending, the smaller index first among equals
+inline void bitonic(__local float* V, __local int* I)
+{
+	int const li = get_local_id(0);
+	for (int size = 2; size <= TILE; size <<= 1)
+		for (int stride = size >> 1; stride > 0; stride >>= 1)
+		{
+			work_group_barrier(CLK_LOCAL_MEM_FENCE);
+			int const a = 2 * li - (li & (stride - 1));
+			int const b = a + stride;
+			float const va = V[a], vb = V[b];
+			int const ia = I[a], ib = I[b];
+			bool const first = vb > va || (vb == va && ib < ia);
+			if (first == ((a & size) == 0))
+			{
+				V[a] = vb, V[b] = va;
+				I[a] = ib, I[b] = ia;
+			}
+		}
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+// the m first of the sorted tile to ov, oi + (row * get_num_groups(0) + group) * m
+inline void bitonic_store(__local float const* V, __local int const* I, int const m,
+	__global float* ov, __global int* oi)
+{
+	int const o = (get_group_id(1) * get_num_groups(0) + get_group_id(0)) * m;
+	for (int j = get_local_id(0); j < m; j += WGS)
+		ov[o + j] = V[j], oi[o + j] = I[j];
+}
+
+// the top m (a power of 2 up to WGS, or k for the last level) of every TILE columns of row get_group_id(1)
+__kernel void topk_block(__global float const* src, int const cols, int const m,
+	__global float* ov, __global int* oi)
+{
+	__local float V[TILE];
+	__local int I[TILE];
+	int const li = get_local_id(0);
+	int const base = get_group_id(0) * TILE;
+	__global float const* s = src + get_group_id(1) * cols;
+	for (int j = li; j < TILE; j += WGS)
+	{
+		bool const in = base + j < cols;
+		V[j] = in ? s[base + j] : -INFINITY;
+		I[j] = in ? base + j : INT_MAX;
+	}
+	bitonic(V, I);
+	bitonic_store(V, I, m, ov, oi);
+}
+
+// the top m of every TILE / K2 of the n sorted lists of K2 in each row from the level before
+__kernel void topk_merge(__global float const* iv, __global int const* ii, int const n, int const K2,
+	int const m, __global float* ov, __global int* oi)
+{
+	__local float V[TILE];
+	__local int I[TILE];
+	int const li = get_local_id(0);
+	int const base = get_group_id(0) * TILE;
+	int const o = get_group_id(1) * n * K2;
+	for (int j = li; j < TILE; j += WGS)
+	{
+		bool const in = base + j < n * K2;
+		V[j] = in ? iv[o + base + j] : -INFINITY;
+		I[j] = in ? ii[o + base + j] : INT_MAX;
+	}
+	bitonic(V, I);
+	bitonic_store(V, I, m, ov, oi);
+}
+
+// radix select, 8 bits a pass from the top: the flipped bits of the k-th largest of a row agree with
+// prefix on mask, and krem of the keys equal to it are still to take. gt and eq count the taken ones
+typedef struct
+{
+	uint prefix, mask;
+	int krem;
+	uint gt, eq;
+} select_state;
+
+// hist[row][digit] += the count of the keys of the row that match the prefix, by the digit at shift;
+// work-groups (x, row)
+__kernel void select_count(__global float const* src, int const cols, int const shift,
+	__global select_state const* S, __global uint* hist)
+{
+	__local uint H[256];
+	int const li = get_local_id(0);
+	int const row = get_group_id(1);
+	__global float const* s = src + row * cols;
+	uint const prefix = S[row].prefix, mask = S[row].mask;
+	for (int i = li; i < 256; i += WGS)
+		H[i] = 0;
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = get_global_id(0); i < cols; i += get_global_size(0))
+	{
+		uint const u = flip(s[i]);
+		if ((u & mask) == prefix)
+			atomic_inc(H + ((u >> shift) & 255));
+	}
+	work_group_barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = li; i < 256; i += WGS)
+		if (H[i])
+			atomic_add(hist + row * 256 + i, H[i]);
+}
+
+// the digit at shift of the k-th largest, one work-item a row
+__kernel void select_find(__global uint const* hist, int const rows, int const shift,
+	__global select_state* S)
+{
+	int const row = get_global_id(0);
+	if (row >= rows)
+		return;
+	uint acc = 0;
+	uint const krem = S[row].krem;
+	for (int b = 255; b >= 0; --b)
+	{
+		uint const h = hist[row * 256 + b];
+		if (acc + h >= krem)
+		{
+			S[row].prefix |= (uint)b << shift;
+			S[row].mask |= 255u << shift;
+			S[row].krem = krem - acc;
+			return;
+		}
+		acc += h;
+	}
+}
+
+// the keys above the k-th largest and the first krem equal to it (in no particular order)
+// to ov, oi + row * k
+__kernel void select_gather(__global float const* src, int const cols, int const k,
+	__global select_state* S, __global float* ov, __global int* oi)
+{
+	int const row = get_group_id(1);
+	__global float const* s = src + row * cols;
+	uint const t = S[row].prefix;
+	int const krem = S[row].krem;
+	for (int i = get_global_id(0); i < cols; i += get_global_size(0))
+	{
+		uint const u = flip(s[i]);
+		int p = -1;
+		if (u > t)
+			p = atomic_inc(&S[row].gt);
+		else if (u == t)
+		{
+			p = atomic_inc(&S[row].eq);
+			p = p < krem ? k - krem + p : -1;
+		}
+		if (p >= 0)
+			ov[row * k + p] = s[i], oi[row * k + p] = i;
+	}
+}
@@ -0,0 +1,263 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+#include <algorithm>
+#include <cmath>
+#include "base.hpp"
+
+// select_state of topk.cl
+struct SelectState
+{
+	cl_uint prefix, mask;
+	cl_int krem;
+	cl_uint gt, eq;
+};
+
+class OCL
+{
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue cqueue;
+	cl_program program;
+	cl_uint cunits;
+	size_t wgs;
+
+public:
+	OCL();
+	~OCL();
+
+	void init();
+	void bitonic(cl_mem src, int rows, int cols, int k, cl_mem vals, cl_mem idx, vector<cl_event>& ev);
+	void select(cl_mem src, int rows, int cols, int k, cl_mem vals, cl_mem idx, vector<cl_event>& ev);
+	void topk(cl_mem src, int rows, int cols, int k, cl_mem vals, cl_mem idx, vector<cl_event>& ev);
+	void work();
+};
+
+OCL::OCL()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+OCL::~OCL()
+{
+	if (program) clReleaseProgram(program);
+	if (cqueue) clReleaseCommandQueue(cqueue);
+	if (context) clReleaseContext(context);
+	if (device) clReleaseDevice(device);
+}
+
+void OCL::init()
+{
+	cl_int err;
+	CheckCLError(err = clGetPlatformIDs(1, &platform, NULL));
+	CheckCLError(err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL));
+	cl_context_properties prop[] = {
+		CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(platform),
+		0, 0};
+	CheckCLError(context = clCreateContext(prop, 1, &device, NULL, NULL, &err));
+	CheckCLError(cqueue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
+	CheckCLError(err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cunits), &cunits, NULL));
+	CheckCLError(err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(wgs), &wgs, NULL));
+	wgs = min(wgs, static_cast<size_t>(256));
+	char info[4096] = {0};
+	string K = string(__FILE__);
+	K = K.substr(0, K.size() - 4) + ".cl";
+	K = loadCLFile(K.data());
+	char const* KS[] = {K.data()};
+	snprintf(info, sizeof(info), "-cl-kernel-arg-info -Werror -DWGS=%zd", wgs);
+	CheckCLError(program = clCreateProgramWithSource(context, 1, KS, 0, &err));
+	err = clBuildProgram(program, 1, &device, info, NULL, NULL);
+	clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(info), info, NULL);
+	fprintf(stderr, "build program with code %d, log:\n%s", err, info);
+	CheckCLError((void)(err));
+	CheckCLError(err = clGetProgramInfo(program, CL_PROGRAM_KERNEL_NAMES, sizeof(info), info, NULL));
+	fprintf(stderr, "kernel names: %s\n", info);
+}
+
+// k <= wgs: the top K2 (k rounded up to a power of 2) of every tile of 2 * wgs, then of every
+// 2 * wgs / K2 of those lists and so on, the last level writes k of each row sorted descending
+void OCL::bitonic(cl_mem src, int rows, int cols, int k, cl_mem vals, cl_mem idx, vector<cl_event>& ev)
+{
+	cl_int err;
+	cl_event e;
+	int const tile = static_cast<int>(wgs * 2);
+	int K2 = 1;
+	while (K2 < k)
+		K2 <<= 1;
+	int n = (cols + tile - 1) / tile;
+	int m = n > 1 ? K2 : k;
+	cl_mem tv[2] = {vals, vals}, ti[2] = {idx, idx};
+	if (n > 1)
+	{
+		CheckCLError(tv[0] = clCreateBuffer(context, CL_MEM_READ_WRITE, rows * n * K2 * sizeof(float), NULL, &err));
+		CheckCLError(ti[0] = clCreateBuffer(context, CL_MEM_READ_WRITE, rows * n * K2 * sizeof(int), NULL, &err));
+		CheckCLError(tv[1] = clCreateBuffer(context, CL_MEM_READ_WRITE, rows * n * K2 * sizeof(float), NULL, &err));
+		CheckCLError(ti[1] = clCreateBuffer(context, CL_MEM_READ_WRITE, rows * n * K2 * sizeof(int), NULL, &err));
+	}
+	cl_mem ov = n > 1 ? tv[0] : vals, oi = n > 1 ? ti[0] : idx;
+	size_t szloc[] = {wgs, 1}, sztot[] = {n * wgs, static_cast<size_t>(rows)};
+	CheckCLError(cl_kernel K1 = clCreateKernel(program, "topk_block", &err));
+	CheckCLError(err = clSetKernelArg(K1, 0, sizeof(src), &src));
+	CheckCLError(err = clSetKernelArg(K1, 1, sizeof(cols), &cols));
+	CheckCLError(err = clSetKernelArg(K1, 2, sizeof(m), &m));
+	CheckCLError(err = clSetKernelArg(K1, 3, sizeof(ov), &ov));
+	CheckCLError(err = clSetKernelArg(K1, 4, sizeof(oi), &oi));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K1, 2, NULL, sztot, szloc, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K1));
+	ev.push_back(e);
+	CheckCLError(cl_kernel K2m = clCreateKernel(program, "topk_merge", &err));
+	for (int level = 1; n > 1; ++level)
+	{
+		int const lists = tile / K2;
+		int const nout = (n + lists - 1) / lists;
+		cl_mem const iv = ov, ii = oi;
+		m = nout > 1 ? K2 : k;
+		ov = nout > 1 ? tv[level & 1] : vals;
+		oi = nout > 1 ? ti[level & 1] : idx;
+		sztot[0] = nout * wgs;
+		CheckCLError(err = clSetKernelArg(K2m, 0, sizeof(iv), &iv));
+		CheckCLError(err = clSetKernelArg(K2m, 1, sizeof(ii), &ii));
+		CheckCLError(err = clSetKernelArg(K2m, 2, sizeof(n), &n));
+		CheckCLError(err = clSetKernelArg(K2m, 3, sizeof(K2), &K2));
+		CheckCLError(err = clSetKernelArg(K2m, 4, sizeof(m), &m));
+		CheckCLError(err = clSetKernelArg(K2m, 5, sizeof(ov), &ov));
+		CheckCLError(err = clSetKernelArg(K2m, 6, sizeof(oi), &oi));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K2m, 2, NULL, sztot, szloc, 0, NULL, &e));
+		ev.push_back(e);
+		n = nout;
+	}
+	CheckCLError(err = clReleaseKernel(K2m));
+	if (tv[0] != vals)
+	{
+		CheckCLError(err = clReleaseMemObject(ti[1]));
+		CheckCLError(err = clReleaseMemObject(tv[1]));
+		CheckCLError(err = clReleaseMemObject(ti[0]));
+		CheckCLError(err = clReleaseMemObject(tv[0]));
+	}
+}
+
+// large k: 4 passes of select_count and select_find narrow down the k-th largest of every row,
+// select_gather takes the k largest, in no particular order
+void OCL::select(cl_mem src, int rows, int cols, int k, cl_mem vals, cl_mem idx, vector<cl_event>& ev)
+{
+	cl_int err;
+	cl_event e;
+	cl_uint const zero = 0;
+	SelectState const s0 = {0, 0, k, 0, 0};
+	vector<SelectState> state(rows, s0);
+	size_t const groups = clamp(static_cast<size_t>(cunits) * 4 / rows, static_cast<size_t>(1), (cols + wgs - 1) / wgs);
+	size_t const szloc[] = {wgs, 1}, sztot[] = {groups * wgs, static_cast<size_t>(rows)};
+	size_t const szrow = (rows + wgs - 1) / wgs * wgs;
+	CheckCLError(cl_mem S = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_WRITE, rows * sizeof(SelectState), state.data(), &err));
+	CheckCLError(cl_mem hist = clCreateBuffer(context, CL_MEM_READ_WRITE, rows * 256 * sizeof(cl_uint), NULL, &err));
+	CheckCLError(cl_kernel K1 = clCreateKernel(program, "select_count", &err));
+	CheckCLError(cl_kernel K2 = clCreateKernel(program, "select_find", &err));
+	CheckCLError(cl_kernel K3 = clCreateKernel(program, "select_gather", &err));
+	CheckCLError(err = clSetKernelArg(K1, 0, sizeof(src), &src));
+	CheckCLError(err = clSetKernelArg(K1, 1, sizeof(cols), &cols));
+	CheckCLError(err = clSetKernelArg(K1, 3, sizeof(S), &S));
+	CheckCLError(err = clSetKernelArg(K1, 4, sizeof(hist), &hist));
+	CheckCLError(err = clSetKernelArg(K2, 0, sizeof(hist), &hist));
+	CheckCLError(err = clSetKernelArg(K2, 1, sizeof(rows), &rows));
+	CheckCLError(err = clSetKernelArg(K2, 3, sizeof(S), &S));
+	for (int shift = 24; shift >= 0; shift -= 8)
+	{
+		CheckCLError(err = clEnqueueFillBuffer(cqueue, hist, &zero, sizeof(zero), 0, rows * 256 * sizeof(cl_uint), 0, NULL, &e));
+		ev.push_back(e);
+		CheckCLError(err = clSetKernelArg(K1, 2, sizeof(shift), &shift));
+		CheckCLError(err = clSetKernelArg(K2, 2, sizeof(shift), &shift));
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K1, 2, NULL, sztot, szloc, 0, NULL, &e));
+		ev.push_back(e);
+		CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K2, 1, NULL, &szrow, &wgs, 0, NULL, &e));
+		ev.push_back(e);
+	}
+	CheckCLError(err = clSetKernelArg(K3, 0, sizeof(src), &src));
+	CheckCLError(err = clSetKernelArg(K3, 1, sizeof(cols), &cols));
+	CheckCLError(err = clSetKernelArg(K3, 2, sizeof(k), &k));
+	CheckCLError(err = clSetKernelArg(K3, 3, sizeof(S), &S));
+	CheckCLError(err = clSetKernelArg(K3, 4, sizeof(vals), &vals));
+	CheckCLError(err = clSetKernelArg(K3, 5, sizeof(idx), &idx));
+	CheckCLError(err = clEnqueueNDRangeKernel(cqueue, K3, 2, NULL, sztot, szloc, 0, NULL, &e));
+	CheckCLError(err = clReleaseKernel(K3));
+	ev.push_back(e);
+	CheckCLError(err = clReleaseKernel(K2));
+	CheckCLError(err = clReleaseKernel(K1));
+	CheckCLError(err = clReleaseMemObject(hist));
+	CheckCLError(err = clReleaseMemObject(S));
+}
+
+// the k (<= cols) largest of each of the rows of src to vals[rows][k] and their columns to idx[rows][k],
+// the events of the enqueued commands are appended to ev
+void OCL::topk(cl_mem src, int rows, int cols, int k, cl_mem vals, cl_mem idx, vector<cl_event>& ev)
+{
+	if (k <= static_cast<int>(wgs))
+		bitonic(src, rows, cols, k, vals, idx, ev);
+	else
+		select(src, rows, cols, k, vals, idx, ev);
+}
+
+// top-k of rows x cols random floats against a full readback and std::partial_sort on the host,
+// the device time is that of the kernels (by events) and the wall clock of topk and the readback of the result
+void OCL::work()
+{
+	cl_int err;
+	int const rows = 8, cols = 1 << 20;
+	int const ks[] = {1, 10, 100, 256, 1000, 10000};
+	Mat src(rows, cols, CV_32F), back(rows, cols, CV_32F);
+	randu(src, -1, 1);
+	CheckCLError(cl_mem M1 = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR + CL_MEM_READ_ONLY, src.total() * sizeof(float), src.data, &err));
+	for (int k : ks)
+	{
+		vector<float> vals(rows * k);
+		vector<int> idx(rows * k), order(cols);
+		CheckCLError(cl_mem M2 = clCreateBuffer(context, CL_MEM_WRITE_ONLY, rows * k * sizeof(float), NULL, &err));
+		CheckCLError(cl_mem M3 = clCreateBuffer(context, CL_MEM_WRITE_ONLY, rows * k * sizeof(int), NULL, &err));
+		vector<cl_event> ev;
+		int64_t t = cv::getTickCount();
+		topk(M1, rows, cols, k, M2, M3, ev);
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, M2, CL_TRUE, 0, vals.size() * sizeof(float), vals.data(), 0, NULL, NULL));
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, M3, CL_TRUE, 0, idx.size() * sizeof(int), idx.data(), 0, NULL, NULL));
+		double const wall = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+		double ms = 0;
+		for (size_t i = 0; i < ev.size(); ++i)
+		{
+			ms += getCLTime(ev[i], NULL);
+			clReleaseEvent(ev[i]);
+		}
+
+		t = cv::getTickCount();
+		CheckCLError(err = clEnqueueReadBuffer(cqueue, M1, CL_TRUE, 0, back.total() * sizeof(float), back.data, 0, NULL, NULL));
+		int wrong = 0;
+		for (int h = 0; h < rows; ++h)
+		{
+			float const* x = back.ptr<float>(h);
+			for (int i = 0; i < cols; ++i)
+				order[i] = i;
+			std::partial_sort(order.begin(), order.begin() + k, order.end(),
+				[x](int a, int b) { return x[a] > x[b] || (x[a] == x[b] && a < b); });
+			// select returns them unordered, and any of the keys equal to the k-th largest
+			float* v = vals.data() + h * k;
+			int const* i = idx.data() + h * k;
+			bool const sel = k > static_cast<int>(wgs);
+			for (int j = 0; j < k; ++j)
+				wrong += x[i[j]] != v[j];
+			if (sel)
+				std::sort(v, v + k, [](float a, float b) { return a > b; });
+			for (int j = 0; j < k; ++j)
+				wrong += v[j] != x[order[j]] || (!sel && i[j] != order[j]);
+		}
+		double const host = (cv::getTickCount() - t) * 1e3 / cv::getTickFrequency();
+		fprintf(stderr, "top %d of %d x %d: kernels %.2fms, wall %.2fms (%s), readback + partial_sort %.2fms, %d wrong\n",
+			k, rows, cols, ms, wall, k <= static_cast<int>(wgs) ? "bitonic" : "radix select", host, wrong);
+		CheckCLError(err = clReleaseMemObject(M3));
+		CheckCLError(err = clReleaseMemObject(M2));
+	}
+	CheckCLError(err = clReleaseMemObject(M1));
+}
+
+int main()
+{
+	OCL ocl;
+	ocl.init();
+	ocl.work();
+	fputs("Game Over!\n", stderr);
+}